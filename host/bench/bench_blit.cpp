@@ -0,0 +1,62 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "drivers/inkplate_framebuffer.h"
+#include "reference_blit.h"
+
+// the Inkplate 10 panel and the default esp-mqtt buffer
+static constexpr int WIDTH = 1200;
+static constexpr int HEIGHT = 825;
+static constexpr size_t CHUNK_SIZE = 1024;
+
+template<typename Blit>
+static double measure_ns_per_byte(const std::vector<uint8_t> &frame, const int iterations, Blit blit) {
+    auto started_at = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (size_t offset = 0; offset < frame.size(); offset += CHUNK_SIZE) {
+            blit(offset, frame.data() + offset, std::min(CHUNK_SIZE, frame.size() - offset));
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - started_at;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(frame.size()) * iterations);
+}
+
+/**
+ * Compares the word-wide blit kernels with the per-pixel drawPixel path they replaced, on whole frames sent in
+ * chunks of the MQTT buffer size. On the host the numbers only tell the relative speed up, not the ESP32 timing.
+ */
+int main(int argc, char **argv) {
+    auto iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+    std::printf("%dx%d frames in %lu byte chunks, %d iterations\n", WIDTH, HEIGHT, static_cast<unsigned long>(CHUNK_SIZE), iterations);
+
+    std::mt19937 random(5);
+    for (auto depth : {1, 4}) {
+        std::vector<uint8_t> frame(WIDTH * HEIGHT * depth / 8);
+        for (auto &byte : frame) byte = static_cast<uint8_t>(random());
+        std::vector<uint8_t> frame_buffer(frame.size());
+        FrameDiff diff(WIDTH, HEIGHT);
+
+        ReferenceInkplate reference(frame_buffer.data(), WIDTH, depth);
+        auto reference_ns = measure_ns_per_byte(frame, iterations, [&](size_t offset, const uint8_t *data, size_t data_len) {
+            reference.draw_chunk(offset, data, data_len);
+        });
+
+        auto blit = depth == 1 ? blit_1bpp : blit_4bpp;
+        auto kernel_ns = measure_ns_per_byte(frame, iterations, [&](size_t offset, const uint8_t *data, size_t data_len) {
+            blit(frame_buffer.data(), offset, data, data_len, nullptr);
+        });
+
+        // with the diff, as the display path runs it
+        diff.reset(depth);
+        auto kernel_diff_ns = measure_ns_per_byte(frame, iterations, [&](size_t offset, const uint8_t *data, size_t data_len) {
+            blit(frame_buffer.data(), offset, data, data_len, &diff);
+        });
+
+        std::printf("%dbpp drawPixel %7.3f ns/byte, kernel %7.3f ns/byte (%5.1fx), kernel with diff %7.3f ns/byte (%5.1fx)\n",
+                    depth, reference_ns, kernel_ns, reference_ns / kernel_ns, kernel_diff_ns, reference_ns / kernel_diff_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "packbits.h"
+#include "display_path.h"
+#include "fake_inkplate.h"
+#include "mqtt_stand_in.h"
+
+// the Inkplate 10 panel and the default esp-mqtt buffer
+static constexpr int WIDTH = 1200;
+static constexpr int HEIGHT = 825;
+static constexpr size_t DEFAULT_MQTT_BUFFER_SIZE = 1024;
+
+/**
+ * Frames which alternate between two images of mostly white with some noise, so every frame changes the panel.
+ */
+static std::vector<std::vector<uint8_t>> make_frames(const int depth) {
+    std::mt19937 random(depth);
+    std::vector<std::vector<uint8_t>> frames;
+    for (int i = 0; i < 2; i++) {
+        std::vector<uint8_t> frame(WIDTH * HEIGHT * depth / 8, depth == 1 ? 0x00 : 0x77);
+        for (size_t offset = 0; offset < frame.size(); offset += 1 + random() % 64) {
+            frame[offset] = static_cast<uint8_t>(random());
+        }
+        frames.push_back(std::move(frame));
+    }
+    return frames;
+}
+
+static void measure(MqttStandIn &mqtt, const std::string &topic, const std::vector<std::vector<uint8_t>> &payloads, const size_t frame_size, const int iterations) {
+    auto started_at = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        const auto &payload = payloads[i % payloads.size()];
+        mqtt.publish(topic, payload.data(), payload.size());
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+
+    std::printf("%-40s %8.3f ms/frame %8.1f MB/s\n", topic.c_str(), seconds * 1000 / iterations, frame_size * iterations / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+    auto buffer_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : DEFAULT_MQTT_BUFFER_SIZE;
+    auto iterations = argc > 2 ? std::atoi(argv[2]) : 50;
+    std::printf("%dx%d panel, %lu byte MQTT buffer, %d frames per topic\n", WIDTH, HEIGHT, static_cast<unsigned long>(buffer_size), iterations);
+
+    FakeInkplate inkplate(WIDTH, HEIGHT);
+    MqttStandIn mqtt(buffer_size);
+    SimulatedDisplayPath display_path(inkplate);
+    display_path.subscribe(mqtt, "bench");
+
+    for (auto depth : {1, 4}) {
+        auto frames = make_frames(depth);
+        auto frame_size = frames[0].size();
+
+        std::vector<std::vector<uint8_t>> encoded_frames;
+        for (const auto &frame : frames) {
+            std::vector<uint8_t> encoded(packbits_max_encoded_size(frame.size()));
+            encoded.resize(packbits_encode(frame.data(), frame.size(), encoded.data()));
+            encoded_frames.push_back(std::move(encoded));
+        }
+
+        auto depth_str = std::to_string(depth) + "bpp";
+        measure(mqtt, "vsb-eink/bench/display/raw_" + depth_str + "/set", frames, frame_size, iterations);
+        measure(mqtt, "vsb-eink/bench/display/rle_" + depth_str + "/set", encoded_frames, frame_size, iterations);
+    }
+
+    std::printf("%lu frames committed, %lu refreshes\n", static_cast<unsigned long>(display_path.get_committed_frames()), static_cast<unsigned long>(inkplate.get_refresh_calls().size()));
+    return 0;
+}
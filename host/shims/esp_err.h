@@ -0,0 +1,7 @@
+#pragma once
+
+// only what the headers built on the host refer to
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
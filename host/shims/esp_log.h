@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdio>
+
+// log lines go to stderr, the level letter and tag prefixed like on the device
+#define ESP_LOGE(tag, format, ...) std::fprintf(stderr, "E (%s) " format "\n", tag __VA_OPT__(,) __VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) std::fprintf(stderr, "W (%s) " format "\n", tag __VA_OPT__(,) __VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) std::fprintf(stderr, "I (%s) " format "\n", tag __VA_OPT__(,) __VA_ARGS__)
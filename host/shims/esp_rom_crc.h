@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Host stand-in of the ROM CRC32 of the ESP32, which matches the CRC32 used by zlib and can be chained the same way.
+ */
+extern "C" uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// the part of Adafruit_GFX InkplateCanvas builds on, the drawing primitives of the library are not available on the host
+class Adafruit_GFX {
+public:
+    Adafruit_GFX(const int16_t w, const int16_t h): WIDTH{w}, HEIGHT{h}, _width{w}, _height{h}, rotation{0} {}
+    virtual ~Adafruit_GFX() = default;
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+    virtual void fillRect(const int16_t x, const int16_t y, const int16_t w, const int16_t h, const uint16_t color) {
+        for (int16_t i = x; i < x + w; i++) {
+            for (int16_t j = y; j < y + h; j++) drawPixel(i, j, color);
+        }
+    }
+
+    [[nodiscard]] int16_t width() const {
+        return _width;
+    }
+
+    [[nodiscard]] int16_t height() const {
+        return _height;
+    }
+protected:
+    int16_t WIDTH;
+    int16_t HEIGHT;
+    int16_t _width;
+    int16_t _height;
+    uint8_t rotation;
+};
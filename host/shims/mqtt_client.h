@@ -0,0 +1,13 @@
+#pragma once
+
+// the fields of an esp-mqtt data event the display path reads, filled in by the broker stand-in
+struct esp_mqtt_event_t {
+    char *topic;
+    int topic_len;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+};
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "nvs.h"
+
+// config.h only passes handles around, the NVS itself is not available on the host
+namespace nvs {
+class NVSHandle;
+}
@@ -0,0 +1,211 @@
+#include "display_path.h"
+
+#include <cstring>
+
+#include "drivers/inkplate_framebuffer.h"
+
+SimulatedDisplayPath::SimulatedDisplayPath(FakeInkplate &inkplate):
+        inkplate{inkplate},
+        back_buffer(inkplate.einkWidth() * inkplate.einkHeight() / 2),
+        back_depth{1},
+        back_hash{},
+        committed_hash{0},
+        committed_depth{1},
+        frame{},
+        frame_diff(inkplate.einkWidth(), inkplate.einkHeight()),
+        decoder{},
+        region_header_buffer{},
+        region_header{},
+        region_window{},
+        committed_frames{0},
+        resend_requests{0} {
+    // start from what the panel shows, like FramePipeline::restore
+    inkplate.clearDisplay();
+    std::memcpy(back_buffer.data(), inkplate.get_frame_buffer(), get_frame_size(back_depth));
+    committed_hash = hash_frame(back_buffer.data(), get_frame_size(back_depth), back_depth);
+    back_hash = committed_hash;
+}
+
+void SimulatedDisplayPath::subscribe(MqttStandIn &mqtt, const std::string &panel_id) {
+    for (auto depth : {1, 4}) {
+        auto display_topic = "vsb-eink/" + panel_id + "/display/raw_" + std::to_string(depth) + "bpp";
+        mqtt.subscribe(display_topic + "/set", [this, depth](auto event) { display_raw(event, depth); });
+        mqtt.subscribe(display_topic + "/delta/+", [this, depth](auto event) { display_delta(event, depth); });
+
+        auto rle_topic = "vsb-eink/" + panel_id + "/display/rle_" + std::to_string(depth) + "bpp/set";
+        mqtt.subscribe(rle_topic, [this, depth](auto event) { display_rle(event, depth); });
+    }
+    mqtt.subscribe("vsb-eink/" + panel_id + "/display/region/set", [this](auto event) { display_region(event); });
+}
+
+std::optional<uint32_t> SimulatedDisplayPath::get_back_hash() const {
+    return back_hash;
+}
+
+size_t SimulatedDisplayPath::get_committed_frames() const {
+    return committed_frames;
+}
+
+size_t SimulatedDisplayPath::get_resend_requests() const {
+    return resend_requests;
+}
+
+size_t SimulatedDisplayPath::get_frame_size(const int depth) const {
+    return inkplate.einkWidth() * inkplate.einkHeight() * depth / 8;
+}
+
+void SimulatedDisplayPath::set_back_depth(const int depth) {
+    if (depth == back_depth) return;
+
+    back_depth = depth;
+    back_hash.reset();
+    std::memset(back_buffer.data(), depth == 1 ? 0x00 : 0x77, get_frame_size(depth));
+}
+
+void SimulatedDisplayPath::begin_frame(const int depth) {
+    set_back_depth(depth);
+    back_hash.reset();
+    frame_diff.reset(depth);
+    frame.accept(depth);
+}
+
+void SimulatedDisplayPath::write_frame(const size_t offset, const uint8_t *data, const size_t data_len) {
+    auto blit = frame.get_depth() == 1 ? blit_1bpp : blit_4bpp;
+    blit(back_buffer.data(), offset, data, data_len, &frame_diff);
+}
+
+void SimulatedDisplayPath::end_frame(const bool is_full_refresh) {
+    frame.reset();
+
+    auto diff = frame_diff.finish();
+    auto hash = hash_frame(back_buffer.data(), get_frame_size(back_depth), back_depth);
+    back_hash = hash;
+    if (diff.changed_pixels == 0 && back_depth == committed_depth && hash == committed_hash) return;
+
+    committed_hash = hash;
+    committed_depth = back_depth;
+    commit(is_full_refresh);
+}
+
+/**
+ * Displays the back buffer the way FramePipeline::run_refresh_loop does, minus the refresh policy.
+ */
+void SimulatedDisplayPath::commit(const bool is_full_refresh) {
+    committed_frames++;
+
+    auto mode = back_depth == 1 ? DisplayMode::INKPLATE_1BIT : DisplayMode::INKPLATE_3BIT;
+    if (inkplate.getDisplayMode() != mode) {
+        inkplate.setDisplayMode(mode);
+        inkplate.clearDisplay();
+        inkplate.display();
+    }
+
+    std::memcpy(inkplate.get_frame_buffer(), back_buffer.data(), get_frame_size(back_depth));
+    if (back_depth == 1 && !is_full_refresh) {
+        inkplate.partialUpdate();
+    } else {
+        inkplate.display();
+    }
+}
+
+void SimulatedDisplayPath::display_raw(const esp_mqtt_event_handle_t event, const int depth) {
+    if (static_cast<size_t>(event->total_data_len) != get_frame_size(depth)) return;
+
+    if (event->current_data_offset == 0) begin_frame(depth);
+    if (!frame.is_accepted(depth)) return;
+
+    write_frame(event->current_data_offset, reinterpret_cast<const uint8_t *>(event->data), event->data_len);
+    if (is_last_chunk(event)) end_frame();
+}
+
+void SimulatedDisplayPath::display_rle(const esp_mqtt_event_handle_t event, const int depth) {
+    if (event->current_data_offset == 0) {
+        begin_frame(depth);
+        decoder.reset(get_frame_size(depth));
+    }
+    if (!frame.is_accepted(depth)) return;
+
+    auto is_decoded = decoder.decode(
+        reinterpret_cast<const uint8_t *>(event->data),
+        event->data_len,
+        [&](const size_t offset, const uint8_t *data, const size_t data_len) {
+            write_frame(offset, data, data_len);
+        }
+    );
+    if (!is_decoded || (is_last_chunk(event) && !decoder.is_complete())) {
+        frame.reset();
+        return;
+    }
+
+    if (is_last_chunk(event)) end_frame();
+}
+
+void SimulatedDisplayPath::display_delta(const esp_mqtt_event_handle_t event, const int depth) {
+    if (event->current_data_offset == 0) {
+        frame.reset();
+
+        auto base_hash = get_announced_hash(event);
+        if (!base_hash || !back_hash || *base_hash != *back_hash || back_depth != depth) {
+            resend_requests++;
+            return;
+        }
+
+        back_hash.reset();
+        frame_diff.reset(depth);
+        frame.accept(depth);
+        decoder.reset(get_frame_size(depth));
+    }
+    if (!frame.is_accepted(depth)) return;
+
+    auto apply_delta = depth == 1 ? xor_1bpp : xor_4bpp;
+    auto is_decoded = decoder.decode(
+        reinterpret_cast<const uint8_t *>(event->data),
+        event->data_len,
+        [&](const size_t offset, const uint8_t *data, const size_t data_len) {
+            apply_delta(back_buffer.data(), offset, data, data_len, &frame_diff);
+        }
+    );
+    if (!is_decoded || (is_last_chunk(event) && !decoder.is_complete())) {
+        frame.reset();
+        resend_requests++;
+        return;
+    }
+
+    if (is_last_chunk(event)) end_frame();
+}
+
+void SimulatedDisplayPath::display_region(const esp_mqtt_event_handle_t event) {
+    auto data = reinterpret_cast<const uint8_t *>(event->data);
+    size_t data_len = event->data_len;
+    size_t offset = event->current_data_offset;
+
+    if (offset < RegionHeader::SIZE) {
+        if (!region_header_buffer.collect(data, data_len, offset)) return;
+
+        region_header = RegionHeader::parse(region_header_buffer.get());
+        frame.reset();
+
+        auto window = get_region_window(region_header, back_depth, inkplate.einkWidth(), inkplate.einkHeight(), inkplate.einkWidth(), event->total_data_len);
+        if (!window) return;
+
+        region_window = *window;
+        back_hash.reset();
+        frame_diff.reset(region_header.depth);
+        frame.accept(region_header.depth);
+    }
+
+    if (!frame.is_accepted(region_header.depth)) return;
+
+    auto blit = region_header.depth == 1 ? blit_1bpp : blit_4bpp;
+    blit_window(blit, back_buffer.data(), region_window, offset - RegionHeader::SIZE, data, data_len, &frame_diff);
+
+    if (is_last_chunk(event)) {
+        if (region_header.flags & RegionHeader::FLAG_NO_REFRESH) {
+            frame_diff.finish();
+            frame.reset();
+            return;
+        }
+
+        end_frame(region_header.flags & RegionHeader::FLAG_FULL_REFRESH);
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <mqtt_client.h>
+
+#include "drivers/inkplate_frame_diff.h"
+#include "tasks/panel/frame_stream.h"
+#include "packbits.h"
+#include "fake_inkplate.h"
+#include "mqtt_stand_in.h"
+
+/**
+ * Host counterpart of the raw, rle, delta and region frame handlers of the panel task. Chunks are accepted or
+ * dropped by the same FrameStream and header checks and run through the same kernels into a back buffer, and
+ * complete frames are handed to the fake Inkplate the way the refresh loop does, so the whole ingest path can be
+ * exercised and measured without a panel. Only the plumbing around them, the frame pipeline and MQTT, is simulated.
+ */
+class SimulatedDisplayPath {
+public:
+    explicit SimulatedDisplayPath(FakeInkplate &inkplate);
+
+    void subscribe(MqttStandIn &mqtt, const std::string &panel_id);
+    void display_raw(esp_mqtt_event_handle_t event, int depth);
+    void display_rle(esp_mqtt_event_handle_t event, int depth);
+    void display_delta(esp_mqtt_event_handle_t event, int depth);
+    void display_region(esp_mqtt_event_handle_t event);
+
+    [[nodiscard]] std::optional<uint32_t> get_back_hash() const;
+    [[nodiscard]] size_t get_committed_frames() const;
+    [[nodiscard]] size_t get_resend_requests() const;
+private:
+    [[nodiscard]] size_t get_frame_size(int depth) const;
+    void set_back_depth(int depth);
+    void begin_frame(int depth);
+    void write_frame(size_t offset, const uint8_t *data, size_t data_len);
+    void end_frame(bool is_full_refresh = false);
+    void commit(bool is_full_refresh);
+
+    FakeInkplate &inkplate;
+    std::vector<uint8_t> back_buffer;
+    int back_depth;
+    std::optional<uint32_t> back_hash;
+    uint32_t committed_hash;
+    int committed_depth;
+
+    FrameStream frame;
+    FrameDiff frame_diff;
+    PackBitsDecoder decoder;
+    MessageHeader<RegionHeader::SIZE> region_header_buffer;
+    RegionHeader region_header;
+    FrameWindow region_window;
+
+    size_t committed_frames;
+    size_t resend_requests;
+};
@@ -0,0 +1,93 @@
+#include "fake_inkplate.h"
+
+#include <algorithm>
+
+#include "drivers/inkplate_framebuffer.h"
+#include "png_snapshot.h"
+
+FakeInkplate::FakeInkplate(const int width, const int height):
+        width{width},
+        height{height},
+        mode{DisplayMode::INKPLATE_1BIT},
+        partial(width * height / 8, 0x00),
+        memory_4bit(width * height / 2, 0x77),
+        refresh_calls{},
+        panel_mode{DisplayMode::INKPLATE_1BIT},
+        panel_content(partial) {}
+
+int FakeInkplate::einkWidth() const {
+    return width;
+}
+
+int FakeInkplate::einkHeight() const {
+    return height;
+}
+
+DisplayMode FakeInkplate::getDisplayMode() const {
+    return mode;
+}
+
+void FakeInkplate::setDisplayMode(const DisplayMode mode) {
+    this->mode = mode;
+}
+
+void FakeInkplate::clearDisplay() {
+    if (mode == DisplayMode::INKPLATE_1BIT) {
+        std::fill(partial.begin(), partial.end(), 0x00);
+    } else {
+        std::fill(memory_4bit.begin(), memory_4bit.end(), 0x77);
+    }
+}
+
+void FakeInkplate::display() {
+    record_refresh(RefreshCallKind::DISPLAY);
+}
+
+void FakeInkplate::partialUpdate() {
+    record_refresh(RefreshCallKind::PARTIAL_UPDATE);
+}
+
+uint8_t *FakeInkplate::get_frame_buffer() {
+    return mode == DisplayMode::INKPLATE_1BIT ? partial.data() : memory_4bit.data();
+}
+
+size_t FakeInkplate::get_frame_size() const {
+    return mode == DisplayMode::INKPLATE_1BIT ? partial.size() : memory_4bit.size();
+}
+
+const std::vector<RefreshCall> &FakeInkplate::get_refresh_calls() const {
+    return refresh_calls;
+}
+
+std::vector<uint8_t> FakeInkplate::get_panel_pixels() const {
+    // 1-bit pixels are black when set, the leftmost one in the LSB, 3-bit ones go from black to white
+    std::vector<uint8_t> pixels(width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            auto index = y * width + x;
+            if (panel_mode == DisplayMode::INKPLATE_1BIT) {
+                pixels[index] = panel_content[index / 8] >> (x % 8) & 1 ? 0x00 : 0xff;
+            } else {
+                auto level = panel_content[index / 2] >> (x % 2 == 0 ? 4 : 0) & 0x07;
+                pixels[index] = static_cast<uint8_t>(level * 255 / 7);
+            }
+        }
+    }
+    return pixels;
+}
+
+bool FakeInkplate::write_snapshot(const std::string &path) const {
+    return write_gray_png(path, width, height, get_panel_pixels());
+}
+
+void FakeInkplate::record_refresh(const RefreshCallKind kind) {
+    auto depth = mode == DisplayMode::INKPLATE_1BIT ? 1 : 4;
+    refresh_calls.push_back({
+        .kind = kind,
+        .mode = mode,
+        .hash = hash_frame(get_frame_buffer(), get_frame_size(), depth)
+    });
+
+    panel_mode = mode;
+    panel_content.assign(get_frame_buffer(), get_frame_buffer() + get_frame_size());
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class DisplayMode {
+    INKPLATE_1BIT,
+    INKPLATE_3BIT,
+};
+
+enum class RefreshCallKind {
+    DISPLAY,
+    PARTIAL_UPDATE,
+};
+
+struct RefreshCall {
+    RefreshCallKind kind;
+    DisplayMode mode;
+    // hash of the framebuffer content at the time of the refresh, see hash_frame
+    uint32_t hash;
+};
+
+/**
+ * Stand-in of the Inkplate on the host. It keeps the 1-bit and 3-bit framebuffers in the layouts of the library
+ * and records every refresh instead of driving a panel, the panel content can be saved as a PNG snapshot.
+ */
+class FakeInkplate {
+public:
+    FakeInkplate(int width, int height);
+
+    [[nodiscard]] int einkWidth() const;
+    [[nodiscard]] int einkHeight() const;
+    [[nodiscard]] DisplayMode getDisplayMode() const;
+    void setDisplayMode(DisplayMode mode);
+    void clearDisplay();
+    void display();
+    void partialUpdate();
+
+    // framebuffer of the current mode, Inkplate::_partial or Inkplate::DMemory4Bit
+    [[nodiscard]] uint8_t *get_frame_buffer();
+    [[nodiscard]] size_t get_frame_size() const;
+    [[nodiscard]] const std::vector<RefreshCall> &get_refresh_calls() const;
+    // gray level of every pixel of the panel as of the last refresh, 0 is black
+    [[nodiscard]] std::vector<uint8_t> get_panel_pixels() const;
+    bool write_snapshot(const std::string &path) const;
+private:
+    void record_refresh(RefreshCallKind kind);
+
+    const int width;
+    const int height;
+    DisplayMode mode;
+    std::vector<uint8_t> partial;
+    std::vector<uint8_t> memory_4bit;
+    std::vector<RefreshCall> refresh_calls;
+    // framebuffer content as of the last refresh, only converted to pixels when asked for
+    DisplayMode panel_mode;
+    std::vector<uint8_t> panel_content;
+};
@@ -0,0 +1,62 @@
+#include "mqtt_stand_in.h"
+
+#include <algorithm>
+
+MqttStandIn::MqttStandIn(const size_t buffer_size):
+        buffer_size{buffer_size},
+        subscriptions{} {}
+
+void MqttStandIn::subscribe(std::string filter, Handler handler) {
+    subscriptions.push_back({std::move(filter), std::move(handler)});
+}
+
+/**
+ * Delivers a message to the matching handlers.
+ * @return Number of handlers the message was delivered to
+ */
+size_t MqttStandIn::publish(const std::string_view topic, const uint8_t *data, const size_t data_len) {
+    // the client hands out views of its own buffer, so the handlers get copies they may not keep
+    std::string topic_copy(topic);
+    std::vector<char> chunk(buffer_size);
+
+    size_t handler_count = 0;
+    for (const auto &subscription : subscriptions) {
+        if (!match_filter(subscription.filter, topic)) continue;
+        handler_count++;
+
+        size_t offset = 0;
+        do {
+            auto chunk_len = std::min(buffer_size, data_len - offset);
+            std::copy_n(data + offset, chunk_len, chunk.data());
+
+            esp_mqtt_event_t event{
+                .topic = offset == 0 ? topic_copy.data() : nullptr,
+                .topic_len = offset == 0 ? static_cast<int>(topic_copy.size()) : 0,
+                .data = chunk.data(),
+                .data_len = static_cast<int>(chunk_len),
+                .total_data_len = static_cast<int>(data_len),
+                .current_data_offset = static_cast<int>(offset)
+            };
+            subscription.handler(&event);
+            offset += chunk_len;
+        } while (offset < data_len);
+    }
+    return handler_count;
+}
+
+bool MqttStandIn::match_filter(std::string_view filter, std::string_view topic) {
+    for (;;) {
+        auto filter_level_end = filter.find('/');
+        auto topic_level_end = topic.find('/');
+        auto filter_level = filter.substr(0, filter_level_end);
+        if (filter_level == "#") return true;
+        if (filter_level != "+" && filter_level != topic.substr(0, topic_level_end)) return false;
+
+        auto is_last_filter_level = filter_level_end == std::string_view::npos;
+        auto is_last_topic_level = topic_level_end == std::string_view::npos;
+        if (is_last_filter_level || is_last_topic_level) return is_last_filter_level && is_last_topic_level;
+
+        filter.remove_prefix(filter_level_end + 1);
+        topic.remove_prefix(topic_level_end + 1);
+    }
+}
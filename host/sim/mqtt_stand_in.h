@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mqtt_client.h>
+
+/**
+ * In-process stand-in of the broker and the MQTT client. A published message is delivered to every matching
+ * handler in chunks of the client buffer size, and just like with esp-mqtt, only the first chunk carries the topic.
+ */
+class MqttStandIn {
+public:
+    using Handler = std::function<void(esp_mqtt_event_handle_t)>;
+
+    explicit MqttStandIn(size_t buffer_size);
+
+    void subscribe(std::string filter, Handler handler);
+    size_t publish(std::string_view topic, const uint8_t *data, size_t data_len);
+
+    static bool match_filter(std::string_view filter, std::string_view topic);
+private:
+    struct Subscription {
+        std::string filter;
+        Handler handler;
+    };
+
+    const size_t buffer_size;
+    std::vector<Subscription> subscriptions;
+};
@@ -0,0 +1,64 @@
+#include "png_snapshot.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <esp_rom_crc.h>
+
+static void append_u32(std::vector<uint8_t> &out, const uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void append_chunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data) {
+    append_u32(out, data.size());
+    auto crc_start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    append_u32(out, esp_rom_crc32_le(0, out.data() + crc_start, out.size() - crc_start));
+}
+
+bool write_gray_png(const std::string &path, const int width, const int height, const std::vector<uint8_t> &pixels) {
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+    std::vector<uint8_t> header;
+    append_u32(header, width);
+    append_u32(header, height);
+    header.insert(header.end(), {8, 0, 0, 0, 0});
+    append_chunk(png, "IHDR", header);
+
+    // every row starts with filter type 0
+    std::vector<uint8_t> raw;
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels.begin() + y * width, pixels.begin() + (y + 1) * width);
+    }
+
+    // zlib stream of stored deflate blocks of at most 65535 bytes
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    for (size_t offset = 0;; offset += 65535) {
+        auto block_len = std::min<size_t>(65535, raw.size() - offset);
+        auto is_last = offset + block_len == raw.size();
+        zlib.push_back(is_last ? 1 : 0);
+        zlib.push_back(block_len);
+        zlib.push_back(block_len >> 8);
+        zlib.push_back(~block_len);
+        zlib.push_back(~block_len >> 8);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block_len);
+        if (is_last) break;
+    }
+    uint32_t a = 1, b = 0;
+    for (auto byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    append_u32(zlib, b << 16 | a);
+    append_chunk(png, "IDAT", zlib);
+    append_chunk(png, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(png.data()), static_cast<std::streamsize>(png.size()));
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Writes an 8-bit grayscale PNG, the image data is stored without compression so no zlib is needed.
+ * @param path Path of the file to write
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param pixels Gray levels of the pixels, row by row
+ * @return false if the file could not be written
+ */
+bool write_gray_png(const std::string &path, int width, int height, const std::vector<uint8_t> &pixels);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "utils.h"
+
+/**
+ * The per-pixel path the word-wide kernels replaced, every pixel of a raw chunk is placed with an index to XY
+ * division and a drawPixel into the framebuffer layouts of the Inkplate library, which are reproduced here.
+ * Kept as the reference the kernels are tested and benchmarked against.
+ */
+class ReferenceInkplate {
+public:
+    ReferenceInkplate(uint8_t *frame_buffer, const int width, const int depth):
+            frame_buffer{frame_buffer},
+            width{width},
+            depth{depth} {}
+
+    void drawPixel(const int x, const int y, const uint8_t color) {
+        if (depth == 1) {
+            // 1 is black, the leftmost pixel of a byte is its LSB
+            auto &byte = frame_buffer[(y * width + x) / 8];
+            auto mask = static_cast<uint8_t>(1 << (x % 8));
+            byte = (byte & ~mask) | (color & 1 ? mask : 0);
+        } else {
+            // only the low 3 bits of a color are kept, the left pixel of a pair is the high nibble
+            auto &byte = frame_buffer[(y * width + x) / 2];
+            byte = x % 2 == 0 ? (byte & 0x0f) | (color & 0x07) << 4 : (byte & 0xf0) | (color & 0x07);
+        }
+    }
+
+    void draw_chunk(const size_t offset, const uint8_t *data, const size_t data_len) {
+        auto pixels_per_byte = 8 / depth;
+        for (size_t group_offset = 0; group_offset < data_len; group_offset++) {
+            auto total_group_offset = offset + group_offset;
+            for (int pixel_index_in_group = 0; pixel_index_in_group < pixels_per_byte; pixel_index_in_group++) {
+                auto position = get_position_by_index(static_cast<int>(total_group_offset * pixels_per_byte) + pixel_index_in_group, width);
+                auto shift = (pixels_per_byte - 1 - pixel_index_in_group) * depth;
+                drawPixel(position.x, position.y, (data[group_offset] >> shift) & ((1 << depth) - 1));
+            }
+        }
+    }
+private:
+    uint8_t *frame_buffer;
+    const int width;
+    const int depth;
+};
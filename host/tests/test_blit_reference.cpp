@@ -0,0 +1,87 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "drivers/inkplate_framebuffer.h"
+#include "reference_blit.h"
+#include "check.h"
+
+static constexpr int WIDTH = 64;
+static constexpr int HEIGHT = 8;
+
+static uint32_t count_changed_pixels(const std::vector<uint8_t> &before, const std::vector<uint8_t> &after, const int depth) {
+    uint32_t changed_pixels = 0;
+    for (size_t i = 0; i < before.size(); i++) {
+        auto changed_bits = before[i] ^ after[i];
+        changed_pixels += depth == 1 ? __builtin_popcount(changed_bits) : ((changed_bits & 0xf0) != 0) + ((changed_bits & 0x0f) != 0);
+    }
+    return changed_pixels;
+}
+
+/**
+ * Blits chunks at every alignment of the destination and the source, with lengths covering an empty body,
+ * lone heads and tails and several words in between, and compares each result with the per-pixel path.
+ */
+static void test_matches_reference(std::mt19937 &random, const int depth) {
+    auto frame_size = static_cast<size_t>(WIDTH * HEIGHT * depth / 8);
+    auto blit = depth == 1 ? blit_1bpp : blit_4bpp;
+
+    // word backed, so the framebuffer alignment is known and the offset alone decides the head length
+    std::vector<uint32_t> frame_words(frame_size / 4);
+    auto *frame_buffer = reinterpret_cast<uint8_t *>(frame_words.data());
+    std::vector<uint8_t> expected(frame_size);
+    std::vector<uint8_t> source(64 + 4);
+    FrameDiff diff(WIDTH, HEIGHT);
+
+    for (size_t offset = 0; offset < 12; offset++) {
+        for (size_t data_len = 0; data_len <= 41; data_len++) {
+            for (size_t source_misalignment = 0; source_misalignment < 4; source_misalignment++) {
+                // random content in both the framebuffer and the chunk, so pixels get set as well as cleared
+                for (auto &byte : expected) byte = static_cast<uint8_t>(random()) & (depth == 1 ? 0xff : 0x77);
+                for (auto &byte : source) byte = static_cast<uint8_t>(random());
+                std::memcpy(frame_buffer, expected.data(), frame_size);
+                auto before = expected;
+                const auto *data = source.data() + source_misalignment;
+
+                ReferenceInkplate reference(expected.data(), WIDTH, depth);
+                reference.draw_chunk(offset, data, data_len);
+
+                diff.reset(depth);
+                blit(frame_buffer, offset, data, data_len, &diff);
+
+                CHECK(std::memcmp(frame_buffer, expected.data(), frame_size) == 0);
+                CHECK(diff.finish().changed_pixels == count_changed_pixels(before, expected, depth));
+            }
+        }
+    }
+}
+
+/**
+ * A whole frame sent in chunks of an odd size ends up the same as with the per-pixel path.
+ */
+static void test_frame_matches_reference(std::mt19937 &random, const int depth) {
+    auto frame_size = static_cast<size_t>(WIDTH * HEIGHT * depth / 8);
+    auto blit = depth == 1 ? blit_1bpp : blit_4bpp;
+
+    std::vector<uint8_t> frame(frame_size);
+    for (auto &byte : frame) byte = static_cast<uint8_t>(random());
+
+    std::vector<uint8_t> frame_buffer(frame_size);
+    std::vector<uint8_t> expected(frame_size);
+    ReferenceInkplate reference(expected.data(), WIDTH, depth);
+    for (size_t offset = 0; offset < frame_size; offset += 29) {
+        auto chunk_len = std::min<size_t>(29, frame_size - offset);
+        blit(frame_buffer.data(), offset, frame.data() + offset, chunk_len, nullptr);
+        reference.draw_chunk(offset, frame.data() + offset, chunk_len);
+    }
+    CHECK(frame_buffer == expected);
+}
+
+int main() {
+    std::mt19937 random(4);
+    for (auto depth : {1, 4}) {
+        test_matches_reference(random, depth);
+        test_frame_matches_reference(random, depth);
+    }
+    return 0;
+}
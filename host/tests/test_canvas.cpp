@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "drivers/inkplate_canvas.h"
+#include "check.h"
+
+static constexpr int WIDTH = 64;
+static constexpr int HEIGHT = 16;
+
+struct Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/**
+ * Fills the rectangle pixel by pixel, only visiting the pixels of the framebuffer.
+ */
+static void fill_rect_per_pixel(InkplateCanvas &canvas, const Rect &rect, const int origin_x, const int origin_y, const uint16_t color) {
+    for (auto y = std::max(rect.y, origin_y); y < std::min(rect.y + rect.height, origin_y + HEIGHT); y++) {
+        for (auto x = std::max(rect.x, origin_x); x < std::min(rect.x + rect.width, origin_x + WIDTH); x++) {
+            canvas.drawPixel(static_cast<int16_t>(x), static_cast<int16_t>(y), color);
+        }
+    }
+}
+
+static void test_fill_rect(std::mt19937 &random, const int depth, const int origin_x, const int origin_y) {
+    auto frame_size = WIDTH * HEIGHT * depth / 8;
+    std::vector<uint8_t> frame_buffer(frame_size);
+    for (auto &byte : frame_buffer) byte = static_cast<uint8_t>(random()) & (depth == 1 ? 0xff : 0x77);
+    auto expected = frame_buffer;
+
+    FrameDiff diff(WIDTH, HEIGHT);
+    InkplateCanvas canvas(WIDTH, HEIGHT);
+    InkplateCanvas reference_canvas(WIDTH, HEIGHT);
+    // a group canvas reaching past the framebuffer on every side the origin allows
+    auto canvas_width = origin_x + WIDTH + 16;
+    auto canvas_height = origin_y + HEIGHT + 8;
+
+    std::vector<Rect> rects{
+        // within the framebuffer, starting and ending mid-byte
+        {origin_x + 3, origin_y + 1, 21, 5},
+        // past every edge
+        {origin_x - 10, origin_y - 4, WIDTH + 20, HEIGHT + 8},
+        // past the right and bottom edges only
+        {origin_x + WIDTH - 5, origin_y + HEIGHT - 2, 40, 40},
+        // reaching past INT16_MAX, which the int16_t loops of Adafruit_GFX never finish
+        {origin_x + 8, origin_y + 2, UINT16_MAX, UINT16_MAX},
+        {INT16_MAX - 10, INT16_MIN, UINT16_MAX, UINT16_MAX},
+        // outside or empty
+        {origin_x + WIDTH, origin_y, 10, 10},
+        {origin_x - 10, origin_y, 10, 10},
+        {origin_x, origin_y, 0, HEIGHT},
+        {origin_x, origin_y, WIDTH, -4},
+    };
+    for (int i = 0; i < 100; i++) {
+        rects.push_back({
+            origin_x + static_cast<int>(random() % (WIDTH + 16)) - 8,
+            origin_y + static_cast<int>(random() % (HEIGHT + 8)) - 4,
+            static_cast<int>(random() % (WIDTH + 8)),
+            static_cast<int>(random() % (HEIGHT + 4))
+        });
+    }
+
+    for (const auto &rect : rects) {
+        auto color = static_cast<uint16_t>(random() % (depth == 1 ? 2 : 8));
+
+        diff.reset(depth);
+        canvas.begin(frame_buffer.data(), depth, &diff, canvas_width, canvas_height, origin_x, origin_y);
+        canvas.fill_rect(rect.x, rect.y, rect.width, rect.height, color);
+        auto changed_pixels = diff.finish().changed_pixels;
+
+        auto previous = expected;
+        reference_canvas.begin(expected.data(), depth, nullptr, canvas_width, canvas_height, origin_x, origin_y);
+        fill_rect_per_pixel(reference_canvas, rect, origin_x, origin_y, color);
+        CHECK(frame_buffer == expected);
+
+        size_t expected_changed_pixels = 0;
+        for (int x = 0; x < WIDTH * HEIGHT; x++) {
+            auto offset = static_cast<size_t>(x) * depth / 8;
+            auto mask = depth == 1 ? 1 << (x & 7) : 0x07 << (x & 1 ? 0 : 4);
+            if ((previous[offset] ^ expected[offset]) & mask) expected_changed_pixels++;
+        }
+        CHECK(changed_pixels == expected_changed_pixels);
+    }
+
+    // the Adafruit_GFX entry point takes the same path, so the primitives built on it are clipped as well
+    canvas.begin(frame_buffer.data(), depth, nullptr, canvas_width, canvas_height, origin_x, origin_y);
+    canvas.fillRect(static_cast<int16_t>(origin_x - 4), static_cast<int16_t>(origin_y), INT16_MAX, 3, 0);
+    reference_canvas.begin(expected.data(), depth, nullptr, canvas_width, canvas_height, origin_x, origin_y);
+    fill_rect_per_pixel(reference_canvas, {origin_x - 4, origin_y, INT16_MAX, 3}, origin_x, origin_y, 0);
+    CHECK(frame_buffer == expected);
+}
+
+static void test_canvas_size() {
+    std::vector<uint8_t> frame_buffer(WIDTH * HEIGHT / 8);
+    InkplateCanvas canvas(WIDTH, HEIGHT);
+    CHECK(canvas.width() == WIDTH && canvas.height() == HEIGHT);
+
+    // Adafruit_GFX clips text and lines to the canvas, so it takes the size of the group canvas the panel is part of
+    canvas.begin(frame_buffer.data(), 1, nullptr, 3 * WIDTH, 2 * HEIGHT, WIDTH, HEIGHT);
+    CHECK(canvas.width() == 3 * WIDTH && canvas.height() == 2 * HEIGHT);
+    canvas.begin(frame_buffer.data(), 1, nullptr, WIDTH, HEIGHT);
+    CHECK(canvas.width() == WIDTH && canvas.height() == HEIGHT);
+}
+
+int main() {
+    std::mt19937 random(5);
+    for (auto depth : {1, 4}) {
+        test_fill_rect(random, depth, 0, 0);
+        // the panel placed within a group canvas
+        test_fill_rect(random, depth, 37, 11);
+    }
+    test_canvas_size();
+    return 0;
+}
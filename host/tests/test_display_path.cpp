@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <esp_rom_crc.h>
+
+#include "drivers/inkplate_framebuffer.h"
+#include "tasks/panel/frame_stream.h"
+#include "packbits.h"
+#include "display_path.h"
+#include "fake_inkplate.h"
+#include "mqtt_stand_in.h"
+#include "check.h"
+
+static constexpr int WIDTH = 64;
+static constexpr int HEIGHT = 16;
+// smaller than a frame and not a multiple of a word, so frames arrive in unaligned chunks
+static constexpr size_t MQTT_BUFFER_SIZE = 37;
+
+static std::string hash_str(const uint32_t hash) {
+    char str[9];
+    std::snprintf(str, sizeof(str), "%08x", hash);
+    return str;
+}
+
+static std::vector<uint8_t> packbits(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> encoded(packbits_max_encoded_size(data.size()));
+    encoded.resize(packbits_encode(data.data(), data.size(), encoded.data()));
+    return encoded;
+}
+
+static std::vector<uint8_t> random_frame(std::mt19937 &random, const int depth) {
+    std::vector<uint8_t> frame(WIDTH * HEIGHT * depth / 8);
+    for (auto &byte : frame) byte = static_cast<uint8_t>(random()) & (depth == 1 ? 0xff : 0x77);
+    return frame;
+}
+
+static std::vector<uint8_t> region_message(const RegionHeader &header, const std::vector<uint8_t> &pixels) {
+    std::vector<uint8_t> message(RegionHeader::SIZE + pixels.size());
+    message[0] = header.x & 0xff;
+    message[1] = header.x >> 8;
+    message[2] = header.y & 0xff;
+    message[3] = header.y >> 8;
+    message[4] = header.width & 0xff;
+    message[5] = header.width >> 8;
+    message[6] = header.height & 0xff;
+    message[7] = header.height >> 8;
+    message[8] = header.depth;
+    message[9] = header.flags;
+    std::copy(pixels.begin(), pixels.end(), message.begin() + RegionHeader::SIZE);
+    return message;
+}
+
+/**
+ * Copies the pixels of a 4bpp region into a whole frame.
+ */
+static void place_region(std::vector<uint8_t> &frame, const RegionHeader &header, const std::vector<uint8_t> &pixels) {
+    auto stride = header.width / 2;
+    for (int row = 0; row < header.height; row++) {
+        std::copy_n(pixels.begin() + row * stride, stride, frame.begin() + (header.y + row) * WIDTH / 2 + header.x / 2);
+    }
+}
+
+int main() {
+    std::mt19937 random(3);
+    FakeInkplate inkplate(WIDTH, HEIGHT);
+    MqttStandIn mqtt(MQTT_BUFFER_SIZE);
+    SimulatedDisplayPath display_path(inkplate);
+    display_path.subscribe(mqtt, "panel");
+    const auto &refresh_calls = inkplate.get_refresh_calls();
+
+    // a raw 1bpp frame ends up in the 1-bit framebuffer and gets a partial update
+    auto frame = random_frame(random, 1);
+    auto frame_hash = esp_rom_crc32_le(0, frame.data(), frame.size());
+    CHECK(mqtt.publish("vsb-eink/panel/display/raw_1bpp/set", frame.data(), frame.size()) == 1);
+    CHECK(refresh_calls.size() == 1);
+    CHECK(refresh_calls.back().kind == RefreshCallKind::PARTIAL_UPDATE);
+    CHECK(refresh_calls.back().hash == frame_hash);
+    CHECK(display_path.get_back_hash() == frame_hash);
+
+    // the same frame again does not touch the panel
+    mqtt.publish("vsb-eink/panel/display/raw_1bpp/set", frame.data(), frame.size());
+    CHECK(refresh_calls.size() == 1);
+
+    // a delta against the displayed frame flips only the changed pixels
+    auto next_frame = frame;
+    next_frame[5] ^= 0xf0;
+    next_frame[100] ^= 0x01;
+    std::vector<uint8_t> delta(frame.size());
+    for (size_t i = 0; i < frame.size(); i++) delta[i] = frame[i] ^ next_frame[i];
+    auto encoded_delta = packbits(delta);
+    mqtt.publish("vsb-eink/panel/display/raw_1bpp/delta/" + hash_str(frame_hash), encoded_delta.data(), encoded_delta.size());
+    CHECK(refresh_calls.size() == 2);
+    CHECK(refresh_calls.back().hash == esp_rom_crc32_le(0, next_frame.data(), next_frame.size()));
+
+    // the same delta again no longer matches the displayed frame, so a whole frame is requested
+    mqtt.publish("vsb-eink/panel/display/raw_1bpp/delta/" + hash_str(frame_hash), encoded_delta.data(), encoded_delta.size());
+    CHECK(refresh_calls.size() == 2);
+    CHECK(display_path.get_resend_requests() == 1);
+
+    // an rle 4bpp frame switches modes, which clears the panel first
+    auto gray_frame = random_frame(random, 4);
+    auto encoded_frame = packbits(gray_frame);
+    mqtt.publish("vsb-eink/panel/display/rle_4bpp/set", encoded_frame.data(), encoded_frame.size());
+    CHECK(refresh_calls.size() == 4);
+    CHECK(refresh_calls[2].mode == DisplayMode::INKPLATE_3BIT);
+    CHECK(refresh_calls[3].kind == RefreshCallKind::DISPLAY);
+    CHECK(refresh_calls[3].hash == esp_rom_crc32_le(0, gray_frame.data(), gray_frame.size()));
+
+    auto pixels = inkplate.get_panel_pixels();
+    CHECK(pixels[0] == (gray_frame[0] >> 4) * 255 / 7);
+    CHECK(pixels[1] == (gray_frame[0] & 0x07) * 255 / 7);
+
+    // a truncated rle frame is dropped
+    encoded_frame.resize(encoded_frame.size() / 2);
+    mqtt.publish("vsb-eink/panel/display/rle_4bpp/set", encoded_frame.data(), encoded_frame.size());
+    CHECK(refresh_calls.size() == 4);
+
+    // a region spanning several chunks is placed into the displayed frame
+    RegionHeader region{.x = 8, .y = 2, .width = 32, .height = 8, .depth = 4, .flags = 0};
+    std::vector<uint8_t> region_pixels(region.width * region.height / 2);
+    for (auto &byte : region_pixels) byte = static_cast<uint8_t>(random()) & 0x77;
+    auto message = region_message(region, region_pixels);
+    CHECK(message.size() > 3 * MQTT_BUFFER_SIZE);
+    CHECK(mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size()) == 1);
+    place_region(gray_frame, region, region_pixels);
+    CHECK(refresh_calls.size() == 5);
+    CHECK(refresh_calls.back().hash == esp_rom_crc32_le(0, gray_frame.data(), gray_frame.size()));
+
+    // a staged region does not refresh, the next region without changes of its own still shows it
+    region.flags = RegionHeader::FLAG_NO_REFRESH;
+    for (auto &byte : region_pixels) byte ^= 0x11;
+    message = region_message(region, region_pixels);
+    mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size());
+    CHECK(refresh_calls.size() == 5);
+    region.flags = 0;
+    message = region_message(region, region_pixels);
+    mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size());
+    place_region(gray_frame, region, region_pixels);
+    CHECK(refresh_calls.size() == 6);
+    CHECK(refresh_calls.back().hash == esp_rom_crc32_le(0, gray_frame.data(), gray_frame.size()));
+
+    // regions out of bounds, of another depth or of the wrong size are dropped along with all their chunks
+    for (auto invalid_region : {
+        RegionHeader{.x = 40, .y = 2, .width = 32, .height = 8, .depth = 4, .flags = 0},
+        RegionHeader{.x = 8, .y = 2, .width = 32, .height = 16, .depth = 1, .flags = 0},
+    }) {
+        message = region_message(invalid_region, region_pixels);
+        mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size());
+    }
+    message = region_message(region, region_pixels);
+    message.pop_back();
+    mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size());
+    CHECK(refresh_calls.size() == 6);
+    CHECK(refresh_calls.back().hash == hash_frame(inkplate.get_frame_buffer(), gray_frame.size(), 4));
+
+    // a rejected header with depth 0 matches the depth a rejection leaves behind, its continuation chunks are still dropped
+    auto back_hash = display_path.get_back_hash();
+    RegionHeader zero_depth_region{.x = 8, .y = 2, .width = 32, .height = 8, .depth = 0, .flags = 0};
+    message = region_message(zero_depth_region, std::vector<uint8_t>(4 * MQTT_BUFFER_SIZE, 0x33));
+    mqtt.publish("vsb-eink/panel/display/region/set", message.data(), message.size());
+    CHECK(refresh_calls.size() == 6);
+    CHECK(display_path.get_back_hash() == back_hash);
+
+    // the snapshot is a PNG of the panel content
+    CHECK(inkplate.write_snapshot("test_display_path.png"));
+    std::ifstream snapshot("test_display_path.png", std::ios::binary);
+    char signature[8];
+    snapshot.read(signature, sizeof(signature));
+    CHECK(snapshot && std::string(signature, 4) == "\x89PNG");
+    return 0;
+}
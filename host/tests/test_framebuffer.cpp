@@ -0,0 +1,146 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <esp_rom_crc.h>
+
+#include "drivers/inkplate_framebuffer.h"
+#include "utils.h"
+#include "check.h"
+
+static constexpr int WIDTH = 64;
+static constexpr int HEIGHT = 16;
+
+static std::vector<uint8_t> random_bytes(std::mt19937 &random, const size_t len) {
+    std::vector<uint8_t> bytes(len);
+    for (auto &byte : bytes) byte = static_cast<uint8_t>(random());
+    return bytes;
+}
+
+static void test_round_trip(std::mt19937 &random, const int depth) {
+    auto frame_size = WIDTH * HEIGHT * depth / 8;
+    auto blit = depth == 1 ? blit_1bpp : blit_4bpp;
+    auto read = depth == 1 ? read_1bpp : read_4bpp;
+
+    // a 4bpp frame only survives the 3-bit framebuffer with the 4th bit of every pixel clear
+    auto frame = random_bytes(random, frame_size);
+    if (depth == 4) {
+        for (auto &byte : frame) byte &= 0x77;
+    }
+
+    // chunks of odd sizes, so the word loop starts and ends in the middle of words
+    std::vector<uint8_t> frame_buffer(frame_size);
+    for (size_t offset = 0; offset < frame.size(); offset += 13) {
+        blit(frame_buffer.data(), offset, frame.data() + offset, std::min<size_t>(13, frame.size() - offset), nullptr);
+    }
+
+    std::vector<uint8_t> read_back(frame_size);
+    read(frame_buffer.data(), 0, read_back.data(), read_back.size());
+    CHECK(read_back == frame);
+    CHECK(hash_frame(frame_buffer.data(), frame_size, depth) == esp_rom_crc32_le(0, frame.data(), frame.size()));
+}
+
+static void test_1bpp_bit_order() {
+    // the leftmost pixel is the MSB on the wire and the LSB in the framebuffer
+    std::vector<uint8_t> frame_buffer(WIDTH * HEIGHT / 8);
+    const uint8_t data[] = {0x80, 0x01};
+    blit_1bpp(frame_buffer.data(), 3, data, sizeof(data));
+    CHECK(frame_buffer[3] == 0x01);
+    CHECK(frame_buffer[4] == 0x80);
+}
+
+static void test_diff(std::mt19937 &random) {
+    std::vector<uint8_t> frame_buffer(WIDTH * HEIGHT / 8);
+    FrameDiff diff(WIDTH, HEIGHT);
+    diff.reset(1);
+
+    // blitting the same content again changes nothing
+    auto frame = random_bytes(random, frame_buffer.size());
+    blit_1bpp(frame_buffer.data(), 0, frame.data(), frame.size());
+    blit_1bpp(frame_buffer.data(), 0, frame.data(), frame.size(), &diff);
+    CHECK(diff.finish().changed_pixels == 0);
+
+    // a single flipped pixel in the middle of a word body
+    diff.reset(1);
+    frame[37] ^= 0x10;
+    blit_1bpp(frame_buffer.data(), 0, frame.data(), frame.size(), &diff);
+    auto summary = diff.finish();
+    CHECK(summary.changed_pixels == 1);
+    CHECK(summary.dirty_rects.size() == 1);
+    CHECK(summary.dirty_rects[0].y == 37 / (WIDTH / 8));
+}
+
+static void test_xor(std::mt19937 &random, const int depth) {
+    auto frame_size = WIDTH * HEIGHT * depth / 8;
+    auto blit = depth == 1 ? blit_1bpp : blit_4bpp;
+    auto apply_delta = depth == 1 ? xor_1bpp : xor_4bpp;
+    auto mask = depth == 1 ? 0xff : 0x77;
+
+    auto base = random_bytes(random, frame_size);
+    auto next = random_bytes(random, frame_size);
+    std::vector<uint8_t> delta(frame_size);
+    for (int i = 0; i < frame_size; i++) {
+        base[i] &= mask;
+        next[i] &= mask;
+        delta[i] = base[i] ^ next[i];
+    }
+
+    std::vector<uint8_t> frame_buffer(frame_size);
+    std::vector<uint8_t> expected(frame_size);
+    blit(frame_buffer.data(), 0, base.data(), base.size(), nullptr);
+    blit(expected.data(), 0, next.data(), next.size(), nullptr);
+
+    FrameDiff diff(WIDTH, HEIGHT);
+    diff.reset(depth);
+    for (size_t offset = 0; offset < delta.size(); offset += 7) {
+        apply_delta(frame_buffer.data(), offset, delta.data() + offset, std::min<size_t>(7, delta.size() - offset), &diff);
+    }
+    CHECK(frame_buffer == expected);
+    CHECK(diff.finish().changed_pixels > 0);
+}
+
+static void test_window() {
+    // a 16x2 pixel window at 8,4 of the 1-bit framebuffer, in bytes that is 2x2 at 1,4
+    std::vector<uint8_t> frame_buffer(WIDTH * HEIGHT / 8);
+    FrameWindow window{.frame_stride = WIDTH / 8, .x = 1, .y = 4, .stride = 2};
+    const uint8_t data[] = {0x01, 0x02, 0x03, 0x04};
+    blit_window(blit_1bpp, frame_buffer.data(), window, 1, data, 3);
+
+    CHECK(frame_buffer[4 * 8 + 2] == reverse_bits(0x01));
+    CHECK(frame_buffer[5 * 8 + 1] == reverse_bits(0x02));
+    CHECK(frame_buffer[5 * 8 + 2] == reverse_bits(0x03));
+
+    uint8_t read_back[3];
+    read_window(read_1bpp, frame_buffer.data(), window, 1, read_back, sizeof(read_back));
+    CHECK(std::memcmp(read_back, data, sizeof(read_back)) == 0);
+}
+
+static void test_crop() {
+    // the framebuffer is the 8x2 byte part at 2,1 of a 12x4 byte payload
+    std::vector<uint8_t> frame_buffer(16, 0xee);
+    FrameCrop crop{.source_stride = 12, .x = 2, .y = 1, .stride = 8, .height = 2};
+    std::vector<uint8_t> payload(48);
+    for (size_t i = 0; i < payload.size(); i++) payload[i] = static_cast<uint8_t>(i);
+
+    for (size_t offset = 0; offset < payload.size(); offset += 5) {
+        blit_crop(blit_4bpp, frame_buffer.data(), crop, offset, payload.data() + offset, std::min<size_t>(5, payload.size() - offset));
+    }
+    for (size_t row = 0; row < 2; row++) {
+        for (size_t column = 0; column < 8; column++) {
+            CHECK(frame_buffer[row * 8 + column] == (payload[(row + 1) * 12 + column + 2] & 0x77));
+        }
+    }
+}
+
+int main() {
+    std::mt19937 random(1);
+    test_round_trip(random, 1);
+    test_round_trip(random, 4);
+    test_1bpp_bit_order();
+    test_diff(random);
+    test_xor(random, 1);
+    test_xor(random, 4);
+    test_window();
+    test_crop();
+    return 0;
+}
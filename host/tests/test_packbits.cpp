@@ -0,0 +1,82 @@
+#include <random>
+#include <vector>
+
+#include "packbits.h"
+#include "check.h"
+
+static std::vector<uint8_t> decode(const std::vector<uint8_t> &encoded, const size_t expected_size, const size_t chunk_size, bool &is_complete) {
+    std::vector<uint8_t> decoded(expected_size);
+    PackBitsDecoder decoder;
+    decoder.reset(expected_size);
+
+    is_complete = false;
+    for (size_t offset = 0; offset < encoded.size(); offset += chunk_size) {
+        auto chunk_len = std::min(chunk_size, encoded.size() - offset);
+        auto is_decoded = decoder.decode(encoded.data() + offset, chunk_len, [&](size_t run_offset, const uint8_t *data, size_t data_len) {
+            std::copy_n(data, data_len, decoded.begin() + static_cast<ptrdiff_t>(run_offset));
+        });
+        if (!is_decoded) return {};
+    }
+    is_complete = decoder.is_complete();
+    return decoded;
+}
+
+static void test_round_trip(std::mt19937 &random) {
+    // runs and literals of every length around the 128 byte limit
+    std::vector<uint8_t> data;
+    for (int run = 0; run < 200; run++) {
+        auto value = static_cast<uint8_t>(random());
+        auto run_length = random() % 300;
+        for (size_t i = 0; i < run_length; i++) {
+            data.push_back(run % 2 == 0 ? value : static_cast<uint8_t>(random()));
+        }
+    }
+
+    std::vector<uint8_t> encoded(packbits_max_encoded_size(data.size()));
+    encoded.resize(packbits_encode(data.data(), data.size(), encoded.data()));
+    CHECK(encoded.size() < data.size());
+
+    for (size_t chunk_size : {1, 2, 127, 1000, 1 << 20}) {
+        bool is_complete;
+        CHECK(decode(encoded, data.size(), chunk_size, is_complete) == data);
+        CHECK(is_complete);
+    }
+}
+
+static void test_incompressible(std::mt19937 &random) {
+    std::vector<uint8_t> data(1000);
+    for (auto &byte : data) byte = static_cast<uint8_t>(random());
+
+    std::vector<uint8_t> encoded(packbits_max_encoded_size(data.size()));
+    encoded.resize(packbits_encode(data.data(), data.size(), encoded.data()));
+    CHECK(encoded.size() <= packbits_max_encoded_size(data.size()));
+
+    bool is_complete;
+    CHECK(decode(encoded, data.size(), 10, is_complete) == data);
+    CHECK(is_complete);
+}
+
+static void test_malformed() {
+    bool is_complete;
+
+    // 128 is a no-op
+    auto decoded = decode({128, 0x81, 0xaa, 128}, 128, 1, is_complete);
+    CHECK(is_complete);
+    CHECK(decoded == std::vector<uint8_t>(128, 0xaa));
+
+    // more data than expected is rejected before it is handed out
+    decode({0x81, 0xaa}, 100, 1, is_complete);
+    CHECK(!is_complete);
+
+    // a literal cut short
+    decode({3, 1, 2}, 4, 1, is_complete);
+    CHECK(!is_complete);
+}
+
+int main() {
+    std::mt19937 random(2);
+    test_round_trip(random);
+    test_incompressible(random);
+    test_malformed();
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <random>
+
+#include "tasks/system/reconnect_backoff.h"
+#include "check.h"
+
+using namespace std::chrono_literals;
+
+static void test_doubles_up_to_the_cap() {
+    // the highest random number gets the full delay, which doubles until it reaches the cap
+    ReconnectBackoff backoff(1s, 5min);
+    auto expected = std::chrono::milliseconds(1s);
+    for (int attempt = 0; attempt < 30; attempt++) {
+        CHECK(backoff.next_delay(UINT32_MAX) <= expected);
+        CHECK(backoff.get_attempts() == attempt + 1);
+        expected = std::min<std::chrono::milliseconds>(expected * 2, 5min);
+    }
+
+    // long after the cap the doublings must not overflow
+    for (int attempt = 0; attempt < 100; attempt++) backoff.next_delay(0);
+    CHECK(backoff.next_delay(0) >= 150s);
+    CHECK(backoff.next_delay(UINT32_MAX) <= 5min);
+}
+
+static void test_jitter_bounds() {
+    // the delay is picked from the upper half of the current one
+    std::mt19937 random(6);
+    for (int attempt = 0; attempt < 12; attempt++) {
+        auto full_delay = std::min<std::chrono::milliseconds>(std::chrono::milliseconds(1000 << attempt), 5min);
+        for (int sample = 0; sample < 200; sample++) {
+            ReconnectBackoff backoff(1s, 5min);
+            for (int i = 0; i < attempt; i++) backoff.next_delay(0);
+
+            auto delay = backoff.next_delay(random());
+            CHECK(delay >= full_delay - full_delay / 2);
+            CHECK(delay <= full_delay);
+        }
+    }
+
+    // both ends are reachable
+    ReconnectBackoff backoff(1s, 5min);
+    CHECK(backoff.next_delay(0) == 500ms);
+    backoff.reset();
+    CHECK(backoff.next_delay(500) == 1s);
+}
+
+static void test_reset_on_success() {
+    ReconnectBackoff backoff(1s, 5min);
+    for (int attempt = 0; attempt < 8; attempt++) backoff.next_delay(0);
+    CHECK(backoff.next_delay(0) >= 128s);
+
+    // a successful connection starts the next outage from the base delay again
+    backoff.reset();
+    CHECK(backoff.get_attempts() == 0);
+    CHECK(backoff.next_delay(UINT32_MAX) <= 1s);
+    CHECK(backoff.get_attempts() == 1);
+}
+
+int main() {
+    test_doubles_up_to_the_cap();
+    test_jitter_bounds();
+    test_reset_on_success();
+    return 0;
+}
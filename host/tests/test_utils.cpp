@@ -0,0 +1,29 @@
+#include <cstdint>
+
+#include "utils.h"
+#include "check.h"
+
+static void test_topic_id() {
+    CHECK(get_topic_id("vsb-eink/panel/assets/0/set", UINT16_MAX) == 0u);
+    CHECK(get_topic_id("vsb-eink/panel/assets/65535/set", UINT16_MAX) == 65535u);
+    CHECK(get_topic_id("vsb-eink/panel/waveform/007/set", UINT8_MAX) == 7u);
+    CHECK(get_topic_id("7/set", UINT8_MAX) == 7u);
+
+    // anything but a decimal number up to the maximum is rejected instead of read as 0 or wrapped around
+    CHECK(!get_topic_id("vsb-eink/panel/assets/65536/set", UINT16_MAX));
+    CHECK(!get_topic_id("vsb-eink/panel/waveform/256/set", UINT8_MAX));
+    CHECK(!get_topic_id("vsb-eink/panel/waveform/99999999999999999999/set", UINT8_MAX));
+    for (auto topic : {"a/b/x/set", "a/b/12x/set", "a/b/-1/set", "a/b/+1/set", "a/b/ 1/set", "a/b//set", "a/b/0x1/set"}) {
+        CHECK(!get_topic_id(topic, UINT16_MAX));
+    }
+
+    // continuation chunks of a message carry no topic
+    CHECK(!get_topic_id("", UINT16_MAX));
+    CHECK(!get_topic_id("set", UINT16_MAX));
+    CHECK(!get_topic_id("/set", UINT16_MAX));
+}
+
+int main() {
+    test_topic_id();
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <optional>
+#include <vector>
+
+#include "tasks/system/waveform_selector.h"
+#include "check.h"
+
+// cold up to 10 °C, normal up to 30 °C, hot above
+static const std::vector<TemperatureBand> BANDS = {
+    {.max_temperature = 10, .waveform = 1},
+    {.max_temperature = 30, .waveform = 2},
+    {.max_temperature = 50, .waveform = 3},
+};
+
+static void test_select_band() {
+    CHECK(!select_temperature_band({}, 20, std::nullopt, 2));
+
+    CHECK(select_temperature_band(BANDS, -10, std::nullopt, 2) == 0);
+    CHECK(select_temperature_band(BANDS, 10, std::nullopt, 2) == 0);
+    CHECK(select_temperature_band(BANDS, 11, std::nullopt, 2) == 1);
+    CHECK(select_temperature_band(BANDS, 30, std::nullopt, 2) == 1);
+    // the last band covers everything above the maximum of the one before
+    CHECK(select_temperature_band(BANDS, 80, std::nullopt, 2) == 2);
+
+    // the current band is only left once its bound is exceeded by the hysteresis
+    CHECK(select_temperature_band(BANDS, 12, 0, 2) == 0);
+    CHECK(select_temperature_band(BANDS, 13, 0, 2) == 1);
+    CHECK(select_temperature_band(BANDS, 9, 1, 2) == 1);
+    CHECK(select_temperature_band(BANDS, 8, 1, 2) == 0);
+
+    // a current band which no longer exists is ignored
+    CHECK(select_temperature_band(BANDS, 20, 7, 2) == 1);
+}
+
+static void test_selector_with_mocked_sensor() {
+    std::optional<int> temperature;
+    WaveformSelector selector([&] { return temperature; });
+
+    // nothing is selected without a reading or without bands, the latter still records the temperature
+    temperature.reset();
+    CHECK(!selector.update());
+    CHECK(!selector.get_temperature());
+    temperature = 15;
+    CHECK(!selector.update());
+    CHECK(selector.get_temperature() == 15);
+    selector.set_bands({BANDS[2], BANDS[0], BANDS[1]});
+
+    // the first reading picks a waveform, the bands were sorted by their maximum
+    temperature = 20;
+    CHECK(selector.update() == 2);
+    CHECK(selector.get_temperature() == 20);
+
+    // only a change of the band switches the waveform
+    temperature = 25;
+    CHECK(!selector.update());
+    temperature = 31;
+    CHECK(!selector.update());
+    temperature = 33;
+    CHECK(selector.update() == 3);
+
+    // a failed read keeps the last temperature and waveform
+    temperature.reset();
+    CHECK(!selector.update());
+    CHECK(selector.get_temperature() == 33);
+
+    temperature = 5;
+    CHECK(selector.update() == 1);
+
+    // new bands select a waveform on the next reading, even within the same band index
+    selector.set_bands({{.max_temperature = 40, .waveform = 4}});
+    CHECK(selector.update() == 4);
+}
+
+int main() {
+    test_select_band();
+    test_selector_with_mocked_sensor();
+    return 0;
+}
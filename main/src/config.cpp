@@ -1,5 +1,8 @@
 #include "config.h"
 
+#include <algorithm>
+#include <iterator>
+
 #include <nvs_handle.hpp>
 #include <esp_mac.h>
 #include <esp_log.h>
@@ -7,7 +10,11 @@
 
 #include "utils.h"
 
-Config::Config(): wifi{}, wifi_fallback{}, panel{}, mqtt{}, mqtt_fallback{} {};
+Config::Config(): wifi{}, wifi_fallback{}, wifi_cache{}, ip{}, panel{}, mqtt{}, mqtt_fallback{}, sleep{} {};
+
+bool WifiCache::operator==(const WifiCache &other) const {
+    return std::equal(std::begin(bssid), std::end(bssid), std::begin(other.bssid)) && channel == other.channel;
+}
 
 std::string Config::get_default_panel_id() {
     uint8_t buffer[6];
@@ -39,6 +46,46 @@ std::optional<std::string> Config::get_string(const std::shared_ptr<nvs::NVSHand
     return std::string(read_buffer);
 }
 
+std::vector<TemperatureBand> Config::get_waveform_bands(const std::shared_ptr<nvs::NVSHandle> &nvs_handle) {
+    size_t blob_len;
+
+    auto err = nvs_handle->get_item_size(nvs::ItemType::BLOB_DATA, "wf_bands", blob_len);
+    if (err != ESP_OK || blob_len % sizeof(TemperatureBand) != 0 || blob_len > MAX_WAVEFORM_BANDS * sizeof(TemperatureBand)) {
+        return {};
+    }
+
+    std::vector<TemperatureBand> bands(blob_len / sizeof(TemperatureBand));
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_blob("wf_bands", bands.data(), blob_len));
+    if (err != ESP_OK) {
+        ESP_LOGW("Config", "Failed to get blob for wf_bands, will use default");
+        return {};
+    }
+
+    return bands;
+}
+
+std::vector<PanelGroup> Config::get_groups(const std::shared_ptr<nvs::NVSHandle> &nvs_handle) {
+    size_t blob_len;
+
+    auto err = nvs_handle->get_item_size(nvs::ItemType::BLOB_DATA, "groups", blob_len);
+    if (err != ESP_OK || blob_len % sizeof(PanelGroup) != 0 || blob_len > MAX_GROUPS * sizeof(PanelGroup)) {
+        return {};
+    }
+
+    std::vector<PanelGroup> groups(blob_len / sizeof(PanelGroup));
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_blob("groups", groups.data(), blob_len));
+    if (err != ESP_OK) {
+        ESP_LOGW("Config", "Failed to get blob for groups, will use default");
+        return {};
+    }
+
+    // the ids are used in topics, a blob from another firmware version must not leave them unterminated
+    for (auto &group : groups) {
+        group.id[PanelGroup::MAX_ID_LEN] = '\0';
+    }
+    return groups;
+}
+
 esp_err_t Config::load_from_nvs() {
     esp_err_t err;
     std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READONLY, &err);
@@ -60,6 +107,18 @@ esp_err_t Config::load_from_nvs() {
     auto wifi_password = get_string(nvs_handle, "wifi_pass_a");
     wifi.password = wifi_password.value_or(wifi_fallback.password);
 
+    WifiCache cache{};
+    err = nvs_handle->get_blob("wifi_cache", &cache, sizeof(cache));
+    wifi_cache = err == ESP_OK ? std::optional(cache) : std::nullopt;
+
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("ip_addr", ip.address));
+    if (err != ESP_OK) {
+        ip.address = 0;
+    }
+    nvs_handle->get_item("ip_mask", ip.netmask);
+    nvs_handle->get_item("ip_gateway", ip.gateway);
+    nvs_handle->get_item("ip_dns", ip.dns);
+
     // Panel config
     auto panel_id = get_string(nvs_handle, "panel_id");
     panel.panel_id = panel_id.value_or(get_default_panel_id());
@@ -69,6 +128,24 @@ esp_err_t Config::load_from_nvs() {
         panel.waveform = panel.waveform;
     }
 
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("ghost_limit", panel.refresh_policy.ghosting_threshold));
+    if (err != ESP_OK) {
+        panel.refresh_policy.ghosting_threshold = 1000;
+    }
+
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("ghost_cost", panel.refresh_policy.partial_update_cost));
+    if (err != ESP_OK) {
+        panel.refresh_policy.partial_update_cost = 50;
+    }
+
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("full_ratio", panel.refresh_policy.full_refresh_ratio));
+    if (err != ESP_OK) {
+        panel.refresh_policy.full_refresh_ratio = 40;
+    }
+
+    panel.waveform_bands = get_waveform_bands(nvs_handle);
+    panel.groups = get_groups(nvs_handle);
+
     // MQTT config
     auto mqtt_broker_url_fallback = get_string(nvs_handle, "broker_url_b");
     mqtt_fallback.broker_url = mqtt_broker_url_fallback.value_or("mqtt://vsb-eink.lksv.cz:1883");
@@ -76,6 +153,22 @@ esp_err_t Config::load_from_nvs() {
     auto mqtt_broker_url = get_string(nvs_handle, "broker_url_a");
     mqtt.broker_url = mqtt_broker_url.value_or(mqtt_fallback.broker_url);
 
+    // Sleep config
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("power_save", sleep.power_save));
+    if (err != ESP_OK) {
+        sleep.power_save = false;
+    }
+
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("sleep_time", sleep.deep_sleep_interval));
+    if (err != ESP_OK) {
+        sleep.deep_sleep_interval = 0;
+    }
+
+    err = ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_handle->get_item("awake_time", sleep.awake_time));
+    if (err != ESP_OK) {
+        sleep.awake_time = 60;
+    }
+
     return ESP_OK;
 }
 
@@ -85,18 +178,33 @@ esp_err_t Config::commit() {
     err = commit_wifi_config();
     if (err != ESP_OK) return err;
 
+    err = commit_ip_config();
+    if (err != ESP_OK) return err;
+
     err = commit_panel_config();
     if (err != ESP_OK) return err;
 
     err = commit_mqtt_config();
     if (err != ESP_OK) return err;
 
+    err = commit_sleep_config();
+    if (err != ESP_OK) return err;
+
     return ESP_OK;
 }
 
 void Config::set_wifi_config(const WifiConfig &config) {
     wifi_fallback = wifi;
     wifi = config;
+    wifi_cache.reset();
+}
+
+void Config::set_wifi_cache(const std::optional<WifiCache> &cache) {
+    wifi_cache = cache;
+}
+
+void Config::set_ip_config(const IpConfig &config) {
+    ip = config;
 }
 
 void Config::set_panel_config(const PanelConfig &config) {
@@ -108,9 +216,17 @@ void Config::set_mqtt_config(const MqttConfig &config) {
     mqtt = config;
 }
 
+void Config::set_sleep_config(const SleepConfig &config) {
+    sleep = config;
+}
+
 void Config::rollback_wifi_config() {
     std::swap(wifi, wifi_fallback);
+    wifi_cache.reset();
+    // the static address belonged to the network which just failed
+    ip = {};
     commit_wifi_config();
+    commit_ip_config();
 }
 
 void Config::rollback_panel_config() {
@@ -139,6 +255,48 @@ esp_err_t Config::commit_wifi_config() {
     err = nvs_handle->set_string("wifi_pass_b", wifi_fallback.password.c_str());
     if (err != ESP_OK) return err;
 
+    err = nvs_handle->commit();
+    if (err != ESP_OK) return err;
+
+    return commit_wifi_cache();
+}
+
+esp_err_t Config::commit_wifi_cache() {
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READWRITE, &err);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (wifi_cache) {
+        err = nvs_handle->set_blob("wifi_cache", &*wifi_cache, sizeof(*wifi_cache));
+        if (err != ESP_OK) return err;
+    } else {
+        err = nvs_handle->erase_item("wifi_cache");
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
+    }
+
+    return nvs_handle->commit();
+}
+
+esp_err_t Config::commit_ip_config() {
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READWRITE, &err);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_handle->set_item("ip_addr", ip.address);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("ip_mask", ip.netmask);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("ip_gateway", ip.gateway);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("ip_dns", ip.dns);
+    if (err != ESP_OK) return err;
+
     return nvs_handle->commit();
 }
 
@@ -154,6 +312,26 @@ esp_err_t Config::commit_panel_config() {
     if (err != ESP_OK) return err;
     err = nvs_handle->set_item("waveform", panel.waveform);
     if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("ghost_limit", panel.refresh_policy.ghosting_threshold);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("ghost_cost", panel.refresh_policy.partial_update_cost);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("full_ratio", panel.refresh_policy.full_refresh_ratio);
+    if (err != ESP_OK) return err;
+    if (panel.waveform_bands.empty()) {
+        err = nvs_handle->erase_item("wf_bands");
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
+    } else {
+        err = nvs_handle->set_blob("wf_bands", panel.waveform_bands.data(), panel.waveform_bands.size() * sizeof(TemperatureBand));
+        if (err != ESP_OK) return err;
+    }
+    if (panel.groups.empty()) {
+        err = nvs_handle->erase_item("groups");
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
+    } else {
+        err = nvs_handle->set_blob("groups", panel.groups.data(), panel.groups.size() * sizeof(PanelGroup));
+        if (err != ESP_OK) return err;
+    }
 
     return nvs_handle->commit();
 }
@@ -171,5 +349,23 @@ esp_err_t Config::commit_mqtt_config() {
     err = nvs_handle->set_string("broker_url_b", mqtt_fallback.broker_url.c_str());
     if (err != ESP_OK) return err;
 
+    return nvs_handle->commit();
+}
+
+esp_err_t Config::commit_sleep_config() {
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READWRITE, &err);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_handle->set_item("power_save", sleep.power_save);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("sleep_time", sleep.deep_sleep_interval);
+    if (err != ESP_OK) return err;
+    err = nvs_handle->set_item("awake_time", sleep.awake_time);
+    if (err != ESP_OK) return err;
+
     return nvs_handle->commit();
 }
\ No newline at end of file
@@ -14,9 +14,66 @@ struct WifiConfig {
     std::string password;
 };
 
+// the access point the panel was last connected to, joining it directly saves the scan
+struct WifiCache {
+    uint8_t bssid[6];
+    uint8_t channel;
+
+    bool operator==(const WifiCache &other) const;
+};
+
+// static IPv4 configuration of the primary network in network byte order, DHCP is used while the address is 0
+struct IpConfig {
+    uint32_t address;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t dns;
+};
+
+struct RefreshPolicyConfig {
+    // ghosting score after which a region of the panel gets cleaned
+    uint16_t ghosting_threshold;
+    // score added to a region by every partial update touching it, on top of the percentage of flipped pixels
+    uint8_t partial_update_cost;
+    // percentage of the panel which has to be ghosted for a full refresh instead of a region one
+    uint8_t full_refresh_ratio;
+};
+
+struct TemperatureBand {
+    // highest temperature in °C the band covers, the band above starts right after it
+    int8_t max_temperature;
+    uint8_t waveform;
+};
+
+// a set of panels sharing display topics, each panel of a video wall shows its own part of a larger canvas
+struct PanelGroup {
+    static constexpr size_t MAX_ID_LEN = 23;
+
+    char id[MAX_ID_LEN + 1];
+    // size of the group frames in pixels, 0 if they have the size of the panel
+    uint16_t canvas_width;
+    uint16_t canvas_height;
+    // position of the panel within the canvas in pixels
+    uint16_t crop_x;
+    uint16_t crop_y;
+};
+
 struct PanelConfig {
     std::string panel_id;
     uint8_t waveform;
+    RefreshPolicyConfig refresh_policy;
+    // waveforms picked by the panel temperature, the static waveform is used while this is empty
+    std::vector<TemperatureBand> waveform_bands;
+    // groups whose display topics are subscribed to on top of the panel ones
+    std::vector<PanelGroup> groups;
+};
+
+struct SleepConfig {
+    // scale the CPU frequency and light sleep while idle, at the cost of a slower response
+    bool power_save;
+    // seconds to deep sleep for once the panel has been idle for the awake time, 0 keeps it awake
+    uint32_t deep_sleep_interval;
+    uint16_t awake_time;
 };
 
 struct MqttConfig {
@@ -26,19 +83,30 @@ struct MqttConfig {
 class Config {
 private:
     std::optional<std::string> get_string(const std::shared_ptr<nvs::NVSHandle> &nvs_handle, const char* item_key);
+    static std::vector<TemperatureBand> get_waveform_bands(const std::shared_ptr<nvs::NVSHandle> &nvs_handle);
+    static std::vector<PanelGroup> get_groups(const std::shared_ptr<nvs::NVSHandle> &nvs_handle);
     static std::string get_default_panel_id();
 public:
+    static constexpr size_t MAX_WAVEFORM_BANDS = 8;
+    static constexpr size_t MAX_GROUPS = 4;
+
     Config();
     esp_err_t load_from_nvs();
     esp_err_t commit();
 
     void set_wifi_config(const WifiConfig &config);
+    void set_wifi_cache(const std::optional<WifiCache> &cache);
+    void set_ip_config(const IpConfig &config);
     void set_panel_config(const PanelConfig &config);
     void set_mqtt_config(const MqttConfig &config);
+    void set_sleep_config(const SleepConfig &config);
 
     esp_err_t commit_wifi_config();
+    esp_err_t commit_wifi_cache();
+    esp_err_t commit_ip_config();
     esp_err_t commit_panel_config();
     esp_err_t commit_mqtt_config();
+    esp_err_t commit_sleep_config();
 
     void rollback_wifi_config();
     void rollback_panel_config();
@@ -46,9 +114,13 @@ public:
 
     WifiConfig wifi;
     WifiConfig wifi_fallback;
+    std::optional<WifiCache> wifi_cache;
+    IpConfig ip;
 
     PanelConfig panel;
 
     MqttConfig mqtt;
     MqttConfig mqtt_fallback;
+
+    SleepConfig sleep;
 };
\ No newline at end of file
@@ -2,23 +2,81 @@
 
 InkplateButton::InkplateButton(const int id):
         id{id},
-        state{ButtonState::RELEASED} {}
+        state{ButtonState::RELEASED},
+        sampled_state{ButtonState::RELEASED},
+        sampled_at{0},
+        pressed_at{0},
+        tapped_at{},
+        is_press_consumed{false},
+        is_double_tap{false} {}
 
-std::optional<InkplateButton::ButtonState> InkplateButton::update(const uint8_t state_raw) {
-    auto old_state = this->state;
+/**
+ * Records a raw reading of the button, it is only accepted by poll once it has been stable for a while.
+ * @param state_raw Raw state of the button, 1 when pressed
+ * @param now_us Time of the reading in microseconds
+ */
+void InkplateButton::sample(const uint8_t state_raw, const int64_t now_us) {
     auto incoming_state = state_raw == 1 ? ButtonState::PRESSED : ButtonState::RELEASED;
+    if (incoming_state == sampled_state) return;
 
-    if (old_state == incoming_state) {
-        return std::nullopt;
+    sampled_state = incoming_state;
+    sampled_at = now_us;
+}
+
+/**
+ * Advances the debounced state and the gesture recognition up to the given time.
+ * @param now_us Current time in microseconds
+ * @return The next event, poll again until there is none
+ */
+std::optional<InkplateButton::ButtonEvent> InkplateButton::poll(const int64_t now_us) {
+    if (sampled_state != state && now_us - sampled_at >= DEBOUNCE_US) {
+        state = sampled_state;
+
+        if (state == ButtonState::PRESSED) {
+            pressed_at = sampled_at;
+            is_press_consumed = false;
+            is_double_tap = tapped_at && pressed_at - *tapped_at <= DOUBLE_TAP_US;
+            tapped_at.reset();
+            return ButtonEvent::PRESSED;
+        }
+
+        // only a short press counts as a tap, the second tap of a double tap does not start another one
+        if (!is_press_consumed && !is_double_tap) {
+            tapped_at = sampled_at;
+        }
+        return ButtonEvent::RELEASED;
     }
 
-    this->state = incoming_state;
+    if (state == ButtonState::PRESSED && is_double_tap) {
+        is_double_tap = false;
+        is_press_consumed = true;
+        return ButtonEvent::DOUBLE_TAP;
+    }
 
-    if (old_state == ButtonState::RELEASED && incoming_state == ButtonState::PRESSED) {
-        return incoming_state;
-    } else if (old_state == ButtonState::PRESSED && incoming_state == ButtonState::RELEASED) {
-        return incoming_state;
+    if (state == ButtonState::PRESSED && !is_press_consumed && now_us - pressed_at >= LONG_PRESS_US) {
+        is_press_consumed = true;
+        return ButtonEvent::LONG_PRESS;
     }
 
     return std::nullopt;
-}
\ No newline at end of file
+}
+
+/**
+ * Tells when poll has to be called next, even if there are no new readings.
+ * @return Time in microseconds, none if the button is idle
+ */
+std::optional<int64_t> InkplateButton::get_deadline() const {
+    if (sampled_state != state) return sampled_at + DEBOUNCE_US;
+    if (state == ButtonState::PRESSED && !is_press_consumed) return pressed_at + LONG_PRESS_US;
+    return std::nullopt;
+}
+
+const char *InkplateButton::get_event_name(const ButtonEvent event) {
+    switch (event) {
+        case ButtonEvent::RELEASED: return "released";
+        case ButtonEvent::PRESSED: return "pressed";
+        case ButtonEvent::LONG_PRESS: return "long_press";
+        case ButtonEvent::DOUBLE_TAP: return "double_tap";
+        default: return "unknown";
+    }
+}
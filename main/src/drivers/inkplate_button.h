@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <optional>
 
@@ -10,11 +11,35 @@ public:
         PRESSED = 1,
     };
 
+    enum class ButtonEvent {
+        RELEASED = 0,
+        PRESSED = 1,
+        LONG_PRESS = 2,
+        DOUBLE_TAP = 3,
+    };
+
     explicit InkplateButton(int id);
     friend class InkplateTouchpad;
 
-    std::optional<ButtonState> update(uint8_t state_raw);
+    void sample(uint8_t state_raw, int64_t now_us);
+    std::optional<ButtonEvent> poll(int64_t now_us);
+    [[nodiscard]] std::optional<int64_t> get_deadline() const;
+
+    static const char *get_event_name(ButtonEvent event);
 protected:
+    // the raw state has to stay the same for this long to be accepted
+    static constexpr int64_t DEBOUNCE_US = 30 * 1000;
+    static constexpr int64_t LONG_PRESS_US = 800 * 1000;
+    // a press this soon after a short tap makes it a double tap
+    static constexpr int64_t DOUBLE_TAP_US = 400 * 1000;
+
     const int id;
     ButtonState state;
-};
\ No newline at end of file
+    ButtonState sampled_state;
+    int64_t sampled_at;
+    int64_t pressed_at;
+    std::optional<int64_t> tapped_at;
+    // the current press has already turned into a gesture, so it is not a tap and cannot become a long press
+    bool is_press_consumed;
+    bool is_double_tap;
+};
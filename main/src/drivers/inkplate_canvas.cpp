@@ -0,0 +1,136 @@
+#include "inkplate_canvas.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "inkplate_framebuffer.h"
+
+InkplateCanvas::InkplateCanvas(const int16_t width, const int16_t height):
+        Adafruit_GFX(width, height),
+        frame_width{width},
+        frame_height{height},
+        frame_buffer{nullptr},
+        depth{1},
+        diff{nullptr},
+        origin_x{0},
+        origin_y{0} {}
+
+void InkplateCanvas::begin(uint8_t *frame_buffer, const int depth, FrameDiff *diff, const int canvas_width, const int canvas_height, const int origin_x, const int origin_y) {
+    WIDTH = _width = static_cast<int16_t>(std::min(canvas_width, INT16_MAX));
+    HEIGHT = _height = static_cast<int16_t>(std::min(canvas_height, INT16_MAX));
+    rotation = 0;
+
+    this->frame_buffer = frame_buffer;
+    this->depth = depth;
+    this->diff = diff;
+    this->origin_x = origin_x;
+    this->origin_y = origin_y;
+}
+
+int InkplateCanvas::get_depth() const {
+    return depth;
+}
+
+void InkplateCanvas::write_byte(const size_t offset, const uint8_t value) {
+    if (diff != nullptr) diff->mark(offset, frame_buffer[offset] ^ value);
+    frame_buffer[offset] = value;
+}
+
+void InkplateCanvas::drawPixel(int16_t x, int16_t y, const uint16_t color) {
+    auto frame_x = x - origin_x;
+    auto frame_y = y - origin_y;
+    if (frame_buffer == nullptr || frame_x < 0 || frame_y < 0 || frame_x >= frame_width || frame_y >= frame_height) return;
+
+    write_pixel(frame_x, frame_y, color);
+}
+
+void InkplateCanvas::write_pixel(const int frame_x, const int frame_y, const uint16_t color) {
+    auto offset = static_cast<size_t>(frame_y * frame_width + frame_x) * depth / 8;
+    auto value = frame_buffer[offset];
+    if (depth == 1) {
+        uint8_t mask = 1 << (frame_x & 7);
+        value = color ? value | mask : value & ~mask;
+    } else {
+        auto shift = frame_x & 1 ? 0 : 4;
+        value = (value & ~(0x07 << shift)) | (std::min<uint16_t>(color, 7) << shift);
+    }
+    write_byte(offset, value);
+}
+
+void InkplateCanvas::fillRect(const int16_t x, const int16_t y, const int16_t w, const int16_t h, const uint16_t color) {
+    fill_rect(x, y, w, h, color);
+}
+
+void InkplateCanvas::fill_rect(const int x, const int y, const int width, const int height, const uint16_t color) {
+    if (frame_buffer == nullptr) return;
+
+    auto start_x = std::max(x - origin_x, 0);
+    auto start_y = std::max(y - origin_y, 0);
+    auto end_x = std::min(x - origin_x + width, frame_width);
+    auto end_y = std::min(y - origin_y + height, frame_height);
+    if (start_x >= end_x || start_y >= end_y) return;
+
+    // pixels sharing a byte with ones outside the rectangle are written one by one, the bytes in between at once
+    auto pixels_per_byte = 8 / depth;
+    auto bytes_start_x = std::min((start_x + pixels_per_byte - 1) / pixels_per_byte * pixels_per_byte, end_x);
+    auto bytes_end_x = std::max(end_x / pixels_per_byte * pixels_per_byte, bytes_start_x);
+    auto level = static_cast<uint8_t>(std::min<uint16_t>(color, 7));
+    uint8_t fill_byte = depth == 1 ? (color ? 0xff : 0x00) : level << 4 | level;
+
+    for (auto frame_y = start_y; frame_y < end_y; frame_y++) {
+        for (auto frame_x = start_x; frame_x < bytes_start_x; frame_x++) write_pixel(frame_x, frame_y, color);
+        for (auto frame_x = bytes_start_x; frame_x < bytes_end_x; frame_x += pixels_per_byte) {
+            write_byte(static_cast<size_t>(frame_y * frame_width + frame_x) * depth / 8, fill_byte);
+        }
+        for (auto frame_x = bytes_end_x; frame_x < end_x; frame_x++) write_pixel(frame_x, frame_y, color);
+    }
+}
+
+void InkplateCanvas::invert_rect(const int x, const int y, const int width, const int height) {
+    if (frame_buffer == nullptr) return;
+
+    auto start_x = std::max(x - origin_x, 0);
+    auto start_y = std::max(y - origin_y, 0);
+    auto end_x = std::min(x - origin_x + width, frame_width);
+    auto end_y = std::min(y - origin_y + height, frame_height);
+
+    // flipping all 3 bits of a gray level mirrors it, 7 - level
+    for (auto frame_y = start_y; frame_y < end_y; frame_y++) {
+        for (auto frame_x = start_x; frame_x < end_x; frame_x++) {
+            auto offset = static_cast<size_t>(frame_y * frame_width + frame_x) * depth / 8;
+            uint8_t mask = depth == 1 ? 1 << (frame_x & 7) : 0x07 << (frame_x & 1 ? 0 : 4);
+            write_byte(offset, frame_buffer[offset] ^ mask);
+        }
+    }
+}
+
+void InkplateCanvas::draw_image(const int x, const int y, const int width, const int height, const uint8_t *data) {
+    if (frame_buffer == nullptr) return;
+
+    auto pixels_per_byte = 8 / depth;
+    auto stride = (width + pixels_per_byte - 1) / pixels_per_byte;
+    auto frame_x = x - origin_x;
+    auto frame_y = y - origin_y;
+    if (frame_x % pixels_per_byte == 0 && width % pixels_per_byte == 0
+        && frame_x >= 0 && frame_y >= 0 && frame_x + width <= frame_width && frame_y + height <= frame_height) {
+        FrameWindow window{
+            .frame_stride = static_cast<size_t>(frame_width / pixels_per_byte),
+            .x = static_cast<size_t>(frame_x / pixels_per_byte),
+            .y = static_cast<size_t>(frame_y),
+            .stride = static_cast<size_t>(stride)
+        };
+        blit_window(depth == 1 ? blit_1bpp : blit_4bpp, frame_buffer, window, 0, data, static_cast<size_t>(stride) * height, diff);
+        return;
+    }
+
+    for (int row = 0; row < height; row++) {
+        const auto *row_data = data + static_cast<size_t>(row) * stride;
+        for (int column = 0; column < width; column++) {
+            // the wire format keeps the leftmost pixel in the most significant bits
+            auto color = depth == 1
+                ? (row_data[column / 8] >> (7 - column % 8)) & 0x01
+                : (row_data[column / 2] >> (column & 1 ? 0 : 4)) & 0x07;
+            drawPixel(static_cast<int16_t>(x + column), static_cast<int16_t>(y + row), color);
+        }
+    }
+}
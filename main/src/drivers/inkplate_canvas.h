@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <inkplate.hpp>
+
+#include "inkplate_frame_diff.h"
+
+/**
+ * Adafruit_GFX surface drawing into a framebuffer other than the one the Inkplate library refreshes from.
+ * Pixels use the layout of the Inkplate framebuffers, so the 1-bit one keeps the leftmost pixel in the LSB
+ * and the 3-bit one keeps the left pixel of a pair in the high nibble. Colors are 0 and 1 at depth 1
+ * and gray levels 0 (black) to 7 (white) at depth 4. Every changed byte is recorded in the diff.
+ */
+class InkplateCanvas : public Adafruit_GFX {
+public:
+    InkplateCanvas(int16_t width, int16_t height);
+    InkplateCanvas(InkplateCanvas const&) = delete;
+    void operator=(InkplateCanvas const&) = delete;
+
+    /**
+     * Points the canvas to a framebuffer, it has to be called before drawing anything.
+     * @param canvas_width Width of the surface drawn on, which Adafruit_GFX clips text and lines to, e.g. a group canvas
+     * @param canvas_height Height of the surface drawn on
+     * @param origin_x Canvas x coordinate of the left edge of the framebuffer, e.g. the crop of a group canvas
+     * @param origin_y Canvas y coordinate of the top edge of the framebuffer
+     */
+    void begin(uint8_t *frame_buffer, int depth, FrameDiff *diff, int canvas_width, int canvas_height, int origin_x = 0, int origin_y = 0);
+
+    [[nodiscard]] int get_depth() const;
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override;
+
+    /**
+     * Fills a rectangle clipped to the framebuffer, whole bytes at once. Unlike the Adafruit_GFX loops over int16_t
+     * coordinates, it takes rectangles reaching past INT16_MAX.
+     */
+    void fill_rect(int x, int y, int width, int height, uint16_t color);
+    void invert_rect(int x, int y, int width, int height);
+
+    /**
+     * Draws an image in the raw wire format of the canvas depth, rows padded to whole bytes.
+     * Images placed on whole bytes of the framebuffer are copied row by row, the rest goes pixel by pixel.
+     */
+    void draw_image(int x, int y, int width, int height, const uint8_t *data);
+private:
+    void write_byte(size_t offset, uint8_t value);
+    void write_pixel(int frame_x, int frame_y, uint16_t color);
+
+    const int frame_width;
+    const int frame_height;
+
+    uint8_t *frame_buffer;
+    int depth;
+    FrameDiff *diff;
+    int origin_x;
+    int origin_y;
+};
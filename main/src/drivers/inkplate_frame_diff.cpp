@@ -0,0 +1,129 @@
+#include "inkplate_frame_diff.h"
+
+#include <algorithm>
+
+FrameDiff::FrameDiff(const int width, const int height):
+        width{width},
+        height{height},
+        bits_per_pixel{1},
+        row_stride{static_cast<size_t>(width / 8)},
+        row_first_byte(height, CLEAN_ROW),
+        row_last_byte(height, 0),
+        changed_pixels{0},
+        cached_row{0},
+        cached_row_start{0},
+        last_summary{} {}
+
+void FrameDiff::reset(const int bits_per_pixel) {
+    this->bits_per_pixel = bits_per_pixel;
+    this->row_stride = static_cast<size_t>(width * bits_per_pixel / 8);
+    std::fill(row_first_byte.begin(), row_first_byte.end(), CLEAN_ROW);
+    std::fill(row_last_byte.begin(), row_last_byte.end(), 0);
+    this->changed_pixels = 0;
+    this->cached_row = 0;
+    this->cached_row_start = 0;
+}
+
+void FrameDiff::mark(const size_t byte_offset, const uint8_t changed_bits) {
+    if (changed_bits == 0) return;
+
+    if (byte_offset < cached_row_start || byte_offset >= cached_row_start + row_stride) {
+        cached_row = byte_offset / row_stride;
+        cached_row_start = cached_row * row_stride;
+    }
+    if (cached_row >= static_cast<size_t>(height)) return;
+
+    auto column = static_cast<uint16_t>(byte_offset - cached_row_start);
+    auto &first = row_first_byte[cached_row];
+    auto &last = row_last_byte[cached_row];
+    if (first == CLEAN_ROW || column < first) first = column;
+    if (column > last) last = column;
+
+    if (bits_per_pixel == 1) {
+        changed_pixels += __builtin_popcount(changed_bits);
+    } else {
+        // a pixel changed if any bit of its nibble did
+        changed_pixels += ((changed_bits & 0xf0) != 0) + ((changed_bits & 0x0f) != 0);
+    }
+}
+
+FrameDiffSummary FrameDiff::finish() {
+    FrameDiffSummary summary{
+        .changed_pixels = changed_pixels,
+        .dirty_rects = {}
+    };
+
+    auto pixels_per_byte = 8 / bits_per_pixel;
+    int band_start = -1;
+    int band_end = -1;
+    uint16_t band_first_byte = CLEAN_ROW;
+    uint16_t band_last_byte = 0;
+
+    auto close_band = [&]() {
+        if (band_start < 0) return;
+        summary.dirty_rects.push_back({
+            .x = band_first_byte * pixels_per_byte,
+            .y = band_start,
+            .width = (band_last_byte - band_first_byte + 1) * pixels_per_byte,
+            .height = band_end - band_start + 1
+        });
+        band_start = -1;
+        band_first_byte = CLEAN_ROW;
+        band_last_byte = 0;
+    };
+
+    for (int row = 0; row < height; row++) {
+        if (row_first_byte[row] == CLEAN_ROW) continue;
+
+        if (band_start >= 0 && row - band_end > BAND_MERGE_GAP) {
+            close_band();
+        }
+        if (band_start < 0) band_start = row;
+        band_end = row;
+        band_first_byte = std::min(band_first_byte, row_first_byte[row]);
+        band_last_byte = std::max(band_last_byte, row_last_byte[row]);
+    }
+    close_band();
+
+    // keep the list short by merging the bands with the smallest gap between them
+    while (summary.dirty_rects.size() > MAX_DIRTY_RECTS) {
+        size_t closest = 0;
+        int closest_gap = INT32_MAX;
+        for (size_t i = 0; i + 1 < summary.dirty_rects.size(); i++) {
+            auto &a = summary.dirty_rects[i];
+            auto &b = summary.dirty_rects[i + 1];
+            auto gap = b.y - (a.y + a.height);
+            if (gap < closest_gap) {
+                closest_gap = gap;
+                closest = i;
+            }
+        }
+
+        auto &a = summary.dirty_rects[closest];
+        auto &b = summary.dirty_rects[closest + 1];
+        auto x = std::min(a.x, b.x);
+        auto right = std::max(a.x + a.width, b.x + b.width);
+        a = {.x = x, .y = a.y, .width = right - x, .height = b.y + b.height - a.y};
+        summary.dirty_rects.erase(summary.dirty_rects.begin() + static_cast<long>(closest) + 1);
+    }
+
+    {
+        std::lock_guard lock(last_summary_mutex);
+        last_summary = summary;
+    }
+
+    return summary;
+}
+
+FrameDiffSummary FrameDiff::get_last_summary() {
+    std::lock_guard lock(last_summary_mutex);
+    return last_summary;
+}
+
+bool FrameDiff::is_dirty() const {
+    return changed_pixels > 0;
+}
+
+uint32_t FrameDiff::get_changed_pixels() const {
+    return changed_pixels;
+}
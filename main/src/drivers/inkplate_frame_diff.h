@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct DirtyRect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct FrameDiffSummary {
+    uint32_t changed_pixels;
+    std::vector<DirtyRect> dirty_rects;
+};
+
+/**
+ * Tracks which parts of a framebuffer changed while a frame is being written into it.
+ * Changes are recorded per row as a span of bytes and folded into row bands once the frame is complete.
+ */
+class FrameDiff {
+public:
+    FrameDiff(int width, int height);
+
+    void reset(int bits_per_pixel);
+    void mark(size_t byte_offset, uint8_t changed_bits);
+    FrameDiffSummary finish();
+    FrameDiffSummary get_last_summary();
+
+    [[nodiscard]] bool is_dirty() const;
+    [[nodiscard]] uint32_t get_changed_pixels() const;
+private:
+    static constexpr uint16_t CLEAN_ROW = UINT16_MAX;
+    // dirty rows closer than this are merged into a single band
+    static constexpr int BAND_MERGE_GAP = 8;
+    static constexpr size_t MAX_DIRTY_RECTS = 16;
+
+    const int width;
+    const int height;
+    int bits_per_pixel;
+    size_t row_stride;
+
+    std::vector<uint16_t> row_first_byte;
+    std::vector<uint16_t> row_last_byte;
+    uint32_t changed_pixels;
+
+    // row of the last marked byte, saves a division for consecutive changes
+    size_t cached_row;
+    size_t cached_row_start;
+
+    std::mutex last_summary_mutex;
+    FrameDiffSummary last_summary;
+};
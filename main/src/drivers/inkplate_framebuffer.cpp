@@ -0,0 +1,222 @@
+#include "inkplate_framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_rom_crc.h>
+
+#include "utils.h"
+
+enum class BlitMode {
+    COPY,
+    // the converted chunk is XORed onto the framebuffer content instead of replacing it
+    XOR,
+};
+
+/**
+ * Applies a per-byte conversion to a chunk while copying it into a framebuffer.
+ * The bulk of the chunk is converted a word at a time, only the unaligned head and tail go byte by byte.
+ * When a diff is given, every byte that ends up different from the previous framebuffer content is recorded in it.
+ */
+template<BlitMode mode, typename ByteOp, typename WordOp>
+static inline void blit_words(
+        uint8_t *frame_buffer,
+        const size_t offset,
+        const uint8_t *src,
+        const size_t len,
+        FrameDiff *diff,
+        ByteOp byte_op,
+        WordOp word_op
+) {
+    auto *dst = frame_buffer + offset;
+    const auto *src_end = src + len;
+
+    auto write_byte = [&](uint8_t value) {
+        if constexpr (mode == BlitMode::XOR) value ^= *dst;
+        if (diff != nullptr) diff->mark(dst - frame_buffer, *dst ^ value);
+        *dst++ = value;
+    };
+
+    // head, until the destination is word aligned
+    while (src < src_end && (reinterpret_cast<uintptr_t>(dst) & 0b11) != 0) {
+        write_byte(byte_op(*src++));
+    }
+
+    // body, one word at a time (the source can be unaligned as it points into the MQTT buffer)
+    while (src_end - src >= 4) {
+        uint32_t word;
+        std::memcpy(&word, src, sizeof(word));
+        word = word_op(word);
+
+        auto *dst_word = reinterpret_cast<uint32_t *>(dst);
+        if constexpr (mode == BlitMode::XOR) word ^= *dst_word;
+        if (diff != nullptr && *dst_word != word) {
+            auto changed_bits = *dst_word ^ word;
+            auto word_offset = static_cast<size_t>(dst - frame_buffer);
+            for (size_t i = 0; i < 4; i++) {
+                diff->mark(word_offset + i, (changed_bits >> (i * 8)) & 0xff);
+            }
+        }
+        *dst_word = word;
+
+        dst += 4;
+        src += 4;
+    }
+
+    // tail
+    while (src < src_end) {
+        write_byte(byte_op(*src++));
+    }
+}
+
+static inline uint8_t reverse_bits_in_byte(const uint8_t byte) {
+    return reverse_bits_table[byte];
+}
+
+static inline uint32_t reverse_bits_in_word(const uint32_t word) {
+    return static_cast<uint32_t>(reverse_bits_table[word & 0xff])
+        | static_cast<uint32_t>(reverse_bits_table[(word >> 8) & 0xff]) << 8
+        | static_cast<uint32_t>(reverse_bits_table[(word >> 16) & 0xff]) << 16
+        | static_cast<uint32_t>(reverse_bits_table[word >> 24]) << 24;
+}
+
+static inline uint8_t nibbles_to_3bit_byte(const uint8_t byte) {
+    return byte & 0x77;
+}
+
+static inline uint32_t nibbles_to_3bit_word(const uint32_t word) {
+    // eight pixels at once, every nibble keeps its position and drops the 4th bit
+    return word & 0x77777777;
+}
+
+void blit_1bpp(uint8_t *frame_buffer, const size_t offset, const uint8_t *data, const size_t data_len, FrameDiff *diff) {
+    blit_words<BlitMode::COPY>(frame_buffer, offset, data, data_len, diff, reverse_bits_in_byte, reverse_bits_in_word);
+}
+
+void blit_4bpp(uint8_t *frame_buffer, const size_t offset, const uint8_t *data, const size_t data_len, FrameDiff *diff) {
+    blit_words<BlitMode::COPY>(frame_buffer, offset, data, data_len, diff, nibbles_to_3bit_byte, nibbles_to_3bit_word);
+}
+
+void xor_1bpp(uint8_t *frame_buffer, const size_t offset, const uint8_t *data, const size_t data_len, FrameDiff *diff) {
+    blit_words<BlitMode::XOR>(frame_buffer, offset, data, data_len, diff, reverse_bits_in_byte, reverse_bits_in_word);
+}
+
+void xor_4bpp(uint8_t *frame_buffer, const size_t offset, const uint8_t *data, const size_t data_len, FrameDiff *diff) {
+    blit_words<BlitMode::XOR>(frame_buffer, offset, data, data_len, diff, nibbles_to_3bit_byte, nibbles_to_3bit_word);
+}
+
+void blit_window(
+        const BlitFunction blit,
+        uint8_t *frame_buffer,
+        const FrameWindow &window,
+        size_t offset,
+        const uint8_t *data,
+        size_t data_len,
+        FrameDiff *diff
+) {
+    while (data_len > 0) {
+        auto row = offset / window.stride;
+        auto column = offset % window.stride;
+        auto segment_len = std::min(window.stride - column, data_len);
+
+        auto frame_offset = (window.y + row) * window.frame_stride + window.x + column;
+        blit(frame_buffer, frame_offset, data, segment_len, diff);
+
+        offset += segment_len;
+        data += segment_len;
+        data_len -= segment_len;
+    }
+}
+
+void blit_crop(
+        const BlitFunction blit,
+        uint8_t *frame_buffer,
+        const FrameCrop &crop,
+        size_t offset,
+        const uint8_t *data,
+        size_t data_len,
+        FrameDiff *diff
+) {
+    while (data_len > 0) {
+        auto row = static_cast<ptrdiff_t>(offset / crop.source_stride);
+        auto column = static_cast<ptrdiff_t>(offset % crop.source_stride);
+        auto segment_len = std::min(crop.source_stride - static_cast<size_t>(column), data_len);
+
+        // only the columns of the segment which fall within the framebuffer are copied
+        auto frame_row = row - crop.y;
+        auto start = std::max(column, crop.x);
+        auto end = std::min(column + static_cast<ptrdiff_t>(segment_len), crop.x + static_cast<ptrdiff_t>(crop.stride));
+        if (frame_row >= 0 && frame_row < static_cast<ptrdiff_t>(crop.height) && start < end) {
+            auto frame_offset = frame_row * crop.stride + (start - crop.x);
+            blit(frame_buffer, frame_offset, data + (start - column), end - start, diff);
+        }
+
+        offset += segment_len;
+        data += segment_len;
+        data_len -= segment_len;
+    }
+}
+
+void read_1bpp(const uint8_t *frame_buffer, const size_t offset, uint8_t *data, const size_t data_len) {
+    const auto *src = frame_buffer + offset;
+    const auto *src_end = src + data_len;
+
+    // the framebuffer is word aligned, so the bulk is converted a word at a time once the source is
+    while (src < src_end && (reinterpret_cast<uintptr_t>(src) & 0b11) != 0) {
+        *data++ = reverse_bits_in_byte(*src++);
+    }
+
+    while (src_end - src >= 4) {
+        auto word = reverse_bits_in_word(*reinterpret_cast<const uint32_t *>(src));
+        std::memcpy(data, &word, sizeof(word));
+        data += 4;
+        src += 4;
+    }
+
+    while (src < src_end) {
+        *data++ = reverse_bits_in_byte(*src++);
+    }
+}
+
+void read_4bpp(const uint8_t *frame_buffer, const size_t offset, uint8_t *data, const size_t data_len) {
+    // every framebuffer nibble already is a valid 4bpp pixel
+    std::memcpy(data, frame_buffer + offset, data_len);
+}
+
+void read_window(
+        const ReadFunction read,
+        const uint8_t *frame_buffer,
+        const FrameWindow &window,
+        size_t offset,
+        uint8_t *data,
+        size_t data_len
+) {
+    while (data_len > 0) {
+        auto row = offset / window.stride;
+        auto column = offset % window.stride;
+        auto segment_len = std::min(window.stride - column, data_len);
+
+        auto frame_offset = (window.y + row) * window.frame_stride + window.x + column;
+        read(frame_buffer, frame_offset, data, segment_len);
+
+        offset += segment_len;
+        data += segment_len;
+        data_len -= segment_len;
+    }
+}
+
+uint32_t hash_frame(const uint8_t *frame_buffer, const size_t frame_size, const int depth) {
+    if (depth == 4) {
+        return esp_rom_crc32_le(0, frame_buffer, frame_size);
+    }
+
+    // 1-bit frames are hashed in their wire bit order, a small chunk at a time
+    uint8_t chunk[256];
+    uint32_t hash = 0;
+    for (size_t offset = 0; offset < frame_size; offset += sizeof(chunk)) {
+        auto chunk_len = std::min(sizeof(chunk), frame_size - offset);
+        read_1bpp(frame_buffer, offset, chunk, chunk_len);
+        hash = esp_rom_crc32_le(hash, chunk, chunk_len);
+    }
+    return hash;
+}
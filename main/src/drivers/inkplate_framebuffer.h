@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "inkplate_frame_diff.h"
+
+/**
+ * Copies a chunk of a raw 1bpp frame into the 1-bit Inkplate framebuffer.
+ * The wire format stores the leftmost pixel in the MSB while the framebuffer stores it in the LSB,
+ * otherwise both are row-major with rows packed back to back, so a chunk may start or end mid-row.
+ * @param frame_buffer The 1-bit framebuffer (Inkplate::_partial)
+ * @param offset Byte offset of the chunk within the frame
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the changed bytes in
+ */
+void blit_1bpp(uint8_t *frame_buffer, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+/**
+ * Copies a chunk of a raw 4bpp frame into the 3-bit Inkplate framebuffer.
+ * Both layouts keep the left pixel of a pair in the high nibble, the framebuffer just uses 3 bits per pixel,
+ * so each nibble loses its 4th bit and the whole conversion runs eight pixels per 32-bit operation.
+ * @param frame_buffer The 3-bit framebuffer (Inkplate::DMemory4Bit)
+ * @param offset Byte offset of the chunk within the frame
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the changed bytes in
+ */
+void blit_4bpp(uint8_t *frame_buffer, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+/**
+ * XORs a chunk of a raw 1bpp delta onto the 1-bit Inkplate framebuffer, flipping the pixels set in it.
+ * @param frame_buffer The 1-bit framebuffer (Inkplate::_partial)
+ * @param offset Byte offset of the chunk within the frame
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the flipped bytes in
+ */
+void xor_1bpp(uint8_t *frame_buffer, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+/**
+ * XORs a chunk of a raw 4bpp delta onto the 3-bit Inkplate framebuffer, the 4th bit of every nibble is ignored.
+ * @param frame_buffer The 3-bit framebuffer (Inkplate::DMemory4Bit)
+ * @param offset Byte offset of the chunk within the frame
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the changed bytes in
+ */
+void xor_4bpp(uint8_t *frame_buffer, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+using BlitFunction = void (*)(uint8_t *frame_buffer, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff);
+
+/**
+ * Placement of a rectangular window within a framebuffer, in bytes.
+ */
+struct FrameWindow {
+    size_t frame_stride;
+    size_t x;
+    size_t y;
+    size_t stride;
+};
+
+/**
+ * Copies a chunk of a window payload into a framebuffer, one row segment at a time.
+ * The payload holds the window rows packed back to back, so a chunk may start or end mid-row.
+ * @param blit The pixel format conversion to use (blit_1bpp or blit_4bpp)
+ * @param frame_buffer The framebuffer
+ * @param window Placement of the window within the framebuffer
+ * @param offset Byte offset of the chunk within the window payload
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the changed bytes in
+ */
+void blit_window(BlitFunction blit, uint8_t *frame_buffer, const FrameWindow &window, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+/**
+ * Part of a larger payload covered by the framebuffer, in bytes, e.g. one panel of a video wall.
+ */
+struct FrameCrop {
+    size_t source_stride;
+    // position of the framebuffer within the payload, negative if the payload starts further right or down
+    ptrdiff_t x;
+    ptrdiff_t y;
+    size_t stride;
+    size_t height;
+};
+
+/**
+ * Copies the part of a payload chunk covered by the framebuffer into it, one row segment at a time.
+ * The payload holds its rows packed back to back, so a chunk may start or end mid-row.
+ * @param blit The pixel format conversion to use (blit_1bpp or blit_4bpp)
+ * @param frame_buffer The framebuffer
+ * @param crop Placement of the framebuffer within the payload
+ * @param offset Byte offset of the chunk within the payload
+ * @param data The chunk
+ * @param data_len Length of the chunk in bytes
+ * @param diff Optional diff to record the changed bytes in
+ */
+void blit_crop(BlitFunction blit, uint8_t *frame_buffer, const FrameCrop &crop, size_t offset, const uint8_t *data, size_t data_len, FrameDiff *diff = nullptr);
+
+/**
+ * Copies a part of the 1-bit Inkplate framebuffer out in the raw 1bpp wire format.
+ * @param frame_buffer The 1-bit framebuffer
+ * @param offset Byte offset of the part within the frame
+ * @param data Output buffer
+ * @param data_len Length of the part in bytes
+ */
+void read_1bpp(const uint8_t *frame_buffer, size_t offset, uint8_t *data, size_t data_len);
+
+/**
+ * Copies a part of the 3-bit Inkplate framebuffer out in the raw 4bpp wire format.
+ * Pixels keep their 3-bit values, so the output uses gray levels 0 to 7 just like the framebuffer.
+ * @param frame_buffer The 3-bit framebuffer
+ * @param offset Byte offset of the part within the frame
+ * @param data Output buffer
+ * @param data_len Length of the part in bytes
+ */
+void read_4bpp(const uint8_t *frame_buffer, size_t offset, uint8_t *data, size_t data_len);
+
+using ReadFunction = void (*)(const uint8_t *frame_buffer, size_t offset, uint8_t *data, size_t data_len);
+
+/**
+ * Copies a part of a window out of a framebuffer, one row segment at a time.
+ * The output holds the window rows packed back to back, the same way blit_window expects them.
+ * @param read The pixel format conversion to use (read_1bpp or read_4bpp)
+ * @param frame_buffer The framebuffer
+ * @param window Placement of the window within the framebuffer
+ * @param offset Byte offset of the part within the window payload
+ * @param data Output buffer
+ * @param data_len Length of the part in bytes
+ */
+void read_window(ReadFunction read, const uint8_t *frame_buffer, const FrameWindow &window, size_t offset, uint8_t *data, size_t data_len);
+
+/**
+ * Computes the CRC32 (as used by zlib) of a framebuffer in the raw wire format of its depth,
+ * so the result matches the hash of the raw_1bpp or raw_4bpp payload which produced it.
+ * @param frame_buffer The framebuffer
+ * @param frame_size Size of the frame in bytes
+ * @param depth Bits per pixel of the frame, 1 or 4
+ */
+uint32_t hash_frame(const uint8_t *frame_buffer, size_t frame_size, int depth);
@@ -1,8 +1,16 @@
 #include "inkplate_touchpad.h"
 
-InkplateTouchpad::InkplateTouchpad(Inkplate &inkplate, const std::function<void(const InkplateTouchpadEvent event)> &on_event) :
+#include <algorithm>
+
+#include <esp_attr.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+
+InkplateTouchpad::InkplateTouchpad(Inkplate &inkplate, std::mutex &expander_mutex, const std::function<void(const InkplateTouchpadEvent event)> &on_event) :
         inkplate{inkplate},
-        on_event{on_event} {
+        expander_mutex{expander_mutex},
+        on_event{on_event},
+        interrupt_queue{xQueueCreate(8, sizeof(uint8_t))} {
     for (const auto pad_id: {PAD1, PAD2, PAD3}) {
         buttons.emplace_back(
            pad_id
@@ -10,20 +18,90 @@ InkplateTouchpad::InkplateTouchpad(Inkplate &inkplate, const std::function<void(
     }
 }
 
-std::optional<InkplateTouchpadEvent> InkplateTouchpad::update() {
-    for (auto& btn : buttons) {
-        auto state = inkplate.readTouchpad(btn.id);
+void IRAM_ATTR InkplateTouchpad::on_interrupt(void *arg) {
+    auto queue = static_cast<QueueHandle_t>(arg);
+    uint8_t pending = 1;
+    BaseType_t is_task_woken = pdFALSE;
+
+    // the line stays raised until the pads are read, which cannot be done from here
+    gpio_intr_disable(INTERRUPT_PIN);
+    xQueueSendFromISR(queue, &pending, &is_task_woken);
+    portYIELD_FROM_ISR(is_task_woken);
+}
+
+esp_err_t InkplateTouchpad::begin() {
+    {
+        std::lock_guard lock(expander_mutex);
 
-        auto button_event = btn.update(state);
-        if (!button_event) continue;
+        // INTB active high and push-pull, raised by any change of the pads on port B
+        inkplate.setIntOutput(1, false, false, HIGH, IO_INT_ADDR);
+        for (const auto &btn : buttons) {
+            inkplate.setIntPin(btn.id, CHANGE, IO_INT_ADDR);
+        }
+    }
 
-        auto event = InkplateTouchpadEvent{
-            .pad_id = btn.id,
-            .event_type = button_event.value(),
-        };
+    gpio_config_t interrupt_pin_config{
+        .pin_bit_mask = 1ULL << INTERRUPT_PIN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_HIGH_LEVEL
+    };
+    auto err = gpio_config(&interrupt_pin_config);
+    if (err != ESP_OK) return err;
+
+    err = gpio_wakeup_enable(INTERRUPT_PIN, GPIO_INTR_HIGH_LEVEL);
+    if (err != ESP_OK) return err;
+    err = esp_sleep_enable_gpio_wakeup();
+    if (err != ESP_OK) return err;
+
+    // the ISR service may have been installed by someone else already
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err;
+
+    err = gpio_isr_handler_add(INTERRUPT_PIN, on_interrupt, interrupt_queue);
+    if (err != ESP_OK) return err;
+
+    return ESP_OK;
+}
 
-        this->on_event(event);
-        return event;
+void InkplateTouchpad::read_pads(const int64_t now_us) {
+    // waits for a refresh in progress to finish, a press is still recognized afterwards as INTB stays raised
+    std::lock_guard lock(expander_mutex);
+    for (auto &btn : buttons) {
+        btn.sample(inkplate.readTouchpad(btn.id), now_us);
     }
-    return std::nullopt;
-}
\ No newline at end of file
+}
+
+TickType_t InkplateTouchpad::get_wait_ticks(const int64_t now_us) const {
+    std::optional<int64_t> deadline;
+    for (const auto &btn : buttons) {
+        auto btn_deadline = btn.get_deadline();
+        if (btn_deadline && (!deadline || *btn_deadline < *deadline)) deadline = btn_deadline;
+    }
+
+    if (!deadline) return portMAX_DELAY;
+    auto wait_ms = (std::max(*deadline - now_us, static_cast<int64_t>(0)) + 999) / 1000;
+    return pdMS_TO_TICKS(wait_ms) + 1;
+}
+
+void InkplateTouchpad::run_event_loop() {
+    for (;;) {
+        uint8_t pending;
+        xQueueReceive(interrupt_queue, &pending, get_wait_ticks(esp_timer_get_time()));
+
+        // the pads are read on deadlines too, to finish debouncing them and to recognize a long press
+        auto now_us = esp_timer_get_time();
+        read_pads(now_us);
+        gpio_intr_enable(INTERRUPT_PIN);
+
+        for (auto &btn : buttons) {
+            while (auto button_event = btn.poll(now_us)) {
+                this->on_event(InkplateTouchpadEvent{
+                    .pad_id = btn.id,
+                    .event_type = *button_event,
+                });
+            }
+        }
+    }
+}
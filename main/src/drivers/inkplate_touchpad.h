@@ -2,22 +2,42 @@
 
 #include <vector>
 #include <functional>
+#include <mutex>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <driver/gpio.h>
 #include <inkplate.hpp>
 
 #include "inkplate_button.h"
 
 struct InkplateTouchpadEvent {
     const int pad_id;
-    const InkplateButton::ButtonState event_type;
+    const InkplateButton::ButtonEvent event_type;
 };
 
+/**
+ * Reports touchpad events without polling. The pads sit on the MCP23017 I/O expander, which raises its INTB
+ * line, wired to GPIO34, whenever one of them changes, until the pads are read. The GPIO interrupt is level
+ * triggered, so it also wakes the chip from light sleep. It disables itself and wakes up the event loop through
+ * a queue, which reads the pads over I2C and enables it again. The expander is shared with the refresh, so it is
+ * only accessed while holding the given lock.
+ */
 class InkplateTouchpad {
 public:
-    InkplateTouchpad(Inkplate &inkplate, const std::function<void(const InkplateTouchpadEvent event)> &on_event);
-    std::optional<InkplateTouchpadEvent> update();
+    static constexpr gpio_num_t INTERRUPT_PIN = GPIO_NUM_34;
+
+    InkplateTouchpad(Inkplate &inkplate, std::mutex &expander_mutex, const std::function<void(const InkplateTouchpadEvent event)> &on_event);
+    esp_err_t begin();
+    [[noreturn]] void run_event_loop();
 private:
+    static void on_interrupt(void *arg);
+    void read_pads(int64_t now_us);
+    [[nodiscard]] TickType_t get_wait_ticks(int64_t now_us) const;
+
     Inkplate &inkplate;
+    std::mutex &expander_mutex;
     std::vector<InkplateButton> buttons;
     std::function<void(const InkplateTouchpadEvent event)> on_event;
-};
\ No newline at end of file
+    QueueHandle_t interrupt_queue;
+};
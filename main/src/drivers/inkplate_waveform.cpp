@@ -1 +1,112 @@
 #include "inkplate_waveform.h"
+
+#include <algorithm>
+
+#include <esp_log.h>
+#include <nvs_handle.hpp>
+
+#include "utils.h"
+
+const Waveform INKPLATE_WAVEFORMS[5] = {
+    {{{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {0, 0, 2, 1, 1, 2, 2, 1, 0},
+      {0, 1, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 2, 1, 2, 2, 2, 1, 0}, {0, 2, 2, 2, 2, 2, 2, 1, 0},
+      {0, 0, 0, 0, 0, 2, 1, 2, 0}, {0, 0, 0, 2, 2, 2, 2, 2, 0}}},
+    {{{0, 0, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 2, 1, 2, 1, 1, 0}, {0, 0, 0, 2, 2, 1, 2, 1, 0},
+      {0, 0, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 0, 2, 1, 1, 1, 2, 0}, {0, 0, 2, 2, 2, 1, 1, 2, 0},
+      {0, 0, 0, 0, 0, 1, 2, 2, 0}, {0, 0, 0, 0, 2, 2, 2, 2, 0}}},
+    {{{0, 3, 3, 3, 3, 3, 3, 3, 0}, {0, 1, 2, 1, 1, 2, 2, 1, 0}, {0, 2, 2, 2, 1, 2, 2, 1, 0},
+      {0, 0, 2, 2, 2, 2, 2, 1, 0}, {0, 3, 3, 2, 1, 1, 1, 2, 0}, {0, 3, 3, 2, 2, 1, 1, 2, 0},
+      {0, 2, 1, 2, 1, 2, 1, 2, 0}, {0, 3, 3, 3, 2, 2, 2, 2, 0}}},
+    {{{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {0, 0, 2, 1, 1, 2, 2, 1, 0},
+      {1, 1, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 2, 1, 2, 2, 2, 1, 0}, {0, 1, 2, 2, 2, 2, 2, 1, 0},
+      {0, 0, 0, 2, 2, 2, 1, 2, 0}, {0, 0, 0, 2, 2, 2, 2, 2, 0}}},
+    {{{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {2, 2, 2, 1, 0, 2, 1, 0, 0},
+      {2, 1, 1, 2, 1, 1, 1, 2, 0}, {2, 2, 2, 1, 1, 1, 0, 2, 0}, {2, 2, 2, 1, 1, 2, 1, 2, 0},
+      {0, 0, 0, 0, 2, 1, 2, 2, 0}, {0, 0, 0, 0, 2, 2, 2, 2, 0}}},
+};
+
+static std::string get_custom_waveform_key(const uint8_t id) {
+    return string_format("waveform_%d", id);
+}
+
+WaveformLibrary::WaveformLibrary(): custom_waveforms{} {}
+
+esp_err_t WaveformLibrary::load_from_nvs() {
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READONLY, &err);
+    if (err != ESP_OK) return err;
+
+    std::lock_guard lock(mutex);
+    for (uint8_t i = 0; i < CUSTOM_WAVEFORMS; i++) {
+        Waveform waveform;
+        auto key = get_custom_waveform_key(FIRST_CUSTOM_WAVEFORM + i);
+        if (nvs_handle->get_blob(key.c_str(), waveform.data(), sizeof(waveform)) != ESP_OK) continue;
+
+        if (!is_valid(waveform)) {
+            ESP_LOGW("WaveformLibrary", "Ignoring invalid custom waveform %d", FIRST_CUSTOM_WAVEFORM + i);
+            continue;
+        }
+        custom_waveforms[i] = waveform;
+    }
+
+    return ESP_OK;
+}
+
+std::optional<Waveform> WaveformLibrary::get(const uint8_t id) {
+    if (id >= 1 && id <= BUILTIN_WAVEFORMS) {
+        return INKPLATE_WAVEFORMS[id - 1];
+    }
+
+    if (is_custom(id)) {
+        std::lock_guard lock(mutex);
+        return custom_waveforms[id - FIRST_CUSTOM_WAVEFORM];
+    }
+
+    return std::nullopt;
+}
+
+esp_err_t WaveformLibrary::set_custom(const uint8_t id, const Waveform &waveform) {
+    if (!is_custom(id) || !is_valid(waveform)) return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READWRITE, &err);
+    if (err != ESP_OK) return err;
+
+    auto key = get_custom_waveform_key(id);
+    err = nvs_handle->set_blob(key.c_str(), waveform.data(), sizeof(waveform));
+    if (err != ESP_OK) return err;
+    err = nvs_handle->commit();
+    if (err != ESP_OK) return err;
+
+    std::lock_guard lock(mutex);
+    custom_waveforms[id - FIRST_CUSTOM_WAVEFORM] = waveform;
+    return ESP_OK;
+}
+
+esp_err_t WaveformLibrary::erase_custom(const uint8_t id) {
+    if (!is_custom(id)) return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err;
+    std::shared_ptr nvs_handle = nvs::open_nvs_handle("vsb_eink", NVS_READWRITE, &err);
+    if (err != ESP_OK) return err;
+
+    auto key = get_custom_waveform_key(id);
+    err = nvs_handle->erase_item(key.c_str());
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
+    err = nvs_handle->commit();
+    if (err != ESP_OK) return err;
+
+    std::lock_guard lock(mutex);
+    custom_waveforms[id - FIRST_CUSTOM_WAVEFORM].reset();
+    return ESP_OK;
+}
+
+bool WaveformLibrary::is_custom(const uint8_t id) {
+    return id >= FIRST_CUSTOM_WAVEFORM && id < FIRST_CUSTOM_WAVEFORM + CUSTOM_WAVEFORMS;
+}
+
+bool WaveformLibrary::is_valid(const Waveform &waveform) {
+    return std::all_of(waveform.begin(), waveform.end(), [](const auto &level) {
+        return std::all_of(level.begin(), level.end(), [](const uint8_t phase) { return phase <= 3; });
+    });
+}
@@ -1,21 +1,41 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include <esp_err.h>
+
+// drive phases of every 3-bit gray level, each phase is 0 (no drive), 1 (towards black), 2 (towards white) or 3 (off)
+using Waveform = std::array<std::array<uint8_t, 9>, 8>;
+static_assert(sizeof(Waveform) == 8 * 9, "the Inkplate library expects the phases of all levels packed back to back");
 
 // All waveforms for Inkplate 10 board
-uint8_t waveform1[8][9] = {{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {0, 0, 2, 1, 1, 2, 2, 1, 0},
-                           {0, 1, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 2, 1, 2, 2, 2, 1, 0}, {0, 2, 2, 2, 2, 2, 2, 1, 0},
-                           {0, 0, 0, 0, 0, 2, 1, 2, 0}, {0, 0, 0, 2, 2, 2, 2, 2, 0}};
-uint8_t waveform2[8][9] = {{0, 0, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 2, 1, 2, 1, 1, 0}, {0, 0, 0, 2, 2, 1, 2, 1, 0},
-                           {0, 0, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 0, 2, 1, 1, 1, 2, 0}, {0, 0, 2, 2, 2, 1, 1, 2, 0},
-                           {0, 0, 0, 0, 0, 1, 2, 2, 0}, {0, 0, 0, 0, 2, 2, 2, 2, 0}};
-uint8_t waveform3[8][9] = {{0, 3, 3, 3, 3, 3, 3, 3, 0}, {0, 1, 2, 1, 1, 2, 2, 1, 0}, {0, 2, 2, 2, 1, 2, 2, 1, 0},
-                           {0, 0, 2, 2, 2, 2, 2, 1, 0}, {0, 3, 3, 2, 1, 1, 1, 2, 0}, {0, 3, 3, 2, 2, 1, 1, 2, 0},
-                           {0, 2, 1, 2, 1, 2, 1, 2, 0}, {0, 3, 3, 3, 2, 2, 2, 2, 0}};
-uint8_t waveform4[8][9] = {{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {0, 0, 2, 1, 1, 2, 2, 1, 0},
-                           {1, 1, 2, 2, 1, 2, 2, 1, 0}, {0, 0, 2, 1, 2, 2, 2, 1, 0}, {0, 1, 2, 2, 2, 2, 2, 1, 0},
-                           {0, 0, 0, 2, 2, 2, 1, 2, 0}, {0, 0, 0, 2, 2, 2, 2, 2, 0}};
-uint8_t waveform5[8][9] = {{0, 0, 0, 0, 0, 0, 0, 1, 0}, {0, 0, 0, 2, 2, 2, 1, 1, 0}, {2, 2, 2, 1, 0, 2, 1, 0, 0},
-                           {2, 1, 1, 2, 1, 1, 1, 2, 0}, {2, 2, 2, 1, 1, 1, 0, 2, 0}, {2, 2, 2, 1, 1, 2, 1, 2, 0},
-                           {0, 0, 0, 0, 2, 1, 2, 2, 0}, {0, 0, 0, 0, 2, 2, 2, 2, 0}};
-uint8_t *INKPLATE_WAVEFORMS[] = {&waveform1[0][0], &waveform2[0][0], &waveform3[0][0], &waveform4[0][0], &waveform5[0][0]};
+extern const Waveform INKPLATE_WAVEFORMS[5];
+
+/**
+ * Built-in waveforms together with custom ones uploaded at runtime and kept in NVS.
+ * Waveform 0 is the one built into the Inkplate library, 1 to 5 are the INKPLATE_WAVEFORMS
+ * and the custom ones take the ids right after them.
+ */
+class WaveformLibrary {
+public:
+    static constexpr uint8_t BUILTIN_WAVEFORMS = sizeof(INKPLATE_WAVEFORMS) / sizeof(INKPLATE_WAVEFORMS[0]);
+    static constexpr uint8_t CUSTOM_WAVEFORMS = 4;
+    static constexpr uint8_t FIRST_CUSTOM_WAVEFORM = BUILTIN_WAVEFORMS + 1;
+
+    WaveformLibrary();
+
+    esp_err_t load_from_nvs();
+    std::optional<Waveform> get(uint8_t id);
+    esp_err_t set_custom(uint8_t id, const Waveform &waveform);
+    esp_err_t erase_custom(uint8_t id);
+
+    static bool is_custom(uint8_t id);
+    static bool is_valid(const Waveform &waveform);
+private:
+    std::mutex mutex;
+    std::array<std::optional<Waveform>, CUSTOM_WAVEFORMS> custom_waveforms;
+};
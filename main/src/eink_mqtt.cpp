@@ -1,22 +1,47 @@
 #include "eink_mqtt.h"
 
+#include <unordered_set>
+
 #include <esp_log.h>
 
 MQTTClient::MQTTClient(
         const idf::mqtt::BrokerConfiguration& broker,
         const idf::mqtt::ClientCredentials& credentials,
         const idf::mqtt::Configuration& config
-        ) : idf::mqtt::Client{broker, credentials, config}, handlers{}, connection_status{ConnectionStatus::CONNECTING} {}
+        ) : idf::mqtt::Client{broker, credentials, config},
+            handlers{},
+            exact_handlers{},
+            wildcard_handlers{},
+            current_message{.handler_count = 0, .handlers = {}},
+            has_new_handlers{false},
+            connection_status{ConnectionStatus::CONNECTING},
+            status_callback{},
+            pending_registrants{0} {}
 
 esp_err_t MQTTClient::register_handler(const MQTTTopicHandler& handler) {
-    auto message_id = subscribe(const_cast<MQTTTopicHandler&>(handler).filter.get(), handler.qos);
+    // the handler is stored first, so it is subscribed by on_connected even if the connection is made meanwhile
+    {
+        std::lock_guard lock(handlers_mutex);
+        auto &registered = handlers.emplace_back(handler);
+        std::string_view filter = registered.filter.get();
+
+        if (filter.find_first_of("+#") == std::string_view::npos) {
+            exact_handlers.emplace(filter, &registered);
+        } else {
+            wildcard_handlers.push_back(&registered);
+        }
+    }
+    has_new_handlers = true;
 
-    if (!message_id.has_value()) {
-        ESP_LOGE("MQTTClient", "Failed to register handler for topic %s", const_cast<MQTTTopicHandler&>(handler).filter.get().c_str());
-        return ESP_FAIL;
+    if (connection_status == ConnectionStatus::CONNECTED) {
+        auto message_id = subscribe(const_cast<MQTTTopicHandler&>(handler).filter.get(), handler.qos);
+
+        if (!message_id.has_value()) {
+            ESP_LOGE("MQTTClient", "Failed to register handler for topic %s", const_cast<MQTTTopicHandler&>(handler).filter.get().c_str());
+            return ESP_FAIL;
+        }
     }
 
-    handlers.push_back(handler);
     ESP_LOGI("MQTTClient", "Registered handler for topic %s", const_cast<MQTTTopicHandler&>(handler).filter.get().c_str());
     return ESP_OK;
 }
@@ -25,27 +50,79 @@ esp_err_t MQTTClient::set_uri(const std::string& uri) {
     return esp_mqtt_client_set_uri(handler.get(), uri.c_str());
 }
 
+esp_err_t MQTTClient::start() {
+    set_status(ConnectionStatus::CONNECTING);
+    return esp_mqtt_client_start(handler.get());
+}
+
+/**
+ * Stops the client including its own reconnection attempts, must not be called from a handler.
+ */
+esp_err_t MQTTClient::stop() {
+    auto err = esp_mqtt_client_stop(handler.get());
+    set_status(ConnectionStatus::FAILED);
+    return err;
+}
+
 esp_err_t MQTTClient::reconnect() {
     return esp_mqtt_client_reconnect(handler.get());
 }
 
-esp_err_t MQTTClient::wait_for_connection(const int retries) {
-    if (retries == 0) {
-        return ESP_FAIL;
-    }
+esp_err_t MQTTClient::disconnect() {
+    return esp_mqtt_client_disconnect(handler.get());
+}
 
-    ESP_LOGI("MQTTClient", "Waiting for connection to MQTT broker");
-    this->connection_status.wait(ConnectionStatus::CONNECTING);
+/**
+ * Holds the connection back until the given number of tasks have registered their handlers. Messages queued by
+ * the broker for a persistent session are delivered right after connecting and would get lost without a handler.
+ * Has to be called right after the client is constructed, before it has had the time to connect.
+ * @param registrants Number of tasks which are going to call release_connection
+ */
+esp_err_t MQTTClient::defer_connection(const int registrants) {
+    pending_registrants = registrants;
+    return esp_mqtt_client_stop(handler.get());
+}
 
-    ESP_LOGI("MQTTClient", "Connection status: %d", this->connection_status.load());
-    switch (this->connection_status.load()) {
-        case ConnectionStatus::CONNECTED:
-            return ESP_OK;
-        case ConnectionStatus::FAILED:
-            return ESP_FAIL;
-        default:
-            return wait_for_connection(retries - 1);
+esp_err_t MQTTClient::release_connection() {
+    if (pending_registrants.fetch_sub(1) != 1) return ESP_OK;
+
+    ESP_LOGI("MQTTClient", "All handlers registered, connecting");
+    return start();
+}
+
+bool MQTTClient::is_connection_released() const {
+    return pending_registrants <= 0;
+}
+
+/**
+ * Waits until the connection attempt in progress either succeeds or fails.
+ * @return CONNECTING if it is still in progress after the timeout
+ */
+MQTTClient::ConnectionStatus MQTTClient::wait_for_connection(const std::chrono::milliseconds timeout) {
+    std::unique_lock lock(status_mutex);
+    status_changed.wait_for(lock, timeout, [this] { return connection_status != ConnectionStatus::CONNECTING; });
+    return connection_status;
+}
+
+MQTTClient::ConnectionStatus MQTTClient::get_status() const {
+    return connection_status;
+}
+
+/**
+ * Sets a callback called from the MQTT task whenever the connection status changes, it must not block.
+ * Has to be set before the connection is started.
+ */
+void MQTTClient::set_status_callback(const std::function<void()>& callback) {
+    status_callback = callback;
+}
+
+void MQTTClient::set_status(const ConnectionStatus status) {
+    {
+        std::lock_guard lock(status_mutex);
+        connection_status = status;
     }
+    status_changed.notify_all();
+    if (status_callback) status_callback();
 }
 
 void MQTTClient::on_subscribed(const esp_mqtt_event_handle_t event) {};
@@ -55,29 +132,89 @@ void MQTTClient::on_error(const esp_mqtt_event_handle_t event) {
     idf::mqtt::Client::on_error(event);
 
     if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-        this->connection_status = ConnectionStatus::FAILED;
-        this->connection_status.notify_all();
+        set_status(ConnectionStatus::FAILED);
     }
 };
 
+void MQTTClient::on_disconnected(const esp_mqtt_event_handle_t event) {
+    set_status(ConnectionStatus::FAILED);
+}
+
 void MQTTClient::on_connected(const esp_mqtt_event_handle_t event) {
-    this->connection_status = ConnectionStatus::CONNECTED;
-    this->connection_status.notify_all();
+    set_status(ConnectionStatus::CONNECTED);
 
+    // a persistent session still holds the subscriptions, unless handlers were added since it was set up
+    auto has_new_handlers = this->has_new_handlers.exchange(false);
+    if (event->session_present && !has_new_handlers) {
+        ESP_LOGI("MQTTClient", "Session resumed, skipping resubscription");
+        return;
+    }
+
+    // several handlers may share a filter, each one is subscribed only once
+    std::lock_guard lock(handlers_mutex);
+    std::unordered_set<std::string_view> subscribed_filters;
     for (const auto& handler : handlers) {
-        subscribe(const_cast<MQTTTopicHandler&>(handler).filter.get(), handler.qos);
+        const auto &filter = const_cast<MQTTTopicHandler&>(handler).filter.get();
+        if (!subscribed_filters.insert(filter).second) continue;
+        subscribe(filter, handler.qos);
     }
 }
 
 void MQTTClient::on_data(const esp_mqtt_event_handle_t event) {
-    static auto current_topic = std::make_pair(-1, std::string{});
-    if (current_topic.first != event->event_id || event->topic_len > 0) {
-        current_topic = std::make_pair(event->event_id, std::string(event->topic, event->topic_len));
+    // only the first chunk of a message carries its topic, the rest is dispatched to the same handlers
+    if (event->topic_len > 0) {
+        std::string_view topic(event->topic, event->topic_len);
+
+        std::lock_guard lock(handlers_mutex);
+        current_message.handler_count = 0;
+
+        auto add_handler = [this](const MQTTTopicHandler *handler) {
+            if (current_message.handler_count < MAX_MATCHING_HANDLERS) {
+                current_message.handlers[current_message.handler_count++] = handler;
+            }
+        };
+
+        auto [exact_begin, exact_end] = exact_handlers.equal_range(topic);
+        for (auto it = exact_begin; it != exact_end; ++it) {
+            add_handler(it->second);
+        }
+
+        for (const auto *handler : wildcard_handlers) {
+            if (match_filter(const_cast<MQTTTopicHandler *>(handler)->filter.get(), topic)) {
+                add_handler(handler);
+            }
+        }
     }
 
-    for (const auto& handler : handlers) {
-        if (handler.filter.match(current_topic.second.begin(), current_topic.second.end())) {
-            handler.callback(event);
+    for (size_t i = 0; i < current_message.handler_count; i++) {
+        current_message.handlers[i]->callback(event);
+    }
+}
+
+bool MQTTClient::match_filter(std::string_view filter, std::string_view topic) {
+    // topics starting with $ are reserved for the broker and never match wildcards at the first level
+    if (!topic.empty() && topic.front() == '$' && !filter.empty() && (filter.front() == '+' || filter.front() == '#')) {
+        return false;
+    }
+
+    for (;;) {
+        auto filter_level_end = filter.find('/');
+        auto topic_level_end = topic.find('/');
+        auto filter_level = filter.substr(0, filter_level_end);
+        auto topic_level = topic.substr(0, topic_level_end);
+
+        if (filter_level == "#") return true;
+        if (filter_level != "+" && filter_level != topic_level) return false;
+
+        auto is_last_filter_level = filter_level_end == std::string_view::npos;
+        auto is_last_topic_level = topic_level_end == std::string_view::npos;
+        if (is_last_filter_level || is_last_topic_level) {
+            // "a/#" also matches "a"
+            return is_last_filter_level == is_last_topic_level
+                || (is_last_topic_level && filter.substr(filter_level_end + 1) == "#");
         }
+
+        filter.remove_prefix(filter_level_end + 1);
+        topic.remove_prefix(topic_level_end + 1);
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <atomic>
 
@@ -26,14 +33,48 @@ public:
 
         esp_err_t register_handler(const MQTTTopicHandler& handler);
         esp_err_t set_uri(const std::string& uri);
+        esp_err_t start();
+        esp_err_t stop();
         esp_err_t reconnect();
-        esp_err_t wait_for_connection(int retries = 10);
+        esp_err_t disconnect();
+        esp_err_t defer_connection(int registrants);
+        esp_err_t release_connection();
+        [[nodiscard]] bool is_connection_released() const;
+        ConnectionStatus wait_for_connection(std::chrono::milliseconds timeout);
+        [[nodiscard]] ConnectionStatus get_status() const;
+        void set_status_callback(const std::function<void()>& callback);
+
+        static bool match_filter(std::string_view filter, std::string_view topic);
 private:
-        std::vector<MQTTTopicHandler> handlers;
+        static constexpr size_t MAX_MATCHING_HANDLERS = 4;
+
+        // handlers matching the message currently being received, reused for its continuation chunks
+        struct MessageDispatch {
+            size_t handler_count;
+            std::array<const MQTTTopicHandler *, MAX_MATCHING_HANDLERS> handlers;
+        };
+
+        // a deque keeps the handlers in place, so the lookup tables can point into it
+        std::deque<MQTTTopicHandler> handlers;
+        std::unordered_multimap<std::string_view, const MQTTTopicHandler *> exact_handlers;
+        std::vector<const MQTTTopicHandler *> wildcard_handlers;
+        std::mutex handlers_mutex;
+        MessageDispatch current_message;
+
+        // set whenever a handler is registered, handlers registered while disconnected are not in the broker session yet
+        std::atomic<bool> has_new_handlers;
+
         std::atomic<ConnectionStatus> connection_status;
+        std::mutex status_mutex;
+        std::condition_variable status_changed;
+        std::function<void()> status_callback;
+        // tasks still registering their handlers, the connection is started only once all of them are done
+        std::atomic<int> pending_registrants;
 
+        void set_status(ConnectionStatus status);
         void on_subscribed(const esp_mqtt_event_handle_t event) override;
         void on_connected(const esp_mqtt_event_handle_t event) override;
+        void on_disconnected(const esp_mqtt_event_handle_t event) override;
         void on_data(const esp_mqtt_event_handle_t event) override;
-        void on_error(const esp_mqtt_event_handle_t event);
-};
\ No newline at end of file
+        void on_error(const esp_mqtt_event_handle_t event) override;
+};
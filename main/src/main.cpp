@@ -4,12 +4,18 @@
 #include <freertos/task.h>
 #include <esp_log.h>
 #include <esp_mqtt_client_config.hpp>
+#include <esp_pthread.h>
 
 #include "config.h"
 #include "eink_mqtt.h"
+#include "wifi.h"
 #include "drivers/inkplate_waveform.h"
 #include "tasks/panel/panel_task.h"
+#include "tasks/system/boot_timings.h"
+#include "tasks/system/connection_manager.h"
 #include "tasks/system/system_task.h"
+#include "tasks/system/temperature_task.h"
+#include "tasks/system/waveform_selector.h"
 
 namespace mqtt = idf::mqtt;
 
@@ -17,46 +23,22 @@ static const char *TAG = "Main";
 
 extern "C" [[noreturn]] void app_main() {
     ESP_LOGI(TAG, "Main task has started");
+    static BootTimings boot_timings{};
     static Inkplate inkplate(DisplayMode::INKPLATE_3BIT);
     inkplate.begin();
     inkplate.initNVS();
+    boot_timings.mark(BootPhase::INKPLATE);
     ESP_LOGI(TAG, "Inkplate initialized");
 
     ESP_LOGI(TAG, "Loading config from NVS");
     static Config config{};
     ESP_ERROR_CHECK(config.load_from_nvs());
     ESP_ERROR_CHECK(config.commit());
+    boot_timings.mark(BootPhase::CONFIG);
     ESP_LOGI(TAG, "Config loaded from NVS");
 
-    ESP_LOGI(TAG, "Configuring display waveform");
-    if (config.panel.waveform != 0) {
-        ESP_LOGI(TAG, "Setting waveform to %d", config.panel.waveform);
-        inkplate.changeWaveform(INKPLATE_WAVEFORMS[config.panel.waveform - 1]);
-    }
-
-    ESP_LOGI(TAG, "Clearing display");
-    inkplate.clearDisplay();
-    inkplate.display();
-
-    ESP_LOGI(TAG, "Trying to connect to %s", config.wifi.ssid.c_str());
-    auto wifi_connected = inkplate.joinAP(config.wifi.ssid.c_str(), config.wifi.password.c_str());
-    if (!wifi_connected) {
-        ESP_LOGE(TAG, "Failed to connect to %s", config.wifi.ssid.c_str());
-        ESP_LOGW(TAG, "Using fallback network config");
-        inkplate.forceDisconnect();
-        wifi_connected = inkplate.joinAP(config.wifi_fallback.ssid.c_str(), config.wifi_fallback.password.c_str());
-
-        if (!wifi_connected) {
-            ESP_LOGE(TAG, "Failed to connect to fallback network");
-            ESP_LOGW(TAG, "Rebooting...");
-            esp_restart();
-        } else {
-            ESP_LOGI(TAG, "Connected to fallback SSID %s", config.wifi_fallback.ssid.c_str());
-            ESP_LOGI(TAG, "Rolling back to fallback network config for future connections");
-            config.rollback_wifi_config();
-        }
-    }
-    ESP_LOGI(TAG, "Connected to %s", config.wifi.ssid.c_str());
+    static WifiClient wifi{};
+    ESP_ERROR_CHECK(wifi.begin());
 
     ESP_LOGI(TAG, "Configuring MQTT client");
     mqtt::BrokerConfiguration mqtt_broker{
@@ -65,46 +47,93 @@ extern "C" [[noreturn]] void app_main() {
     };
     mqtt::ClientCredentials mqtt_client_credentials{};
     mqtt::Configuration mqtt_client_config{};
+    // a panel sleeping between updates gets the messages sent meanwhile once it connects again
+    mqtt_client_config.session.disable_clean_session = config.sleep.deep_sleep_interval != 0;
 
     static MQTTClient mqtt_client{
             mqtt_broker,
             mqtt_client_credentials,
             mqtt_client_config
     };
+    // the panel and system tasks have to register their handlers first and the connection manager has to bring up
+    // the network, see MQTTClient::defer_connection
+    ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt_client.defer_connection(3));
+    static ConnectionManager connection_manager(config, wifi, mqtt_client, boot_timings);
 
-    ESP_LOGI(TAG, "Connecting to MQTT broker");
-    auto mqtt_connection_status = mqtt_client.wait_for_connection(6);
-    if (mqtt_connection_status != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to connect to MQTT broker");
-        ESP_LOGW(TAG, "Using fallback MQTT broker config");
-        mqtt_client.set_uri(config.mqtt_fallback.broker_url);
-        mqtt_client.reconnect();
-        mqtt_connection_status = mqtt_client.wait_for_connection(6);
-
-        if (mqtt_connection_status != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to connect to fallback MQTT broker");
-            ESP_LOGW(TAG, "Rebooting...");
-            esp_restart();
+    // the radio gets going first, joining the network takes longer than anything else during boot
+    ESP_LOGI(TAG, "Trying to connect to %s", config.wifi.ssid.c_str());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(wifi.connect(config.wifi, config.wifi_cache, config.ip));
+
+    static FrameCache frame_cache{};
+    ESP_ERROR_CHECK_WITHOUT_ABORT(frame_cache.init());
+    static FrameDiff frame_diff(inkplate.einkWidth(), inkplate.einkHeight());
+    static FrameMetrics metrics{};
+    static FramePipeline frames(inkplate, metrics, frame_cache);
+    frames.set_refresh_policy_config(config.panel.refresh_policy);
+    static AssetStore assets{};
+    ESP_ERROR_CHECK_WITHOUT_ABORT(assets.init());
+
+    ESP_LOGI(TAG, "Configuring display waveform");
+    static WaveformLibrary waveforms{};
+    ESP_ERROR_CHECK_WITHOUT_ABORT(waveforms.load_from_nvs());
+    if (config.panel.waveform != 0) {
+        auto waveform = waveforms.get(config.panel.waveform);
+        if (waveform) {
+            ESP_LOGI(TAG, "Setting waveform to %d", config.panel.waveform);
+            frames.set_waveform(config.panel.waveform, *waveform);
         } else {
-            ESP_LOGI(TAG, "Connected to fallback MQTT broker");
-            ESP_LOGI(TAG, "Rolling back to fallback MQTT broker for future connections");
-            config.rollback_mqtt_config();
+            ESP_LOGW(TAG, "Waveform %d does not exist, keeping the default one", config.panel.waveform);
         }
     }
-    ESP_LOGI(TAG, "Connected to MQTT broker");
+
+    // the temperature bands take precedence, so the cached frame is already restored with the right waveform
+    static WaveformSelector waveform_selector([] { return frames.read_temperature(); });
+    waveform_selector.set_bands(config.panel.waveform_bands);
+    auto band_waveform_id = waveform_selector.update();
+    if (band_waveform_id) {
+        auto waveform = waveforms.get(*band_waveform_id);
+        if (waveform) {
+            ESP_LOGI(TAG, "Setting waveform to %d for %d °C", *band_waveform_id, waveform_selector.get_temperature().value_or(0));
+            frames.set_waveform(*band_waveform_id, *waveform);
+        } else {
+            ESP_LOGW(TAG, "Waveform %d of the temperature band does not exist", *band_waveform_id);
+        }
+    }
+
+    ESP_LOGI(TAG, "Restoring last frame");
+    auto restore_thread_config = esp_pthread_get_default_config();
+    restore_thread_config.thread_name = "frame_restore";
+    restore_thread_config.stack_size = 4096;
+    esp_pthread_set_cfg(&restore_thread_config);
+    std::thread restore_thread([] {
+        frames.restore();
+        boot_timings.mark(BootPhase::FRAME);
+    });
+    restore_thread.detach();
+    auto default_thread_config = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&default_thread_config);
 
     ESP_LOGI(TAG, "Starting panel and system tasks");
     TaskContext ctx{
             .inkplate = inkplate,
             .config = config,
-            .mqtt = mqtt_client
+            .mqtt = mqtt_client,
+            .frame_diff = frame_diff,
+            .frames = frames,
+            .metrics = metrics,
+            .assets = assets,
+            .waveforms = waveforms,
+            .waveform_selector = waveform_selector,
+            .boot_timings = boot_timings,
+            .connection = connection_manager
     };
     std::thread panel_task_thread(panel_task, std::ref(ctx));
     std::thread system_task_thread(system_task, std::ref(ctx));
+    std::thread temperature_task_thread(temperature_task, std::ref(ctx));
+    std::thread connection_thread(&ConnectionManager::run, &connection_manager);
     ESP_LOGI(TAG, "Panel and system tasks started");
 
     for (;;) {
-        constexpr TickType_t xDelay = 500 / portTICK_PERIOD_MS;
-        vTaskDelay(xDelay);
+        vTaskDelay(portMAX_DELAY);
     }
 }
@@ -0,0 +1,104 @@
+#include "packbits.h"
+
+#include <algorithm>
+
+size_t packbits_encode(const uint8_t *data, const size_t data_len, uint8_t *encoded) {
+    constexpr size_t max_run_length = 128;
+    auto *encoded_start = encoded;
+    size_t literal_start = 0;
+
+    auto flush_literals = [&](const size_t end) {
+        for (auto start = literal_start; start < end; start += max_run_length) {
+            auto literal_len = std::min(max_run_length, end - start);
+            *encoded++ = static_cast<uint8_t>(literal_len - 1);
+            encoded = std::copy_n(data + start, literal_len, encoded);
+        }
+    };
+
+    size_t i = 0;
+    while (i < data_len) {
+        auto run_end = i + 1;
+        while (run_end < data_len && run_end - i < max_run_length && data[run_end] == data[i]) {
+            run_end++;
+        }
+
+        if (run_end - i >= 3) {
+            flush_literals(i);
+            *encoded++ = static_cast<uint8_t>(257 - (run_end - i));
+            *encoded++ = data[i];
+            literal_start = run_end;
+        }
+
+        i = run_end;
+    }
+
+    flush_literals(data_len);
+    return encoded - encoded_start;
+}
+
+PackBitsDecoder::PackBitsDecoder():
+        state{State::CONTROL},
+        run_length{0},
+        decoded_size{0},
+        expected_size{0} {}
+
+void PackBitsDecoder::reset(const size_t expected_size) {
+    this->state = State::CONTROL;
+    this->run_length = 0;
+    this->decoded_size = 0;
+    this->expected_size = expected_size;
+}
+
+bool PackBitsDecoder::decode(const uint8_t *data, const size_t data_len, const Sink &sink) {
+    const auto *data_end = data + data_len;
+
+    while (data < data_end) {
+        switch (state) {
+            case State::CONTROL: {
+                auto control = *data++;
+                if (control < 128) {
+                    state = State::LITERAL;
+                    run_length = control + 1;
+                } else if (control > 128) {
+                    state = State::REPEAT;
+                    run_length = 257 - control;
+                }
+                break;
+            }
+            case State::LITERAL: {
+                // literals are passed on straight from the input
+                auto literal_len = std::min(run_length, static_cast<size_t>(data_end - data));
+                if (decoded_size + literal_len > expected_size) return false;
+
+                sink(decoded_size, data, literal_len);
+                decoded_size += literal_len;
+                data += literal_len;
+                run_length -= literal_len;
+
+                if (run_length == 0) state = State::CONTROL;
+                break;
+            }
+            case State::REPEAT: {
+                if (decoded_size + run_length > expected_size) return false;
+
+                uint8_t run[MAX_RUN_LENGTH];
+                std::fill_n(run, run_length, *data++);
+                sink(decoded_size, run, run_length);
+                decoded_size += run_length;
+
+                state = State::CONTROL;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool PackBitsDecoder::is_complete() const {
+    return state == State::CONTROL && decoded_size == expected_size;
+}
+
+size_t PackBitsDecoder::get_decoded_size() const {
+    return decoded_size;
+}
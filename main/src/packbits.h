@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/**
+ * Upper bound of the PackBits encoded size of data_len bytes, reached when the data holds no runs at all.
+ */
+constexpr size_t packbits_max_encoded_size(const size_t data_len) {
+    return data_len + (data_len + 127) / 128;
+}
+
+/**
+ * Encodes data with PackBits, runs of 3 or more equal bytes are repeated, the rest is stored as literals.
+ * @param data The data to encode
+ * @param data_len Length of the data in bytes
+ * @param encoded Output buffer of at least packbits_max_encoded_size(data_len) bytes
+ * @return Length of the encoded data in bytes
+ */
+size_t packbits_encode(const uint8_t *data, size_t data_len, uint8_t *encoded);
+
+/**
+ * Streaming decoder of PackBits run-length encoded data.
+ * A control byte n in 0..127 is followed by n + 1 literal bytes, n in 129..255 is followed by a single byte
+ * repeated 257 - n times and 128 is a no-op. The decoder keeps its state between calls, so the input can be
+ * split anywhere, and hands out the decoded bytes as runs without buffering the whole output.
+ */
+class PackBitsDecoder {
+public:
+    using Sink = std::function<void(size_t offset, const uint8_t *data, size_t data_len)>;
+
+    PackBitsDecoder();
+
+    void reset(size_t expected_size);
+    bool decode(const uint8_t *data, size_t data_len, const Sink &sink);
+
+    [[nodiscard]] bool is_complete() const;
+    [[nodiscard]] size_t get_decoded_size() const;
+private:
+    enum class State {
+        CONTROL,
+        LITERAL,
+        REPEAT,
+    };
+
+    static constexpr size_t MAX_RUN_LENGTH = 128;
+
+    State state;
+    size_t run_length;
+    size_t decoded_size;
+    size_t expected_size;
+};
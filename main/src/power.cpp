@@ -0,0 +1,53 @@
+#include "power.h"
+
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp32/pm.h>
+
+static constexpr auto *TAG = "power";
+
+static constexpr int MAX_CPU_FREQ_MHZ = 240;
+// Wi-Fi needs the APB clock at 80 MHz and keeps the CPU at least there while the radio is in use
+static constexpr int MIN_CPU_FREQ_MHZ = 80;
+
+/**
+ * Applies the power saving mode. When saving power, the CPU frequency is scaled down and the chip enters light
+ * sleep whenever all tasks are blocked, waking up with the Wi-Fi beacons at the cost of a slower response.
+ * Must be called after Wi-Fi has been started.
+ * @param config Sleep configuration of the panel
+ */
+esp_err_t configure_power_management(const SleepConfig &config) {
+    // ESP-IDF 5.0 only has the per chip config, the chip independent esp_pm_config_t arrived with 5.1
+    esp_pm_config_esp32_t pm_config{
+        .max_freq_mhz = MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = config.power_save ? MIN_CPU_FREQ_MHZ : MAX_CPU_FREQ_MHZ,
+        .light_sleep_enable = config.power_save
+    };
+
+    auto err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure power management: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = esp_wifi_set_ps(config.power_save ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Power saving %s", config.power_save ? "enabled" : "disabled");
+    return ESP_OK;
+}
+
+PerformanceLock::PerformanceLock(const char *name): handle{nullptr} {
+    auto err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, name, &handle);
+    if (err != ESP_OK && err != ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGE(TAG, "Failed to create performance lock %s: %s", name, esp_err_to_name(err));
+    }
+}
+
+void PerformanceLock::lock() {
+    if (handle != nullptr) esp_pm_lock_acquire(handle);
+}
+
+void PerformanceLock::unlock() {
+    if (handle != nullptr) esp_pm_lock_release(handle);
+}
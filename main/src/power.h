@@ -0,0 +1,24 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_pm.h>
+
+#include "config.h"
+
+esp_err_t configure_power_management(const SleepConfig &config);
+
+/**
+ * Keeps the CPU at its maximum frequency while held, meets the BasicLockable requirements.
+ * Without power management enabled in the build it does nothing.
+ */
+class PerformanceLock {
+public:
+    explicit PerformanceLock(const char *name);
+    PerformanceLock(PerformanceLock const&) = delete;
+    void operator=(PerformanceLock const&) = delete;
+
+    void lock();
+    void unlock();
+private:
+    esp_pm_lock_handle_t handle;
+};
@@ -5,9 +5,25 @@
 
 #include "../config.h"
 #include "eink_mqtt.h"
+#include "drivers/inkplate_frame_diff.h"
+#include "drivers/inkplate_waveform.h"
+#include "tasks/panel/asset_store.h"
+#include "tasks/panel/frame_metrics.h"
+#include "tasks/panel/frame_pipeline.h"
+#include "tasks/system/boot_timings.h"
+#include "tasks/system/connection_manager.h"
+#include "tasks/system/waveform_selector.h"
 
 struct TaskContext {
     Inkplate &inkplate;
     Config &config;
     MQTTClient &mqtt;
+    FrameDiff &frame_diff;
+    FramePipeline &frames;
+    FrameMetrics &metrics;
+    AssetStore &assets;
+    WaveformLibrary &waveforms;
+    WaveformSelector &waveform_selector;
+    BootTimings &boot_timings;
+    ConnectionManager &connection;
 };
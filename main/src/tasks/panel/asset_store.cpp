@@ -0,0 +1,272 @@
+#include "asset_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+static constexpr auto *TAG = "asset_store";
+
+static size_t align_to_sector(const size_t offset, const size_t sector_size) {
+    return (offset + sector_size - 1) / sector_size * sector_size;
+}
+
+uint32_t AssetStore::Directory::compute_crc() const {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(this), offsetof(Directory, crc));
+}
+
+AssetStore::AssetStore():
+        partition{nullptr},
+        mapped_data{nullptr},
+        mmap_handle{},
+        directory{},
+        directory_sector{DIRECTORY_SECTORS - 1},
+        use_counter{0},
+        upload{},
+        upload_written{0},
+        upload_erased_end{0} {}
+
+esp_err_t AssetStore::init() {
+    std::lock_guard lock(mutex);
+
+    auto *found_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "assets");
+    if (found_partition == nullptr) {
+        ESP_LOGW(TAG, "Asset partition not found");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // flash writes flush the cache of the mapped range, so the mapping stays valid across uploads
+    const void *data = nullptr;
+    auto err = esp_partition_mmap(found_partition, 0, found_partition->size, ESP_PARTITION_MMAP_DATA, &data, &mmap_handle);
+    if (err != ESP_OK) return err;
+    partition = found_partition;
+    mapped_data = static_cast<const uint8_t *>(data);
+
+    const Directory *newest_directory = nullptr;
+    for (size_t sector = 0; sector < DIRECTORY_SECTORS; sector++) {
+        auto *candidate = reinterpret_cast<const Directory *>(mapped_data + sector * SECTOR_SIZE);
+        if (candidate->magic != DIRECTORY_MAGIC || candidate->count > MAX_ASSETS || candidate->crc != candidate->compute_crc()) continue;
+        if (newest_directory == nullptr || candidate->sequence > newest_directory->sequence) {
+            newest_directory = candidate;
+            directory_sector = sector;
+        }
+    }
+    if (newest_directory == nullptr) return ESP_OK;
+
+    std::memcpy(&directory, newest_directory, sizeof(directory));
+    for (size_t i = 0; i < directory.count; i++) {
+        const auto &entry = directory.entries[i];
+        use_counter = std::max(use_counter, entry.last_used + 1);
+    }
+
+    ESP_LOGI(TAG, "Found %d assets in %d bytes", static_cast<int>(directory.count), static_cast<int>(compute_used_size()));
+    return ESP_OK;
+}
+
+AssetStore::Entry *AssetStore::find(const uint16_t id) {
+    auto *entries_end = directory.entries + directory.count;
+    auto *entry = std::find_if(directory.entries, entries_end, [id](const Entry &entry) { return entry.id == id; });
+    return entry == entries_end ? nullptr : entry;
+}
+
+void AssetStore::remove(const Entry *entry) {
+    // the order of the entries does not matter, so the last one takes the free spot
+    directory.entries[entry - directory.entries] = directory.entries[--directory.count];
+}
+
+std::optional<Asset> AssetStore::get(const uint16_t id) {
+    std::lock_guard lock(mutex);
+    auto *entry = find(id);
+    if (entry == nullptr) return std::nullopt;
+
+    entry->last_used = use_counter++;
+    return Asset{
+        .width = entry->width,
+        .height = entry->height,
+        .depth = entry->depth,
+        .data = mapped_data + entry->offset
+    };
+}
+
+std::vector<AssetInfo> AssetStore::list() const {
+    std::lock_guard lock(mutex);
+    std::vector<AssetInfo> assets;
+    for (size_t i = 0; i < directory.count; i++) {
+        const auto &entry = directory.entries[i];
+        assets.push_back({
+            .id = entry.id,
+            .width = entry.width,
+            .height = entry.height,
+            .depth = entry.depth,
+            .size = entry.size,
+            .hash = entry.hash
+        });
+    }
+    return assets;
+}
+
+size_t AssetStore::get_budget() const {
+    if (partition == nullptr) return 0;
+    return partition->size - DATA_OFFSET;
+}
+
+size_t AssetStore::get_used_size() const {
+    std::lock_guard lock(mutex);
+    return compute_used_size();
+}
+
+size_t AssetStore::compute_used_size() const {
+    size_t used_size = 0;
+    for (size_t i = 0; i < directory.count; i++) {
+        used_size += align_to_sector(directory.entries[i].size, SECTOR_SIZE);
+    }
+    return used_size;
+}
+
+size_t AssetStore::get_asset_size(const uint16_t width, const uint16_t height, const uint8_t depth) {
+    auto pixels_per_byte = 8 / depth;
+    return static_cast<size_t>((width + pixels_per_byte - 1) / pixels_per_byte) * height;
+}
+
+std::optional<size_t> AssetStore::find_free_space(const size_t size) const {
+    std::vector<std::pair<size_t, size_t>> extents;
+    for (size_t i = 0; i < directory.count; i++) {
+        const auto &entry = directory.entries[i];
+        extents.emplace_back(entry.offset, entry.offset + align_to_sector(entry.size, SECTOR_SIZE));
+    }
+    std::sort(extents.begin(), extents.end());
+
+    // first fit, assets come and go rarely enough for the fragmentation not to matter
+    size_t gap_start = DATA_OFFSET;
+    for (const auto &[start, end] : extents) {
+        if (start >= gap_start + size) return gap_start;
+        gap_start = std::max(gap_start, end);
+    }
+    if (gap_start + size <= partition->size) return gap_start;
+    return std::nullopt;
+}
+
+esp_err_t AssetStore::write_directory() {
+    directory.magic = DIRECTORY_MAGIC;
+    directory.sequence++;
+    directory.crc = directory.compute_crc();
+
+    auto next_sector = (directory_sector + 1) % DIRECTORY_SECTORS;
+    auto err = esp_partition_erase_range(partition, next_sector * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK) return err;
+    err = esp_partition_write(partition, next_sector * SECTOR_SIZE, &directory, sizeof(directory));
+    if (err != ESP_OK) return err;
+
+    directory_sector = next_sector;
+    return ESP_OK;
+}
+
+esp_err_t AssetStore::erase(const uint16_t id) {
+    std::lock_guard lock(mutex);
+    auto *entry = find(id);
+    if (entry == nullptr) return ESP_ERR_NOT_FOUND;
+
+    // the data stays in place until another asset takes its space
+    remove(entry);
+    return write_directory();
+}
+
+esp_err_t AssetStore::begin_upload(const uint16_t id, const uint16_t width, const uint16_t height, const uint8_t depth) {
+    std::lock_guard lock(mutex);
+    upload.reset();
+    if (partition == nullptr) return ESP_ERR_NOT_FOUND;
+
+    auto size = get_asset_size(width, height, depth);
+    if (size == 0 || size > get_budget()) return ESP_ERR_INVALID_SIZE;
+
+    auto evict_least_recently_used = [&] {
+        auto *entry = std::min_element(directory.entries, directory.entries + directory.count, [](const Entry &a, const Entry &b) {
+            return a.last_used < b.last_used;
+        });
+        ESP_LOGI(TAG, "Evicting asset %d", entry->id);
+        remove(entry);
+    };
+
+    // the replaced asset is kept until the upload is finished, unless it has to make room for it
+    auto is_evicted = false;
+    while (directory.count >= MAX_ASSETS && find(id) == nullptr) {
+        evict_least_recently_used();
+        is_evicted = true;
+    }
+    auto offset = find_free_space(size);
+    while (!offset) {
+        evict_least_recently_used();
+        is_evicted = true;
+        offset = find_free_space(size);
+    }
+
+    // the evicted assets must be gone from the directory before their data gets overwritten
+    if (is_evicted) {
+        auto err = write_directory();
+        if (err != ESP_OK) return err;
+    }
+
+    upload = Entry{
+        .id = id,
+        .depth = depth,
+        .reserved = 0,
+        .width = width,
+        .height = height,
+        .offset = static_cast<uint32_t>(*offset),
+        .size = static_cast<uint32_t>(size),
+        .hash = 0,
+        .last_used = 0
+    };
+    upload_written = 0;
+    upload_erased_end = *offset;
+    return ESP_OK;
+}
+
+esp_err_t AssetStore::write_upload(const uint8_t *data, const size_t data_len) {
+    std::lock_guard lock(mutex);
+    if (!upload) return ESP_ERR_INVALID_STATE;
+    if (upload_written + data_len > upload->size) {
+        upload.reset();
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    auto write_offset = upload->offset + upload_written;
+    while (upload_erased_end < write_offset + data_len) {
+        auto err = esp_partition_erase_range(partition, upload_erased_end, SECTOR_SIZE);
+        if (err != ESP_OK) {
+            upload.reset();
+            return err;
+        }
+        upload_erased_end += SECTOR_SIZE;
+    }
+
+    auto err = esp_partition_write(partition, write_offset, data, data_len);
+    if (err != ESP_OK) {
+        upload.reset();
+        return err;
+    }
+
+    upload->hash = esp_rom_crc32_le(upload->hash, data, data_len);
+    upload_written += data_len;
+    return ESP_OK;
+}
+
+esp_err_t AssetStore::finish_upload() {
+    std::lock_guard lock(mutex);
+    if (!upload) return ESP_ERR_INVALID_STATE;
+
+    auto entry = *upload;
+    upload.reset();
+    if (upload_written != entry.size) return ESP_ERR_INVALID_SIZE;
+
+    auto *replaced_entry = find(entry.id);
+    if (replaced_entry != nullptr) remove(replaced_entry);
+    if (directory.count >= MAX_ASSETS) return ESP_ERR_NO_MEM;
+
+    entry.last_used = use_counter++;
+    directory.entries[directory.count++] = entry;
+
+    ESP_LOGI(TAG, "Stored %dx%d %dbpp asset %d", entry.width, entry.height, entry.depth, entry.id);
+    return write_directory();
+}
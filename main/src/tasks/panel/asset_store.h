@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+struct AssetInfo {
+    uint16_t id;
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+    size_t size;
+    uint32_t hash;
+};
+
+/**
+ * Pixels of a stored asset in the raw 1bpp or 4bpp wire format, rows padded to whole bytes.
+ * The data points straight into the memory mapped flash, so it must not be written to.
+ */
+struct Asset {
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+    const uint8_t *data;
+};
+
+/**
+ * Keeps images reused across frames, like backgrounds and icons, in the "assets" flash partition.
+ * The partition starts with two directory sectors written alternately, so an interrupted write leaves the previous
+ * directory intact, followed by the asset data, each asset starting on a sector boundary. The whole partition is
+ * memory mapped, so assets are drawn straight from flash. When an upload does not fit, the least recently used
+ * assets are evicted. Their use is only tracked in RAM and persisted along with the next directory write.
+ * Uploads and draws come from the MQTT task while the panel task also lists the assets, so the directory is guarded
+ * by a mutex. The data of an asset stays valid until an upload replaces or evicts it, which happens on the MQTT task.
+ */
+class AssetStore {
+public:
+    static constexpr size_t MAX_ASSETS = 64;
+
+    AssetStore();
+    AssetStore(AssetStore const&) = delete;
+    void operator=(AssetStore const&) = delete;
+
+    esp_err_t init();
+    std::optional<Asset> get(uint16_t id);
+    [[nodiscard]] std::vector<AssetInfo> list() const;
+    [[nodiscard]] size_t get_budget() const;
+    [[nodiscard]] size_t get_used_size() const;
+    esp_err_t erase(uint16_t id);
+
+    // an upload replaces the asset of the same id once it is finished, chunks have to be written in order
+    esp_err_t begin_upload(uint16_t id, uint16_t width, uint16_t height, uint8_t depth);
+    esp_err_t write_upload(const uint8_t *data, size_t data_len);
+    esp_err_t finish_upload();
+
+    static size_t get_asset_size(uint16_t width, uint16_t height, uint8_t depth);
+private:
+    static constexpr uint32_t DIRECTORY_MAGIC = 0x41425356; // "VSBA"
+    static constexpr size_t SECTOR_SIZE = 4096;
+    static constexpr size_t DIRECTORY_SECTORS = 2;
+    static constexpr size_t DATA_OFFSET = DIRECTORY_SECTORS * SECTOR_SIZE;
+
+    struct Entry {
+        uint16_t id;
+        uint8_t depth;
+        uint8_t reserved;
+        uint16_t width;
+        uint16_t height;
+        uint32_t offset;
+        uint32_t size;
+        uint32_t hash;
+        uint32_t last_used;
+    };
+    static_assert(sizeof(Entry) == 24);
+
+    struct Directory {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t count;
+        Entry entries[MAX_ASSETS];
+        uint32_t crc;
+
+        [[nodiscard]] uint32_t compute_crc() const;
+    };
+    static_assert(sizeof(Directory) <= SECTOR_SIZE);
+
+    Entry *find(uint16_t id);
+    [[nodiscard]] size_t compute_used_size() const;
+    void remove(const Entry *entry);
+    std::optional<size_t> find_free_space(size_t size) const;
+    esp_err_t write_directory();
+
+    mutable std::mutex mutex;
+
+    // only set by init, before the tasks start
+    const esp_partition_t *partition;
+    const uint8_t *mapped_data;
+    esp_partition_mmap_handle_t mmap_handle;
+
+    Directory directory;
+    size_t directory_sector;
+    uint32_t use_counter;
+
+    std::optional<Entry> upload;
+    size_t upload_written;
+    size_t upload_erased_end;
+};
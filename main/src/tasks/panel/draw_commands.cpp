@@ -0,0 +1,175 @@
+#include "draw_commands.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include <esp_log.h>
+
+static constexpr auto *TAG = "draw_commands";
+
+// fonts by their id, the built-in 6x8 one of Adafruit_GFX goes first
+static const GFXfont *const FONTS[] = {
+    nullptr,
+};
+
+static constexpr uint8_t MAX_TEXT_SIZE = 8;
+
+DrawCommandDecoder::DrawCommandDecoder(AssetStore &assets):
+        assets{assets},
+        state{State::OPCODE},
+        op{DrawOp::FILL_RECT},
+        arguments{},
+        arguments_len{0},
+        sprite_x{0},
+        sprite_y{0},
+        sprite_width{0},
+        sprite_color{0},
+        sprite_background{TRANSPARENT},
+        sprite_offset{0},
+        sprite_size{0},
+        command_count{0} {}
+
+void DrawCommandDecoder::reset() {
+    state = State::OPCODE;
+    arguments_len = 0;
+    command_count = 0;
+}
+
+int16_t DrawCommandDecoder::get_int16(const size_t index) const {
+    return static_cast<int16_t>(get_uint16(index));
+}
+
+uint16_t DrawCommandDecoder::get_uint16(const size_t index) const {
+    return static_cast<uint16_t>(arguments[index] | arguments[index + 1] << 8);
+}
+
+size_t DrawCommandDecoder::get_arguments_size() const {
+    switch (op) {
+        case DrawOp::FILL_RECT: return 9;
+        case DrawOp::DRAW_LINE: return 9;
+        case DrawOp::DRAW_TEXT:
+            // the length of the text is the last fixed argument
+            if (arguments_len < TEXT_ARGUMENTS_SIZE) return TEXT_ARGUMENTS_SIZE;
+            return TEXT_ARGUMENTS_SIZE + arguments[TEXT_ARGUMENTS_SIZE - 1];
+        case DrawOp::DRAW_SPRITE: return 10;
+        case DrawOp::INVERT_RECT: return 8;
+        case DrawOp::DRAW_ASSET: return 6;
+        default: return 0;
+    }
+}
+
+bool DrawCommandDecoder::decode(const uint8_t *data, const size_t data_len, InkplateCanvas &canvas) {
+    const auto *data_end = data + data_len;
+
+    while (data < data_end) {
+        switch (state) {
+            case State::OPCODE: {
+                op = static_cast<DrawOp>(*data++);
+                if (get_arguments_size() == 0) {
+                    ESP_LOGE(TAG, "Unknown draw command %d", static_cast<int>(op));
+                    return false;
+                }
+                arguments_len = 0;
+                state = State::ARGUMENTS;
+                break;
+            }
+            case State::ARGUMENTS: {
+                auto part_len = std::min(get_arguments_size() - arguments_len, static_cast<size_t>(data_end - data));
+                std::copy_n(data, part_len, arguments + arguments_len);
+                arguments_len += part_len;
+                data += part_len;
+
+                // a text with no characters is complete as soon as its fixed arguments are
+                if (arguments_len == get_arguments_size()) {
+                    if (!execute(canvas)) return false;
+                    command_count++;
+                }
+                break;
+            }
+            case State::SPRITE: {
+                draw_sprite_byte(*data++, canvas);
+                if (++sprite_offset == sprite_size) state = State::OPCODE;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool DrawCommandDecoder::execute(InkplateCanvas &canvas) {
+    state = State::OPCODE;
+
+    switch (op) {
+        case DrawOp::FILL_RECT:
+            canvas.fill_rect(get_int16(0), get_int16(2), get_uint16(4), get_uint16(6), arguments[8]);
+            return true;
+        case DrawOp::DRAW_LINE:
+            canvas.drawLine(get_int16(0), get_int16(2), get_int16(4), get_int16(6), arguments[8]);
+            return true;
+        case DrawOp::DRAW_TEXT: {
+            auto font_id = arguments[4];
+            auto size = arguments[5];
+            if (font_id >= std::size(FONTS) || size == 0 || size > MAX_TEXT_SIZE) {
+                ESP_LOGE(TAG, "Invalid font %d of size %d", font_id, size);
+                return false;
+            }
+
+            // the classic font is placed by its top left corner, the others by the baseline of the text
+            arguments[arguments_len] = '\0';
+            canvas.setFont(FONTS[font_id]);
+            canvas.setTextSize(size);
+            canvas.setTextColor(arguments[6]);
+            canvas.setTextWrap(false);
+            canvas.setCursor(get_int16(0), get_int16(2));
+            canvas.print(reinterpret_cast<const char *>(arguments + TEXT_ARGUMENTS_SIZE));
+            return true;
+        }
+        case DrawOp::DRAW_SPRITE:
+            sprite_x = get_int16(0);
+            sprite_y = get_int16(2);
+            sprite_width = get_uint16(4);
+            sprite_color = arguments[8];
+            sprite_background = arguments[9];
+            sprite_offset = 0;
+            sprite_size = static_cast<size_t>((sprite_width + 7) / 8) * get_uint16(6);
+            if (sprite_size > 0) state = State::SPRITE;
+            return true;
+        case DrawOp::INVERT_RECT:
+            canvas.invert_rect(get_int16(0), get_int16(2), get_uint16(4), get_uint16(6));
+            return true;
+        case DrawOp::DRAW_ASSET: {
+            auto asset_id = get_uint16(4);
+            auto asset = assets.get(asset_id);
+            if (!asset || asset->depth != canvas.get_depth()) {
+                ESP_LOGE(TAG, "Asset %d does not exist or has a different depth", asset_id);
+                return false;
+            }
+
+            canvas.draw_image(get_int16(0), get_int16(2), asset->width, asset->height, asset->data);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void DrawCommandDecoder::draw_sprite_byte(const uint8_t byte, InkplateCanvas &canvas) {
+    auto row_stride = (sprite_width + 7) / 8;
+    auto row = static_cast<int>(sprite_offset / row_stride);
+    auto column = static_cast<int>(sprite_offset % row_stride) * 8;
+
+    for (int bit = 0; bit < 8 && column + bit < sprite_width; bit++) {
+        auto is_set = (byte & (0x80 >> bit)) != 0;
+        if (!is_set && sprite_background == TRANSPARENT) continue;
+        canvas.drawPixel(static_cast<int16_t>(sprite_x + column + bit), static_cast<int16_t>(sprite_y + row), is_set ? sprite_color : sprite_background);
+    }
+}
+
+bool DrawCommandDecoder::is_complete() const {
+    return state == State::OPCODE;
+}
+
+size_t DrawCommandDecoder::get_command_count() const {
+    return command_count;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "drivers/inkplate_canvas.h"
+#include "asset_store.h"
+
+enum class DrawOp : uint8_t {
+    // x (int16), y (int16), width (uint16), height (uint16), color (uint8)
+    FILL_RECT = 1,
+    // x0 (int16), y0 (int16), x1 (int16), y1 (int16), color (uint8)
+    DRAW_LINE = 2,
+    // x (int16), y (int16), font (uint8), size (uint8), color (uint8), length (uint8), followed by the text
+    DRAW_TEXT = 3,
+    // x (int16), y (int16), width (uint16), height (uint16), color (uint8), background (uint8),
+    // followed by the 1bpp sprite with rows padded to whole bytes and the leftmost pixel in the MSB
+    DRAW_SPRITE = 4,
+    // x (int16), y (int16), width (uint16), height (uint16)
+    INVERT_RECT = 5,
+    // x (int16), y (int16), asset id (uint16)
+    DRAW_ASSET = 6,
+};
+
+/**
+ * Streaming interpreter of a display list, a sequence of draw commands each made of an opcode and little-endian
+ * arguments. Commands are executed on the canvas as soon as their arguments are complete, sprite pixels are
+ * drawn as their bytes arrive, so neither the list nor a sprite is ever buffered as a whole and the input can
+ * be split anywhere.
+ */
+class DrawCommandDecoder {
+public:
+    // background color of a sprite which leaves its unset pixels untouched
+    static constexpr uint8_t TRANSPARENT = 0xff;
+
+    explicit DrawCommandDecoder(AssetStore &assets);
+
+    void reset();
+    bool decode(const uint8_t *data, size_t data_len, InkplateCanvas &canvas);
+
+    [[nodiscard]] bool is_complete() const;
+    [[nodiscard]] size_t get_command_count() const;
+private:
+    enum class State {
+        OPCODE,
+        ARGUMENTS,
+        SPRITE,
+    };
+
+    static constexpr size_t MAX_TEXT_LENGTH = 255;
+    static constexpr size_t TEXT_ARGUMENTS_SIZE = 8;
+    static constexpr size_t MAX_ARGUMENTS_SIZE = TEXT_ARGUMENTS_SIZE + MAX_TEXT_LENGTH;
+
+    [[nodiscard]] int16_t get_int16(size_t index) const;
+    [[nodiscard]] uint16_t get_uint16(size_t index) const;
+    [[nodiscard]] size_t get_arguments_size() const;
+    bool execute(InkplateCanvas &canvas);
+    void draw_sprite_byte(uint8_t byte, InkplateCanvas &canvas);
+
+    AssetStore &assets;
+
+    State state;
+    DrawOp op;
+    uint8_t arguments[MAX_ARGUMENTS_SIZE + 1];
+    size_t arguments_len;
+
+    // sprite being streamed in
+    int16_t sprite_x;
+    int16_t sprite_y;
+    uint16_t sprite_width;
+    uint8_t sprite_color;
+    uint8_t sprite_background;
+    size_t sprite_offset;
+    size_t sprite_size;
+
+    size_t command_count;
+};
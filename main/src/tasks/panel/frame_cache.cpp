@@ -0,0 +1,157 @@
+#include "frame_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include "drivers/inkplate_framebuffer.h"
+
+static constexpr auto *TAG = "frame_cache";
+
+static size_t align_to_sector(const size_t offset, const size_t sector_size) {
+    return (offset + sector_size - 1) / sector_size * sector_size;
+}
+
+uint32_t FrameCache::RecordHeader::compute_crc() const {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(this), offsetof(RecordHeader, header_crc));
+}
+
+FrameCache::FrameCache():
+        partition{nullptr},
+        newest_record{},
+        newest_record_offset{0},
+        write_offset{0},
+        next_sequence{0},
+        chunk_buffer{} {}
+
+esp_err_t FrameCache::init() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "frames");
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "Frame cache partition not found");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // every record starts on a sector boundary, so only the sector starts need to be checked
+    for (size_t offset = 0; offset + sizeof(RecordHeader) <= partition->size; offset += SECTOR_SIZE) {
+        RecordHeader header{};
+        if (esp_partition_read(partition, offset, &header, sizeof(header)) != ESP_OK) continue;
+        if (header.magic != RECORD_MAGIC || header.header_crc != header.compute_crc()) continue;
+        if (offset + sizeof(RecordHeader) + header.data_size > partition->size) continue;
+
+        next_sequence = std::max(next_sequence, header.sequence + 1);
+        if (!newest_record || header.sequence > newest_record->sequence) {
+            newest_record = header;
+            newest_record_offset = offset;
+        }
+    }
+
+    if (newest_record) {
+        write_offset = align_to_sector(newest_record_offset + sizeof(RecordHeader) + newest_record->data_size, SECTOR_SIZE);
+        ESP_LOGI(TAG, "Found cached %dbpp frame %08lx", newest_record->depth, static_cast<unsigned long>(newest_record->hash));
+    }
+
+    return ESP_OK;
+}
+
+std::optional<CachedFrame> FrameCache::get_cached_frame() const {
+    if (!newest_record) return std::nullopt;
+    return CachedFrame{
+        .depth = newest_record->depth,
+        .hash = newest_record->hash
+    };
+}
+
+bool FrameCache::load(uint8_t *frame_buffer, const size_t frame_size) {
+    if (!newest_record || newest_record->frame_size != frame_size) return false;
+
+    PackBitsDecoder decoder;
+    decoder.reset(frame_size);
+
+    auto data_offset = newest_record_offset + sizeof(RecordHeader);
+    for (size_t offset = 0; offset < newest_record->data_size; offset += CHUNK_SIZE) {
+        auto chunk_len = std::min(CHUNK_SIZE, newest_record->data_size - offset);
+        if (esp_partition_read(partition, data_offset + offset, chunk_buffer, chunk_len) != ESP_OK) return false;
+
+        auto is_decoded = decoder.decode(chunk_buffer, chunk_len, [&](const size_t offset, const uint8_t *data, const size_t data_len) {
+            std::memcpy(frame_buffer + offset, data, data_len);
+        });
+        if (!is_decoded) return false;
+    }
+
+    if (!decoder.is_complete() || hash_frame(frame_buffer, frame_size, newest_record->depth) != newest_record->hash) {
+        ESP_LOGE(TAG, "Cached frame is corrupted");
+        newest_record.reset();
+        return false;
+    }
+
+    return true;
+}
+
+esp_err_t FrameCache::erase_until(size_t &erased_end, const size_t end) {
+    while (erased_end < end) {
+        auto err = esp_partition_erase_range(partition, erased_end, SECTOR_SIZE);
+        if (err != ESP_OK) return err;
+
+        // the newest record is no longer intact once any part of it is gone
+        if (newest_record && erased_end < newest_record_offset + sizeof(RecordHeader) + newest_record->data_size
+            && erased_end + SECTOR_SIZE > newest_record_offset) {
+            newest_record.reset();
+        }
+        erased_end += SECTOR_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t FrameCache::store(const uint8_t *frame_buffer, const size_t frame_size, const int depth, const uint32_t hash, const AbortCheck &should_abort) {
+    if (partition == nullptr) return ESP_ERR_NOT_FOUND;
+    if (newest_record && newest_record->hash == hash && newest_record->depth == depth) return ESP_OK;
+
+    auto record_offset = write_offset;
+    if (record_offset + sizeof(RecordHeader) + packbits_max_encoded_size(frame_size) > partition->size) {
+        record_offset = 0;
+    }
+
+    // the header goes in last, so an interrupted write never leaves a valid looking record behind
+    auto erased_end = record_offset;
+    auto data_offset = record_offset + sizeof(RecordHeader);
+    auto err = erase_until(erased_end, data_offset);
+    if (err != ESP_OK) return err;
+
+    for (size_t offset = 0; offset < frame_size; offset += CHUNK_SIZE) {
+        if (should_abort()) return ESP_ERR_INVALID_STATE;
+
+        // every chunk is compressed on its own, their concatenation is still a valid PackBits stream
+        auto chunk_len = std::min(CHUNK_SIZE, frame_size - offset);
+        auto encoded_len = packbits_encode(frame_buffer + offset, chunk_len, chunk_buffer);
+
+        err = erase_until(erased_end, data_offset + encoded_len);
+        if (err != ESP_OK) return err;
+        err = esp_partition_write(partition, data_offset, chunk_buffer, encoded_len);
+        if (err != ESP_OK) return err;
+        data_offset += encoded_len;
+    }
+
+    RecordHeader header{
+        .magic = RECORD_MAGIC,
+        .sequence = next_sequence++,
+        .depth = static_cast<uint8_t>(depth),
+        .reserved = {},
+        .frame_size = static_cast<uint32_t>(frame_size),
+        .data_size = static_cast<uint32_t>(data_offset - record_offset - sizeof(RecordHeader)),
+        .hash = hash,
+        .reserved_2 = 0,
+        .header_crc = 0
+    };
+    header.header_crc = header.compute_crc();
+
+    err = esp_partition_write(partition, record_offset, &header, sizeof(header));
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Cached %dbpp frame %08lx in %d bytes", depth, static_cast<unsigned long>(hash), static_cast<int>(header.data_size));
+    newest_record = header;
+    newest_record_offset = record_offset;
+    write_offset = align_to_sector(data_offset, SECTOR_SIZE);
+    return ESP_OK;
+}
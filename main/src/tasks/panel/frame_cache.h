@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#include "packbits.h"
+
+struct CachedFrame {
+    int depth;
+    uint32_t hash;
+};
+
+/**
+ * Keeps the last displayed frame in the "frames" flash partition, so it can be restored after a reboot.
+ * Frames are stored PackBits compressed as records appended one after another, each starting on a sector
+ * boundary, and the partition is reused from its start once the end is reached. This spreads the erase cycles
+ * over the whole partition instead of wearing out the same sectors with every write. On boot the record with
+ * the highest sequence number wins.
+ */
+class FrameCache {
+public:
+    using AbortCheck = std::function<bool()>;
+
+    FrameCache();
+    FrameCache(FrameCache const&) = delete;
+    void operator=(FrameCache const&) = delete;
+
+    esp_err_t init();
+    [[nodiscard]] std::optional<CachedFrame> get_cached_frame() const;
+    bool load(uint8_t *frame_buffer, size_t frame_size);
+    esp_err_t store(const uint8_t *frame_buffer, size_t frame_size, int depth, uint32_t hash, const AbortCheck &should_abort);
+private:
+    static constexpr uint32_t RECORD_MAGIC = 0x46425356; // "VSBF"
+    static constexpr size_t SECTOR_SIZE = 4096;
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t sequence;
+        uint8_t depth;
+        uint8_t reserved[3];
+        uint32_t frame_size;
+        uint32_t data_size;
+        uint32_t hash;
+        uint32_t reserved_2;
+        uint32_t header_crc;
+
+        [[nodiscard]] uint32_t compute_crc() const;
+    };
+    static_assert(sizeof(RecordHeader) == 32);
+
+    esp_err_t erase_until(size_t &erased_end, size_t end);
+
+    const esp_partition_t *partition;
+    std::optional<RecordHeader> newest_record;
+    size_t newest_record_offset;
+    size_t write_offset;
+    uint32_t next_sequence;
+    uint8_t chunk_buffer[packbits_max_encoded_size(CHUNK_SIZE)];
+};
@@ -0,0 +1,99 @@
+#include "frame_metrics.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+FrameMetrics::FrameMetrics():
+        windows{},
+        committed_frames{0},
+        displayed_frames{0},
+        refreshes{},
+        last_refresh{RefreshDecision::FULL} {}
+
+void FrameMetrics::record(const FrameStage stage, const int64_t duration_us) {
+    std::lock_guard lock(mutex);
+
+    auto &window = windows[to_underlying(stage)];
+    window.samples[window.next] = static_cast<uint32_t>(std::clamp<int64_t>(duration_us, 0, UINT32_MAX));
+    window.next = (window.next + 1) % WINDOW_SIZE;
+    window.count = std::min(window.count + 1, WINDOW_SIZE);
+}
+
+void FrameMetrics::count_committed_frame() {
+    std::lock_guard lock(mutex);
+    committed_frames++;
+}
+
+void FrameMetrics::count_displayed_frame() {
+    std::lock_guard lock(mutex);
+    displayed_frames++;
+}
+
+void FrameMetrics::count_refresh(const RefreshDecision decision) {
+    std::lock_guard lock(mutex);
+    refreshes[to_underlying(decision)]++;
+    last_refresh = decision;
+}
+
+FrameStageSummary FrameMetrics::summarize(const FrameStage stage) {
+    std::array<uint32_t, WINDOW_SIZE> samples{};
+    size_t count;
+    {
+        std::lock_guard lock(mutex);
+        auto &window = windows[to_underlying(stage)];
+        count = window.count;
+        std::copy_n(window.samples.begin(), count, samples.begin());
+    }
+
+    if (count == 0) {
+        return {.samples = 0, .min_us = 0, .avg_us = 0, .p95_us = 0, .max_us = 0};
+    }
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) sum += samples[i];
+
+    auto begin = samples.begin();
+    auto end = samples.begin() + static_cast<long>(count);
+    auto p95 = begin + static_cast<long>((count * 95 + 99) / 100 - 1);
+    std::nth_element(begin, p95, end);
+
+    return {
+        .samples = count,
+        .min_us = *std::min_element(begin, end),
+        .avg_us = static_cast<uint32_t>(sum / count),
+        .p95_us = *p95,
+        .max_us = *std::max_element(begin, end)
+    };
+}
+
+uint32_t FrameMetrics::get_committed_frames() {
+    std::lock_guard lock(mutex);
+    return committed_frames;
+}
+
+uint32_t FrameMetrics::get_displayed_frames() {
+    std::lock_guard lock(mutex);
+    return displayed_frames;
+}
+
+uint32_t FrameMetrics::get_refreshes(const RefreshDecision decision) {
+    std::lock_guard lock(mutex);
+    return refreshes[to_underlying(decision)];
+}
+
+RefreshDecision FrameMetrics::get_last_refresh() {
+    std::lock_guard lock(mutex);
+    return last_refresh;
+}
+
+const char *FrameMetrics::get_stage_name(const FrameStage stage) {
+    switch (stage) {
+        case FrameStage::RECEIVE: return "receive";
+        case FrameStage::UNPACK: return "unpack";
+        case FrameStage::QUEUE: return "queue";
+        case FrameStage::REFRESH: return "refresh";
+        case FrameStage::TOTAL: return "total";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "refresh_policy.h"
+
+enum class FrameStage {
+    // first to last chunk of a frame received
+    RECEIVE,
+    // time spent unpacking the chunks of a frame
+    UNPACK,
+    // frame committed to refresh started
+    QUEUE,
+    // refresh of the panel
+    REFRESH,
+    // first chunk received to refresh finished
+    TOTAL,
+    COUNT
+};
+
+struct FrameStageSummary {
+    size_t samples;
+    uint32_t min_us;
+    uint32_t avg_us;
+    uint32_t p95_us;
+    uint32_t max_us;
+};
+
+/**
+ * Rolling latency statistics of the frame pipeline.
+ * Each stage keeps a fixed window of its most recent samples, so recording never allocates.
+ */
+class FrameMetrics {
+public:
+    FrameMetrics();
+
+    void record(FrameStage stage, int64_t duration_us);
+    void count_committed_frame();
+    void count_displayed_frame();
+    void count_refresh(RefreshDecision decision);
+
+    FrameStageSummary summarize(FrameStage stage);
+    uint32_t get_committed_frames();
+    uint32_t get_displayed_frames();
+    uint32_t get_refreshes(RefreshDecision decision);
+    RefreshDecision get_last_refresh();
+
+    static const char *get_stage_name(FrameStage stage);
+private:
+    static constexpr size_t WINDOW_SIZE = 32;
+
+    struct StageWindow {
+        std::array<uint32_t, WINDOW_SIZE> samples;
+        size_t count;
+        size_t next;
+    };
+
+    std::mutex mutex;
+    std::array<StageWindow, static_cast<size_t>(FrameStage::COUNT)> windows;
+    uint32_t committed_frames;
+    uint32_t displayed_frames;
+    std::array<uint32_t, static_cast<size_t>(RefreshDecision::COUNT)> refreshes;
+    RefreshDecision last_refresh;
+};
@@ -0,0 +1,416 @@
+#include "frame_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "drivers/inkplate_framebuffer.h"
+
+static constexpr auto *TAG = "frame_pipeline";
+
+// hash of the frame on the panel, kept across software resets together with its complement,
+// which tells a preserved value apart from the random content of RTC memory after a power on
+RTC_NOINIT_ATTR static uint32_t rtc_displayed_hash;
+RTC_NOINIT_ATTR static uint32_t rtc_displayed_hash_complement;
+
+FramePipeline::FramePipeline(Inkplate &inkplate, FrameMetrics &metrics, FrameCache &cache):
+        inkplate{inkplate},
+        metrics{metrics},
+        cache{cache},
+        buffer_size{static_cast<size_t>(inkplate.einkWidth() * inkplate.einkHeight() / 2)},
+        back_buffer{static_cast<uint8_t *>(heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM))},
+        back_depth{inkplate.getDisplayMode() == DisplayMode::INKPLATE_1BIT ? 1 : 4},
+        back_hash{},
+        committed_hash{0},
+        committed_depth{back_depth},
+        pending_buffer{static_cast<uint8_t *>(heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM))},
+        pending_depth{back_depth},
+        pending_refresh{RefreshKind::PARTIAL},
+        pending_hash{0},
+        pending_started_at{0},
+        pending_committed_at{0},
+        is_pending{false},
+        refresh_buffer{static_cast<uint8_t *>(heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM))},
+        pending_waveform{},
+        pending_waveform_id{0},
+        waveform{},
+        waveform_id{0},
+        performance_lock("frame_refresh"),
+        refresh_policy(inkplate.einkWidth(), inkplate.einkHeight()),
+        is_restored{false},
+        displayed_hash{0},
+        is_cache_stale{false},
+        is_flush_requested{false},
+        displayed_at{0},
+        cached_at{0} {}
+
+void FramePipeline::restore() {
+    std::lock_guard panel_lock(panel_mutex);
+    std::lock_guard performance_guard(performance_lock);
+    {
+        std::lock_guard lock(pending_mutex);
+        apply_pending_waveform();
+    }
+
+    if (!restore_cached_frame()) {
+        ESP_LOGI(TAG, "Clearing display");
+        inkplate.clearDisplay();
+        inkplate.display();
+        set_displayed_hash(hash_frame(get_front_buffer(), get_frame_size(back_depth), back_depth));
+    }
+
+    // start from what the panel currently shows, so the first frame is diffed against the right content
+    std::memcpy(back_buffer, get_front_buffer(), get_frame_size(back_depth));
+    back_hash = displayed_hash.load();
+    committed_hash = *back_hash;
+    committed_depth = back_depth;
+
+    is_restored = true;
+    is_restored.notify_all();
+}
+
+/**
+ * Blocks until the last frame has been restored, the back buffer and the panel must not be touched before.
+ */
+void FramePipeline::wait_until_restored() const {
+    is_restored.wait(false);
+}
+
+bool FramePipeline::restore_cached_frame() {
+    auto cached_frame = cache.get_cached_frame();
+    if (!cached_frame) return false;
+
+    // the record is checked against its hash in the back buffer, so a corrupted one never reaches the panel
+    auto depth = cached_frame->depth;
+    if (!cache.load(back_buffer, get_frame_size(depth))) return false;
+
+    // a software reset leaves the panel as it was, redraw it only if it is not showing the cached frame
+    auto reset_reason = esp_reset_reason();
+    auto is_panel_intact = reset_reason != ESP_RST_POWERON
+        && reset_reason != ESP_RST_BROWNOUT
+        && rtc_displayed_hash_complement == ~rtc_displayed_hash
+        && rtc_displayed_hash == cached_frame->hash;
+
+    inkplate.setDisplayMode(get_display_mode(depth));
+    back_depth = depth;
+
+    if (is_panel_intact) {
+        ESP_LOGI(TAG, "Panel still shows the cached frame");
+        std::memcpy(get_front_buffer(), back_buffer, get_frame_size(depth));
+    } else {
+        ESP_LOGI(TAG, "Restoring the cached frame");
+        if (depth == 1) {
+            inkplate.clearDisplay();
+            inkplate.display();
+        }
+        std::memcpy(get_front_buffer(), back_buffer, get_frame_size(depth));
+        if (depth == 1) {
+            inkplate.partialUpdate();
+        } else {
+            inkplate.display();
+        }
+    }
+
+    set_displayed_hash(cached_frame->hash);
+    return true;
+}
+
+uint32_t FramePipeline::get_displayed_hash() const {
+    return displayed_hash;
+}
+
+void FramePipeline::set_displayed_hash(const uint32_t hash) {
+    displayed_hash = hash;
+    rtc_displayed_hash = hash;
+    rtc_displayed_hash_complement = ~hash;
+}
+
+DisplayMode FramePipeline::get_display_mode(const int depth) {
+    return depth == 1 ? DisplayMode::INKPLATE_1BIT : DisplayMode::INKPLATE_3BIT;
+}
+
+size_t FramePipeline::get_frame_size(const int depth) const {
+    return inkplate.einkWidth() * inkplate.einkHeight() * depth / 8;
+}
+
+uint8_t *FramePipeline::get_front_buffer() const {
+    return inkplate.getDisplayMode() == DisplayMode::INKPLATE_1BIT
+        ? inkplate._partial->get_data()
+        : inkplate.DMemory4Bit->get_data();
+}
+
+uint8_t *FramePipeline::get_back_buffer() const {
+    return back_buffer;
+}
+
+size_t FramePipeline::get_buffer_size() const {
+    return buffer_size;
+}
+
+int FramePipeline::get_back_depth() const {
+    return back_depth;
+}
+
+void FramePipeline::set_back_depth(const int depth) {
+    if (depth == back_depth) return;
+
+    // switching modes clears the panel, so the back buffer starts out white as well
+    back_depth = depth;
+    back_hash.reset();
+    std::memset(back_buffer, depth == 1 ? 0x00 : 0x77, get_frame_size(depth));
+}
+
+std::optional<uint32_t> FramePipeline::get_back_hash() const {
+    return back_hash;
+}
+
+void FramePipeline::set_back_hash(const std::optional<uint32_t> hash) {
+    back_hash = hash;
+}
+
+/**
+ * Tells whether the back buffer content with the given hash is the frame last committed, i.e. the one the panel
+ * shows or is about to show. Changes staged without a refresh or the white buffer of a mode switch are not.
+ */
+bool FramePipeline::is_committed(const uint32_t hash) const {
+    return back_depth == committed_depth && hash == committed_hash;
+}
+
+void FramePipeline::commit(const RefreshKind refresh, const int64_t frame_started_at, const std::optional<uint32_t> hash) {
+    back_hash = hash ? *hash : hash_frame(back_buffer, get_frame_size(back_depth), back_depth);
+    committed_hash = *back_hash;
+    committed_depth = back_depth;
+    {
+        std::lock_guard lock(pending_mutex);
+
+        // a full refresh requested by a frame which did not make it to the panel must not get lost
+        auto merged_refresh = is_pending && pending_depth == back_depth ? std::max(pending_refresh, refresh) : refresh;
+
+        std::memcpy(pending_buffer, back_buffer, get_frame_size(back_depth));
+        pending_depth = back_depth;
+        pending_refresh = merged_refresh;
+        pending_hash = *back_hash;
+        pending_started_at = frame_started_at;
+        pending_committed_at = esp_timer_get_time();
+        is_pending = true;
+    }
+
+    metrics.count_committed_frame();
+    pending_changed.notify_one();
+}
+
+void FramePipeline::set_refresh_policy_config(const RefreshPolicyConfig &config) {
+    refresh_policy.set_config(config);
+}
+
+void FramePipeline::set_waveform(const uint8_t id, const Waveform &waveform) {
+    {
+        std::lock_guard lock(pending_mutex);
+        pending_waveform = waveform;
+        pending_waveform_id = id;
+    }
+    pending_changed.notify_one();
+}
+
+uint8_t FramePipeline::get_waveform_id() const {
+    return waveform_id;
+}
+
+/**
+ * Reads the panel temperature sensor, waiting for the refresh in progress to finish first.
+ * @return Temperature in °C, none if the sensor did not respond
+ */
+std::optional<int> FramePipeline::read_temperature() {
+    std::lock_guard lock(panel_mutex);
+
+    // the sensor only reports temperatures the panel can operate in, anything else is a failed read
+    auto temperature = inkplate.readTemperature();
+    if (temperature < -10 || temperature > 85) {
+        ESP_LOGW(TAG, "Panel temperature sensor returned %d", temperature);
+        return std::nullopt;
+    }
+    return temperature;
+}
+
+/**
+ * Lock to hold while talking to anything else on the I/O expander or the I2C bus of the panel, like the touchpads.
+ */
+std::mutex &FramePipeline::get_panel_mutex() {
+    return panel_mutex;
+}
+
+void FramePipeline::apply_pending_waveform() {
+    if (!pending_waveform) return;
+
+    // the Inkplate library precomputes its drive lookup tables from the waveform right away
+    waveform = *pending_waveform;
+    waveform_id = pending_waveform_id;
+    pending_waveform.reset();
+    inkplate.changeWaveform(waveform[0].data());
+    ESP_LOGI(TAG, "Waveform changed to %d", waveform_id.load());
+}
+
+void FramePipeline::invert_regions(const std::vector<DirtyRect> &regions) {
+    // regions are aligned to whole bytes of the 1-bit framebuffer
+    auto *frame_buffer = get_front_buffer();
+    auto stride = inkplate.einkWidth() / 8;
+    for (const auto &region : regions) {
+        for (int y = region.y; y < region.y + region.height; y++) {
+            auto *row = frame_buffer + y * stride;
+            for (int column = region.x / 8; column < (region.x + region.width) / 8; column++) {
+                row[column] = ~row[column];
+            }
+        }
+    }
+}
+
+void FramePipeline::store_displayed_frame() {
+    auto depth = inkplate.getDisplayMode() == DisplayMode::INKPLATE_1BIT ? 1 : 4;
+    auto err = cache.store(get_front_buffer(), get_frame_size(depth), depth, displayed_hash, [this] {
+        std::lock_guard lock(pending_mutex);
+        return is_pending;
+    });
+
+    // a store interrupted by a new frame is retried once that frame has been displayed for a while
+    if (err == ESP_ERR_INVALID_STATE) return;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to cache the displayed frame: %s", esp_err_to_name(err));
+    }
+
+    std::lock_guard lock(pending_mutex);
+    is_cache_stale = false;
+    is_flush_requested = false;
+    cached_at = esp_timer_get_time();
+}
+
+int64_t FramePipeline::get_last_committed_at() {
+    std::lock_guard lock(pending_mutex);
+    return pending_committed_at;
+}
+
+/**
+ * Tells whether the panel is done with all frames and has the displayed one cached, so it is safe to power down.
+ */
+bool FramePipeline::is_settled() {
+    std::lock_guard lock(pending_mutex);
+    return !is_pending && !pending_waveform && !is_cache_stale;
+}
+
+void FramePipeline::flush_cache() {
+    {
+        std::lock_guard lock(pending_mutex);
+        if (!is_cache_stale) return;
+        is_flush_requested = true;
+    }
+    pending_changed.notify_one();
+}
+
+void FramePipeline::run_refresh_loop() {
+    wait_until_restored();
+
+    for (;;) {
+        int depth;
+        RefreshKind refresh;
+        int64_t started_at;
+        int64_t committed_at;
+        uint32_t hash;
+        {
+            std::unique_lock lock(pending_mutex);
+            auto has_work = [this] { return is_pending || pending_waveform.has_value(); };
+            if (is_cache_stale) {
+                auto cache_due_at = std::max(displayed_at + CACHE_DELAY_US, cached_at + CACHE_INTERVAL_US);
+                auto cache_due_in = std::max(cache_due_at - esp_timer_get_time(), static_cast<int64_t>(0));
+                pending_changed.wait_for(lock, std::chrono::microseconds(cache_due_in), [&] { return has_work() || is_flush_requested; });
+
+                if (!has_work()) {
+                    lock.unlock();
+                    store_displayed_frame();
+                    continue;
+                }
+            } else {
+                pending_changed.wait(lock, has_work);
+            }
+
+            apply_pending_waveform();
+            if (!is_pending) continue;
+
+            // take the frame, so the MQTT task can commit the next one while the refresh policy looks at this one
+            std::swap(pending_buffer, refresh_buffer);
+            depth = pending_depth;
+            refresh = pending_refresh;
+            started_at = pending_started_at;
+            committed_at = pending_committed_at;
+            hash = pending_hash;
+            is_pending = false;
+            // from now on the cache lags behind the panel, even while it is still being refreshed
+            is_cache_stale = true;
+        }
+
+        std::lock_guard panel_lock(panel_mutex);
+        std::lock_guard performance_guard(performance_lock);
+
+        // clean the panel when switching modes or when partial updates have left too much ghosting behind
+        // TODO: once inkplate.display() works in 1bit mode, it should be used instead of the clear and partial update
+        auto decision = RefreshDecision::FULL;
+        auto mode = get_display_mode(depth);
+        if (inkplate.getDisplayMode() != mode) {
+            ESP_LOGI(TAG, "Switching to %d bit mode", depth == 1 ? 1 : 3);
+            inkplate.setDisplayMode(mode);
+            inkplate.clearDisplay();
+            inkplate.display();
+            refresh_policy.reset();
+        } else if (depth == 1) {
+            decision = refresh_policy.decide(get_front_buffer(), refresh_buffer, refresh == RefreshKind::FULL);
+            if (decision == RefreshDecision::FULL) {
+                inkplate.clearDisplay();
+                inkplate.display();
+            }
+        }
+
+        {
+            std::lock_guard lock(pending_mutex);
+            // a frame of a different depth arrived in the meantime, prepare the panel for that one instead
+            if (is_pending && pending_depth != depth) continue;
+
+            // a newer frame is displayed right away with the refresh decided for the taken one,
+            // unless it asks for a full refresh the taken one is not getting
+            if (is_pending && (pending_refresh != RefreshKind::FULL || decision == RefreshDecision::FULL)) {
+                std::swap(pending_buffer, refresh_buffer);
+                started_at = pending_started_at;
+                committed_at = pending_committed_at;
+                hash = pending_hash;
+                is_pending = false;
+            }
+        }
+        std::memcpy(get_front_buffer(), refresh_buffer, get_frame_size(depth));
+
+        auto refresh_started_at = esp_timer_get_time();
+        if (depth == 1 && decision == RefreshDecision::REGION) {
+            // drive every pixel of the ghosted regions to the opposite color and back
+            invert_regions(refresh_policy.get_regions());
+            inkplate.partialUpdate();
+            invert_regions(refresh_policy.get_regions());
+            inkplate.partialUpdate();
+        } else if (depth == 1) {
+            inkplate.partialUpdate();
+        } else {
+            inkplate.display();
+        }
+        auto refresh_finished_at = esp_timer_get_time();
+
+        metrics.record(FrameStage::QUEUE, refresh_started_at - committed_at);
+        metrics.record(FrameStage::REFRESH, refresh_finished_at - refresh_started_at);
+        metrics.record(FrameStage::TOTAL, refresh_finished_at - started_at);
+        metrics.count_displayed_frame();
+        metrics.count_refresh(decision);
+
+        set_displayed_hash(hash);
+        displayed_at = refresh_finished_at;
+        ESP_LOGI(TAG, "%s refresh took %d ms", RefreshPolicy::get_decision_name(decision), static_cast<int>((refresh_finished_at - refresh_started_at) / 1000));
+    }
+}
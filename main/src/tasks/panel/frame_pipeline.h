@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include <inkplate.hpp>
+
+#include "drivers/inkplate_waveform.h"
+#include "power.h"
+#include "frame_cache.h"
+#include "frame_metrics.h"
+#include "refresh_policy.h"
+
+enum class RefreshKind {
+    PARTIAL = 0,
+    FULL = 1,
+};
+
+/**
+ * Decouples frame reception from the e-ink refresh.
+ * Incoming frames are written into a PSRAM back buffer by the MQTT task. Each complete frame is committed into
+ * a pending buffer, which the refresh loop swaps for its own refresh buffer before deciding how to refresh and
+ * copying the frame into the Inkplate framebuffer, so the next frame can be received while the current one is
+ * being displayed. Whenever several frames are
+ * committed during a single refresh, only the newest one is displayed. Once the panel has been showing the same
+ * frame for a while, the refresh loop also stores it in the frame cache, so it survives a reboot.
+ */
+class FramePipeline {
+public:
+    FramePipeline(Inkplate &inkplate, FrameMetrics &metrics, FrameCache &cache);
+    FramePipeline(FramePipeline const&) = delete;
+    void operator=(FramePipeline const&) = delete;
+
+    // has to be called once before the pipeline is used, may run in its own thread while the rest is starting up
+    void restore();
+    void wait_until_restored() const;
+    [[nodiscard]] uint32_t get_displayed_hash() const;
+
+    // ingest side, only to be used from the MQTT task
+    [[nodiscard]] uint8_t *get_back_buffer() const;
+    [[nodiscard]] size_t get_buffer_size() const;
+    [[nodiscard]] int get_back_depth() const;
+    void set_back_depth(int depth);
+    [[nodiscard]] std::optional<uint32_t> get_back_hash() const;
+    void set_back_hash(std::optional<uint32_t> hash);
+    [[nodiscard]] bool is_committed(uint32_t hash) const;
+    void commit(RefreshKind refresh, int64_t frame_started_at, std::optional<uint32_t> hash = std::nullopt);
+
+    // refresh side
+    void set_refresh_policy_config(const RefreshPolicyConfig &config);
+    void set_waveform(uint8_t id, const Waveform &waveform);
+    [[nodiscard]] uint8_t get_waveform_id() const;
+    std::optional<int> read_temperature();
+    [[nodiscard]] std::mutex &get_panel_mutex();
+    [[noreturn]] void run_refresh_loop();
+
+    // sleep side
+    [[nodiscard]] int64_t get_last_committed_at();
+    bool is_settled();
+    void flush_cache();
+private:
+    // a frame is cached once it has been displayed for a while, but at most once per interval to spare the flash
+    static constexpr int64_t CACHE_DELAY_US = 30LL * 1000 * 1000;
+    static constexpr int64_t CACHE_INTERVAL_US = 5LL * 60 * 1000 * 1000;
+
+    static DisplayMode get_display_mode(int depth);
+    [[nodiscard]] size_t get_frame_size(int depth) const;
+    [[nodiscard]] uint8_t *get_front_buffer() const;
+    bool restore_cached_frame();
+    void set_displayed_hash(uint32_t hash);
+    void store_displayed_frame();
+    void apply_pending_waveform();
+    void invert_regions(const std::vector<DirtyRect> &regions);
+
+    Inkplate &inkplate;
+    FrameMetrics &metrics;
+    FrameCache &cache;
+    size_t buffer_size;
+
+    uint8_t *back_buffer;
+    int back_depth;
+    // hash of the back buffer content, unknown while it is being written to
+    std::optional<uint32_t> back_hash;
+    // the frame last handed to the refresh loop, the back buffer may have diverged from it without a commit
+    uint32_t committed_hash;
+    int committed_depth;
+
+    std::mutex pending_mutex;
+    std::condition_variable pending_changed;
+    uint8_t *pending_buffer;
+    int pending_depth;
+    RefreshKind pending_refresh;
+    uint32_t pending_hash;
+    int64_t pending_started_at;
+    int64_t pending_committed_at;
+    bool is_pending;
+    // frame taken from the pending buffer, only touched by the refresh loop
+    uint8_t *refresh_buffer;
+    // applied by the refresh loop in between refreshes, the Inkplate library must not switch mid-refresh
+    std::optional<Waveform> pending_waveform;
+    uint8_t pending_waveform_id;
+    Waveform waveform;
+    std::atomic<uint8_t> waveform_id;
+
+    // held while the panel is driven, its sensors share the power rails and I2C bus with the refresh
+    std::mutex panel_mutex;
+    // the panel timing is driven by the CPU, so it must not be scaled down during a refresh
+    PerformanceLock performance_lock;
+
+    RefreshPolicy refresh_policy;
+
+    std::atomic<bool> is_restored;
+    std::atomic<uint32_t> displayed_hash;
+    // both guarded by pending_mutex, a flush stores the displayed frame without waiting for the cache delay
+    bool is_cache_stale;
+    bool is_flush_requested;
+    int64_t displayed_at;
+    int64_t cached_at;
+};
@@ -0,0 +1,78 @@
+#include "frame_stream.h"
+
+#include <cctype>
+#include <string_view>
+
+#include <esp_log.h>
+
+bool is_last_chunk(const esp_mqtt_event_handle_t event) {
+    return event->current_data_offset + event->data_len == event->total_data_len;
+}
+
+std::optional<uint32_t> get_announced_hash(const esp_mqtt_event_handle_t event) {
+    std::string_view topic(event->topic, event->topic_len);
+    auto hash_str = topic.substr(topic.rfind('/') + 1);
+    if (hash_str == "set" || hash_str.empty() || hash_str.size() > 8) return std::nullopt;
+
+    uint32_t hash = 0;
+    for (unsigned char c : hash_str) {
+        if (!isxdigit(c)) return std::nullopt;
+        hash = hash << 4 | (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+    return hash;
+}
+
+void FrameStream::accept(const int depth, const std::optional<FrameCrop> &crop) {
+    this->depth = depth;
+    this->crop = crop;
+}
+
+void FrameStream::reset() {
+    depth = 0;
+    crop.reset();
+}
+
+bool FrameStream::is_accepted(const int depth) const {
+    return this->depth != 0 && this->depth == depth;
+}
+
+int FrameStream::get_depth() const {
+    return depth;
+}
+
+const std::optional<FrameCrop> &FrameStream::get_crop() const {
+    return crop;
+}
+
+std::optional<FrameWindow> get_region_window(const RegionHeader &header, const int current_depth, const int canvas_width, const int canvas_height, const int frame_width, const int message_size) {
+    if (header.depth != current_depth) {
+        ESP_LOGE("display_region", "Region depth %d does not match the current display depth %d", header.depth, current_depth);
+        return std::nullopt;
+    }
+
+    auto pixels_per_byte = 8 / header.depth;
+    if (header.x % pixels_per_byte != 0 || header.width % pixels_per_byte != 0) {
+        ESP_LOGE("display_region", "Region x and width must be multiples of %d", pixels_per_byte);
+        return std::nullopt;
+    }
+
+    if (header.width == 0 || header.height == 0
+        || header.x + header.width > canvas_width
+        || header.y + header.height > canvas_height) {
+        ESP_LOGE("display_region", "Region %dx%d at %d,%d is out of bounds", header.width, header.height, header.x, header.y);
+        return std::nullopt;
+    }
+
+    auto expected_size = static_cast<int>(RegionHeader::SIZE) + header.width * header.height / pixels_per_byte;
+    if (message_size != expected_size) {
+        ESP_LOGE("display_region", "Expected %d bytes, got %d bytes", expected_size, message_size);
+        return std::nullopt;
+    }
+
+    return FrameWindow{
+        .frame_stride = static_cast<size_t>(frame_width / pixels_per_byte),
+        .x = static_cast<size_t>(header.x / pixels_per_byte),
+        .y = header.y,
+        .stride = static_cast<size_t>(header.width / pixels_per_byte)
+    };
+}
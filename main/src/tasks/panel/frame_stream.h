@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <mqtt_client.h>
+
+#include "drivers/inkplate_framebuffer.h"
+
+/**
+ * Tells whether the chunk is the last one of its message.
+ */
+bool is_last_chunk(esp_mqtt_event_handle_t event);
+
+/**
+ * Reads the frame hash announced in the last topic level of a frame message, e.g. display/raw_1bpp/set/1a2b3c4d.
+ */
+std::optional<uint32_t> get_announced_hash(esp_mqtt_event_handle_t event);
+
+/**
+ * Collects the fixed size header at the start of a message, which may in theory be split across chunks.
+ */
+template<size_t SIZE>
+class MessageHeader {
+public:
+    /**
+     * Takes the header part of a chunk and moves the chunk past it.
+     * @param data The chunk, moved past the header part
+     * @param data_len Length of the chunk, reduced by the header part
+     * @param offset Byte offset of the chunk within the message, moved past the header part
+     * @return true once the header is complete, false while it is still missing parts
+     */
+    bool collect(const uint8_t *&data, size_t &data_len, size_t &offset) {
+        if (offset >= SIZE) return true;
+
+        auto part_len = std::min(SIZE - offset, data_len);
+        std::copy_n(data, part_len, buffer + offset);
+        data += part_len;
+        data_len -= part_len;
+        offset += part_len;
+        return offset == SIZE;
+    }
+
+    [[nodiscard]] const uint8_t *get() const {
+        return buffer;
+    }
+private:
+    uint8_t buffer[SIZE] = {};
+};
+
+/**
+ * The frame message currently being received. It is accepted once its first chunk or header checks out, along with
+ * the depth it is drawn in, and the chunks following a rejected one are dropped until the next message starts.
+ */
+class FrameStream {
+public:
+    /**
+     * @param depth Bits per pixel of the frame, 1 or 4
+     * @param crop Part of the frame the panel shows, if it is a larger group frame
+     */
+    void accept(int depth, const std::optional<FrameCrop> &crop = std::nullopt);
+
+    // rejects the message being received, or ends it once it is complete
+    void reset();
+
+    /**
+     * Tells whether the chunks of a message drawn in the given depth are to be applied, which a rejected message
+     * never is, even if its header claims depth 0.
+     */
+    [[nodiscard]] bool is_accepted(int depth) const;
+
+    [[nodiscard]] int get_depth() const;
+    [[nodiscard]] const std::optional<FrameCrop> &get_crop() const;
+private:
+    // 0 if there is no accepted message
+    int depth = 0;
+    std::optional<FrameCrop> crop;
+};
+
+struct RegionHeader {
+    static constexpr size_t SIZE = 10;
+    static constexpr uint8_t FLAG_FULL_REFRESH = 1 << 0;
+    static constexpr uint8_t FLAG_NO_REFRESH = 1 << 1;
+
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+    uint8_t flags;
+
+    static RegionHeader parse(const uint8_t *data) {
+        return {
+            .x = static_cast<uint16_t>(data[0] | data[1] << 8),
+            .y = static_cast<uint16_t>(data[2] | data[3] << 8),
+            .width = static_cast<uint16_t>(data[4] | data[5] << 8),
+            .height = static_cast<uint16_t>(data[6] | data[7] << 8),
+            .depth = data[8],
+            .flags = data[9]
+        };
+    }
+};
+
+/**
+ * Checks a region header and places the region within the framebuffer.
+ * @param header The region header
+ * @param current_depth Depth of the frame in the back buffer, which the region has to match
+ * @param canvas_width Width of the canvas the region is placed in, the panel or the whole group frame
+ * @param canvas_height Height of the canvas the region is placed in
+ * @param frame_width Width of the framebuffer
+ * @param message_size Size of the whole message, header included
+ * @return Placement of the region relative to the canvas, none if it is invalid
+ */
+std::optional<FrameWindow> get_region_window(const RegionHeader &header, int current_depth, int canvas_width, int canvas_height, int frame_width, int message_size);
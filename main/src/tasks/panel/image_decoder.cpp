@@ -0,0 +1,491 @@
+#include "image_decoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp32/rom/miniz.h>
+
+static constexpr auto *TAG = "image_decoder";
+
+static constexpr uint8_t PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+static constexpr uint8_t PNG_COLOR_GRAY = 0;
+static constexpr uint8_t PNG_COLOR_RGB = 2;
+static constexpr uint8_t PNG_COLOR_PALETTE = 3;
+static constexpr uint8_t PNG_COLOR_GRAY_ALPHA = 4;
+static constexpr uint8_t PNG_COLOR_RGBA = 6;
+
+static uint32_t read_be32(const uint8_t *data) {
+    return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static uint8_t get_luminance(const uint8_t red, const uint8_t green, const uint8_t blue) {
+    return static_cast<uint8_t>((red * 77 + green * 150 + blue * 29) >> 8);
+}
+
+// transparent pixels are shown over white, the background of the panel
+static uint8_t blend_over_white(const uint8_t gray, const uint8_t alpha) {
+    return static_cast<uint8_t>((gray * alpha + 255 * (255 - alpha)) / 255);
+}
+
+ImageDecoder::ImageDecoder():
+        stream{nullptr},
+        is_job_pending{false},
+        is_job_done{true},
+        is_decoded{false},
+        is_aborted{false},
+        format{ImageFormat::PNG},
+        canvas{nullptr},
+        width{0},
+        height{0},
+        remaining_input{0},
+        input_buffer{},
+        gray_row{},
+        dither{},
+        png_header{},
+        png_palette{},
+        png_row{},
+        png_previous_row{},
+        png_row_fill{0},
+        png_row_y{0},
+        inflater{nullptr},
+        inflate_window{nullptr},
+        inflate_window_offset{0},
+        is_inflated{false},
+        jpeg_strip{nullptr},
+        jpeg_strip_height{0} {}
+
+void ImageDecoder::init() {
+    stream = xStreamBufferCreate(STREAM_BUFFER_SIZE, 1);
+}
+
+bool ImageDecoder::begin(const ImageFormat format, InkplateCanvas &canvas, const int width, const int height, const size_t size) {
+    {
+        // an image which was never fed completely leaves the worker waiting for the rest of it
+        std::unique_lock lock(job_mutex);
+        if (!is_job_done) {
+            is_aborted = true;
+            job_changed.wait(lock, [this] { return is_job_done; });
+        }
+    }
+
+    if (stream == nullptr || xStreamBufferReset(stream) != pdPASS) {
+        ESP_LOGE(TAG, "Image decoder is not ready");
+        return false;
+    }
+
+    this->format = format;
+    this->canvas = &canvas;
+    this->width = width;
+    this->height = height;
+    this->remaining_input = size;
+    is_aborted = false;
+    {
+        std::lock_guard lock(job_mutex);
+        is_job_pending = true;
+        is_job_done = false;
+    }
+    job_changed.notify_all();
+    return true;
+}
+
+void ImageDecoder::write(const uint8_t *data, size_t data_len) {
+    // the worker always reads the whole image, even once it failed to decode it
+    while (data_len > 0) {
+        auto sent_len = xStreamBufferSend(stream, data, data_len, portMAX_DELAY);
+        data += sent_len;
+        data_len -= sent_len;
+    }
+}
+
+bool ImageDecoder::finish() {
+    std::unique_lock lock(job_mutex);
+    job_changed.wait(lock, [this] { return is_job_done; });
+    return is_decoded;
+}
+
+void ImageDecoder::run_worker() {
+    for (;;) {
+        {
+            std::unique_lock lock(job_mutex);
+            job_changed.wait(lock, [this] { return is_job_pending; });
+            is_job_pending = false;
+        }
+
+        gray_row.assign(width, 0);
+        dither.begin(width, canvas->get_depth());
+        auto is_image_decoded = format == ImageFormat::PNG ? decode_png() : decode_jpeg();
+        dither.end();
+        gray_row = {};
+        skip(remaining_input);
+
+        {
+            std::lock_guard lock(job_mutex);
+            is_decoded = is_image_decoded && !is_aborted;
+            is_job_done = true;
+        }
+        job_changed.notify_all();
+    }
+}
+
+size_t ImageDecoder::read(uint8_t *data, const size_t data_len) {
+    auto len = std::min(data_len, remaining_input);
+    size_t received_len = 0;
+    while (received_len < len && !is_aborted) {
+        received_len += xStreamBufferReceive(stream, data + received_len, len - received_len, pdMS_TO_TICKS(100));
+    }
+
+    remaining_input -= received_len;
+    return received_len;
+}
+
+size_t ImageDecoder::skip(const size_t data_len) {
+    size_t skipped_len = 0;
+    while (skipped_len < data_len) {
+        auto len = read(input_buffer, std::min(sizeof(input_buffer), data_len - skipped_len));
+        if (len == 0) break;
+        skipped_len += len;
+    }
+    return skipped_len;
+}
+
+void ImageDecoder::draw_row(uint8_t *row, const int y) {
+    dither.dither_row(row);
+    for (int x = 0; x < width; x++) {
+        canvas->drawPixel(static_cast<int16_t>(x), static_cast<int16_t>(y), row[x]);
+    }
+}
+
+bool ImageDecoder::decode_png() {
+    uint8_t signature[sizeof(PNG_SIGNATURE)];
+    if (read(signature, sizeof(signature)) != sizeof(signature) || !std::equal(signature, signature + sizeof(signature), PNG_SIGNATURE)) {
+        ESP_LOGE(TAG, "Not a PNG image");
+        return false;
+    }
+
+    // the inflate state and window are too large to be kept around between images
+    inflater = static_cast<tinfl_decompressor *>(heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM));
+    inflate_window = static_cast<uint8_t *>(heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM));
+    auto is_decoded = false;
+    auto has_header = false;
+    if (inflater == nullptr || inflate_window == nullptr) {
+        ESP_LOGE(TAG, "Not enough memory to inflate the PNG image");
+    }
+
+    while (inflater != nullptr && inflate_window != nullptr) {
+        uint8_t chunk_header[8];
+        if (read(chunk_header, sizeof(chunk_header)) != sizeof(chunk_header)) {
+            ESP_LOGE(TAG, "PNG image ends before its last chunk");
+            break;
+        }
+        auto chunk_len = static_cast<size_t>(read_be32(chunk_header));
+        std::string_view chunk_type(reinterpret_cast<const char *>(chunk_header + 4), 4);
+
+        if (chunk_type == "IHDR") {
+            if (!read_png_header(chunk_len, png_header)) break;
+            has_header = true;
+            tinfl_init(inflater);
+            inflate_window_offset = 0;
+            is_inflated = false;
+        } else if (chunk_type == "PLTE" && chunk_len <= sizeof(png_palette) * 3) {
+            for (size_t i = 0; i < chunk_len / 3; i++) {
+                uint8_t color[3];
+                if (read(color, sizeof(color)) != sizeof(color)) break;
+                png_palette[i] = get_luminance(color[0], color[1], color[2]);
+            }
+            skip(chunk_len % 3);
+        } else if (chunk_type == "tRNS" && png_header.color_type == PNG_COLOR_PALETTE && chunk_len <= sizeof(png_palette)) {
+            // alpha of the palette entries, the ones past its end are opaque
+            for (size_t i = 0; i < chunk_len; i++) {
+                uint8_t alpha;
+                if (read(&alpha, 1) != 1) break;
+                png_palette[i] = blend_over_white(png_palette[i], alpha);
+            }
+        } else if (chunk_type == "IDAT") {
+            if (!has_header || !inflate_png_data(chunk_len)) break;
+        } else if (chunk_type == "IEND") {
+            is_decoded = has_header && png_row_y == png_header.height;
+            if (!is_decoded) ESP_LOGE(TAG, "PNG image ends after %d of %d rows", png_row_y, png_header.height);
+            break;
+        } else {
+            skip(chunk_len);
+        }
+
+        // the CRC of the chunk, the data itself is checked by the Adler-32 of the zlib stream
+        skip(4);
+    }
+
+    heap_caps_free(inflater);
+    heap_caps_free(inflate_window);
+    inflater = nullptr;
+    inflate_window = nullptr;
+    png_row = {};
+    png_previous_row = {};
+    return is_decoded;
+}
+
+bool ImageDecoder::read_png_header(const size_t chunk_len, PngHeader &header) {
+    uint8_t data[13];
+    if (chunk_len != sizeof(data) || read(data, sizeof(data)) != sizeof(data)) {
+        ESP_LOGE(TAG, "Invalid PNG header");
+        return false;
+    }
+
+    header.width = static_cast<int>(read_be32(data));
+    header.height = static_cast<int>(read_be32(data + 4));
+    header.bit_depth = data[8];
+    header.color_type = data[9];
+    header.interlace = data[12];
+
+    if (header.width != width || header.height != height) {
+        ESP_LOGE(TAG, "Expected a %dx%d image, got %dx%d", width, height, header.width, header.height);
+        return false;
+    }
+
+    auto bit_depth = header.bit_depth;
+    auto is_supported = false;
+    switch (header.color_type) {
+        case PNG_COLOR_GRAY:
+            header.channels = 1;
+            is_supported = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+            break;
+        case PNG_COLOR_PALETTE:
+            header.channels = 1;
+            is_supported = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+            break;
+        case PNG_COLOR_GRAY_ALPHA:
+            header.channels = 2;
+            is_supported = bit_depth == 8 || bit_depth == 16;
+            break;
+        case PNG_COLOR_RGB:
+            header.channels = 3;
+            is_supported = bit_depth == 8 || bit_depth == 16;
+            break;
+        case PNG_COLOR_RGBA:
+            header.channels = 4;
+            is_supported = bit_depth == 8 || bit_depth == 16;
+            break;
+        default:
+            break;
+    }
+    if (!is_supported || header.interlace != 0) {
+        ESP_LOGE(TAG, "Unsupported PNG image, color type %d, bit depth %d, interlace %d", header.color_type, bit_depth, header.interlace);
+        return false;
+    }
+
+    auto bits_per_pixel = header.channels * bit_depth;
+    header.row_size = (static_cast<size_t>(header.width) * bits_per_pixel + 7) / 8;
+    header.filter_unit = std::max(1, bits_per_pixel / 8);
+
+    // every row starts with the type of its filter
+    png_row.assign(header.row_size + 1, 0);
+    png_previous_row.assign(header.row_size, 0);
+    png_row_fill = 0;
+    png_row_y = 0;
+    return true;
+}
+
+bool ImageDecoder::inflate_png_data(size_t chunk_len) {
+    while (chunk_len > 0) {
+        auto input_len = read(input_buffer, std::min(sizeof(input_buffer), chunk_len));
+        if (input_len == 0) return false;
+        chunk_len -= input_len;
+
+        // the window is circular, the rows are taken out of it before it wraps around
+        size_t input_offset = 0;
+        while (!is_inflated) {
+            auto input_part_len = input_len - input_offset;
+            auto output_len = TINFL_LZ_DICT_SIZE - inflate_window_offset;
+            auto status = tinfl_decompress(
+                inflater,
+                input_buffer + input_offset,
+                &input_part_len,
+                inflate_window,
+                inflate_window + inflate_window_offset,
+                &output_len,
+                TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT
+            );
+            input_offset += input_part_len;
+
+            if (status < TINFL_STATUS_DONE) {
+                ESP_LOGE(TAG, "Corrupted PNG image data (%d)", static_cast<int>(status));
+                return false;
+            }
+            if (!push_png_data(inflate_window + inflate_window_offset, output_len)) return false;
+            inflate_window_offset = (inflate_window_offset + output_len) & (TINFL_LZ_DICT_SIZE - 1);
+
+            if (status == TINFL_STATUS_DONE) is_inflated = true;
+            if (status == TINFL_STATUS_NEEDS_MORE_INPUT) break;
+        }
+    }
+    return true;
+}
+
+bool ImageDecoder::push_png_data(const uint8_t *data, size_t data_len) {
+    while (data_len > 0) {
+        if (png_row_y >= png_header.height) {
+            ESP_LOGE(TAG, "PNG image data exceeds %d rows", png_header.height);
+            return false;
+        }
+
+        auto part_len = std::min(png_row.size() - png_row_fill, data_len);
+        std::copy_n(data, part_len, png_row.begin() + static_cast<ptrdiff_t>(png_row_fill));
+        png_row_fill += part_len;
+        data += part_len;
+        data_len -= part_len;
+
+        if (png_row_fill < png_row.size()) break;
+
+        if (png_row[0] > 4) {
+            ESP_LOGE(TAG, "Invalid PNG filter %d", png_row[0]);
+            return false;
+        }
+        unfilter_png_row();
+        convert_png_row();
+        draw_row(gray_row.data(), png_row_y);
+
+        std::copy(png_row.begin() + 1, png_row.end(), png_previous_row.begin());
+        png_row_fill = 0;
+        png_row_y++;
+    }
+    return true;
+}
+
+void ImageDecoder::unfilter_png_row() {
+    auto filter = png_row[0];
+    auto *row = png_row.data() + 1;
+    const auto *above = png_previous_row.data();
+    auto unit = png_header.filter_unit;
+
+    for (size_t i = 0; i < png_header.row_size; i++) {
+        int left = i >= unit ? row[i - unit] : 0;
+        int up = above[i];
+        int up_left = i >= unit ? above[i - unit] : 0;
+
+        switch (filter) {
+            case 1:
+                row[i] += left;
+                break;
+            case 2:
+                row[i] += up;
+                break;
+            case 3:
+                row[i] += (left + up) / 2;
+                break;
+            case 4: {
+                // Paeth, the neighbour closest to left + up - up_left
+                auto estimate = left + up - up_left;
+                auto left_distance = std::abs(estimate - left);
+                auto up_distance = std::abs(estimate - up);
+                auto up_left_distance = std::abs(estimate - up_left);
+                if (left_distance <= up_distance && left_distance <= up_left_distance) {
+                    row[i] += left;
+                } else if (up_distance <= up_left_distance) {
+                    row[i] += up;
+                } else {
+                    row[i] += up_left;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void ImageDecoder::convert_png_row() {
+    const auto *row = png_row.data() + 1;
+    auto bit_depth = png_header.bit_depth;
+
+    // samples of 16 bits are cut down to their most significant byte
+    auto get_sample = [&](const size_t index) -> uint8_t {
+        if (bit_depth == 8) return row[index];
+        if (bit_depth == 16) return row[index * 2];
+
+        auto bit_offset = index * bit_depth;
+        auto mask = (1 << bit_depth) - 1;
+        return (row[bit_offset / 8] >> (8 - bit_depth - bit_offset % 8)) & mask;
+    };
+
+    for (int x = 0; x < width; x++) {
+        uint8_t gray;
+        switch (png_header.color_type) {
+            case PNG_COLOR_GRAY:
+                gray = bit_depth < 8 ? get_sample(x) * 255 / ((1 << bit_depth) - 1) : get_sample(x);
+                break;
+            case PNG_COLOR_PALETTE:
+                gray = png_palette[get_sample(x)];
+                break;
+            case PNG_COLOR_GRAY_ALPHA:
+                gray = blend_over_white(get_sample(x * 2), get_sample(x * 2 + 1));
+                break;
+            case PNG_COLOR_RGB:
+                gray = get_luminance(get_sample(x * 3), get_sample(x * 3 + 1), get_sample(x * 3 + 2));
+                break;
+            default:
+                gray = blend_over_white(get_luminance(get_sample(x * 4), get_sample(x * 4 + 1), get_sample(x * 4 + 2)), get_sample(x * 4 + 3));
+                break;
+        }
+        gray_row[x] = gray;
+    }
+}
+
+bool ImageDecoder::decode_jpeg() {
+    auto *work_buffer = malloc(JPEG_WORK_SIZE);
+    if (work_buffer == nullptr) return false;
+
+    JDEC decoder{};
+    auto result = jd_prepare(&decoder, read_jpeg, work_buffer, JPEG_WORK_SIZE, this);
+    if (result == JDR_OK && (static_cast<int>(decoder.width) != width || static_cast<int>(decoder.height) != height)) {
+        ESP_LOGE(TAG, "Expected a %dx%d image, got %dx%d", width, height, static_cast<int>(decoder.width), static_cast<int>(decoder.height));
+        free(work_buffer);
+        return false;
+    }
+
+    // blocks come out one MCU at a time, the rows are dithered once a whole strip of them is complete
+    if (result == JDR_OK) {
+        jpeg_strip_height = 8 * decoder.msy;
+        jpeg_strip = static_cast<uint8_t *>(heap_caps_malloc(static_cast<size_t>(width) * jpeg_strip_height, MALLOC_CAP_SPIRAM));
+        result = jpeg_strip != nullptr ? jd_decomp(&decoder, write_jpeg, 0) : JDR_MEM1;
+    }
+
+    if (result != JDR_OK) {
+        ESP_LOGE(TAG, "Cannot decode the JPEG image (%d), baseline images are supported only", static_cast<int>(result));
+    }
+
+    heap_caps_free(jpeg_strip);
+    jpeg_strip = nullptr;
+    free(work_buffer);
+    return result == JDR_OK;
+}
+
+UINT ImageDecoder::read_jpeg(JDEC *decoder, BYTE *data, const UINT data_len) {
+    auto *self = static_cast<ImageDecoder *>(decoder->device);
+    if (data == nullptr) return self->skip(data_len);
+    return self->read(data, data_len);
+}
+
+UINT ImageDecoder::write_jpeg(JDEC *decoder, void *bitmap, JRECT *rect) {
+    auto *self = static_cast<ImageDecoder *>(decoder->device);
+    if (self->is_aborted) return 0;
+
+    const auto *rgb = static_cast<const uint8_t *>(bitmap);
+    auto strip_top = rect->top / self->jpeg_strip_height * self->jpeg_strip_height;
+    for (int y = rect->top; y <= rect->bottom; y++) {
+        auto *strip_row = self->jpeg_strip + static_cast<size_t>(y - strip_top) * self->width;
+        for (int x = rect->left; x <= rect->right; x++) {
+            strip_row[x] = get_luminance(rgb[0], rgb[1], rgb[2]);
+            rgb += 3;
+        }
+    }
+
+    if (rect->right == self->width - 1) {
+        for (int y = strip_top; y <= rect->bottom; y++) {
+            self->draw_row(self->jpeg_strip + static_cast<size_t>(y - strip_top) * self->width, y);
+        }
+    }
+    return 1;
+}
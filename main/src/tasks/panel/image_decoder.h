@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/stream_buffer.h>
+#include <esp32/rom/tjpgd.h>
+
+#include "drivers/inkplate_canvas.h"
+#include "image_dither.h"
+
+enum class ImageFormat {
+    PNG,
+    JPEG,
+};
+
+/**
+ * Decodes PNG and JPEG images as their chunks arrive and dithers them row by row onto a canvas.
+ * The inflate and JPEG decoders of the ROM pull their input, so they run in a worker thread, which the MQTT task
+ * feeds through a stream buffer and blocks on while the worker catches up. Besides the 32 KiB deflate window
+ * of PNG, only a couple of rows, or a strip of MCU rows of JPEG, are kept in memory.
+ */
+class ImageDecoder {
+public:
+    ImageDecoder();
+    ImageDecoder(ImageDecoder const&) = delete;
+    void operator=(ImageDecoder const&) = delete;
+
+    // has to be called once before the worker is started
+    void init();
+    [[noreturn]] void run_worker();
+
+    // feeding side, only to be used from the MQTT task
+    bool begin(ImageFormat format, InkplateCanvas &canvas, int width, int height, size_t size);
+    void write(const uint8_t *data, size_t data_len);
+    bool finish();
+private:
+    static constexpr size_t STREAM_BUFFER_SIZE = 4096;
+    static constexpr size_t INPUT_CHUNK_SIZE = 1024;
+    static constexpr size_t JPEG_WORK_SIZE = 3100;
+
+    struct PngHeader {
+        int width;
+        int height;
+        uint8_t bit_depth;
+        uint8_t color_type;
+        uint8_t interlace;
+        int channels;
+        size_t row_size;
+        // distance of the bytes the filters refer to, a whole pixel rounded up to a byte
+        size_t filter_unit;
+    };
+
+    size_t read(uint8_t *data, size_t data_len);
+    size_t skip(size_t data_len);
+    void draw_row(uint8_t *row, int y);
+
+    bool decode_png();
+    bool read_png_header(size_t chunk_len, PngHeader &header);
+    bool inflate_png_data(size_t chunk_len);
+    bool push_png_data(const uint8_t *data, size_t data_len);
+    void unfilter_png_row();
+    void convert_png_row();
+
+    bool decode_jpeg();
+    static UINT read_jpeg(JDEC *decoder, BYTE *data, UINT data_len);
+    static UINT write_jpeg(JDEC *decoder, void *bitmap, JRECT *rect);
+
+    StreamBufferHandle_t stream;
+
+    std::mutex job_mutex;
+    std::condition_variable job_changed;
+    bool is_job_pending;
+    bool is_job_done;
+    bool is_decoded;
+    // set when a new image starts before the last one was fed completely, the worker gives up on the rest of it
+    std::atomic<bool> is_aborted;
+
+    // the job, only to be touched by the worker while it runs
+    ImageFormat format;
+    InkplateCanvas *canvas;
+    int width;
+    int height;
+    size_t remaining_input;
+    uint8_t input_buffer[INPUT_CHUNK_SIZE];
+    std::vector<uint8_t> gray_row;
+    FloydSteinbergDither dither;
+
+    // PNG decoding state
+    PngHeader png_header;
+    uint8_t png_palette[256];
+    std::vector<uint8_t> png_row;
+    std::vector<uint8_t> png_previous_row;
+    size_t png_row_fill;
+    int png_row_y;
+    struct tinfl_decompressor_tag *inflater;
+    uint8_t *inflate_window;
+    size_t inflate_window_offset;
+    bool is_inflated;
+
+    // JPEG decoding state
+    uint8_t *jpeg_strip;
+    int jpeg_strip_height;
+};
@@ -0,0 +1,44 @@
+#include "image_dither.h"
+
+#include <algorithm>
+
+FloydSteinbergDither::FloydSteinbergDither():
+        width{0},
+        levels{2},
+        is_1bit{true},
+        current_errors{},
+        next_errors{} {}
+
+void FloydSteinbergDither::begin(const int width, const int depth) {
+    this->width = width;
+    this->levels = depth == 1 ? 2 : 8;
+    this->is_1bit = depth == 1;
+    current_errors.assign(width + 2, 0);
+    next_errors.assign(width + 2, 0);
+}
+
+void FloydSteinbergDither::end() {
+    current_errors = {};
+    next_errors = {};
+}
+
+void FloydSteinbergDither::dither_row(uint8_t *row) {
+    std::fill(next_errors.begin(), next_errors.end(), 0);
+
+    auto max_level = levels - 1;
+    for (int x = 0; x < width; x++) {
+        auto value = row[x] + current_errors[x + 1];
+        auto level = std::clamp((value * max_level + 127) / 255, 0, max_level);
+        auto error = value - level * 255 / max_level;
+
+        // 7/16 to the right, 3/16 down left, 5/16 down and 1/16 down right
+        current_errors[x + 2] += static_cast<int16_t>(error * 7 / 16);
+        next_errors[x] += static_cast<int16_t>(error * 3 / 16);
+        next_errors[x + 1] += static_cast<int16_t>(error * 5 / 16);
+        next_errors[x + 2] += static_cast<int16_t>(error / 16);
+
+        row[x] = static_cast<uint8_t>(is_1bit ? level == 0 : level);
+    }
+
+    std::swap(current_errors, next_errors);
+}
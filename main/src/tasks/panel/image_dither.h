@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Floyd-Steinberg dither of 8-bit gray rows down to the gray levels of a framebuffer, in integers only.
+ * Rows are dithered one at a time from top to bottom, so only the errors spread into the current and the next
+ * row are kept. The output uses the colors of InkplateCanvas, 1 is black at depth 1, 0 to 7 are the gray levels
+ * from black to white at depth 4.
+ */
+class FloydSteinbergDither {
+public:
+    FloydSteinbergDither();
+
+    void begin(int width, int depth);
+    void end();
+
+    // replaces the gray levels of a row, 0 black to 255 white, with the colors of the depth
+    void dither_row(uint8_t *row);
+private:
+    int width;
+    int levels;
+    bool is_1bit;
+
+    // errors of the pixels of the current and the next row, with a spare one at both ends
+    std::vector<int16_t> current_errors;
+    std::vector<int16_t> next_errors;
+};
@@ -1,129 +1,825 @@
 #include "panel_task.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_log.h>
+#include <esp_pthread.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <cJSON.h>
 
 #include "drivers/inkplate_button.h"
+#include "drivers/inkplate_canvas.h"
+#include "drivers/inkplate_framebuffer.h"
 #include "drivers/inkplate_touchpad.h"
+#include "draw_commands.h"
+#include "frame_stream.h"
+#include "image_decoder.h"
+#include "packbits.h"
 #include "utils.h"
 
-void display_1bpp(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
-    static int partial_update_counter = 0;
-    static int partial_update_threshold = 10;
+// frame message currently being received, along with the part of a group frame the panel shows
+static FrameStream frame;
+
+// hash of the frame currently being received, computed as its chunks arrive, and the one announced by the sender
+static uint32_t frame_hash = 0;
+static std::optional<uint32_t> frame_announced_hash;
+
+// decodes the compressed images of the image topics in a worker of its own, see ImageDecoder
+static ImageDecoder image_decoder;
+
+// timing of the frame currently being received, in esp_timer microseconds
+static int64_t frame_started_at = 0;
+static int64_t chunk_received_at = 0;
+static int64_t frame_unpack_us = 0;
+
+/**
+ * Measures the time spent handling a single chunk of a frame message.
+ */
+class ChunkTimer {
+public:
+    explicit ChunkTimer(const esp_mqtt_event_handle_t event) {
+        chunk_received_at = esp_timer_get_time();
+        if (event->current_data_offset == 0) {
+            frame_started_at = chunk_received_at;
+            frame_unpack_us = 0;
+        }
+    }
+
+    ~ChunkTimer() {
+        frame_unpack_us += esp_timer_get_time() - chunk_received_at;
+    }
+};
+
+static size_t get_frame_size(const TaskContext &ctx, const int depth) {
+    return ctx.inkplate.einkWidth() * ctx.inkplate.einkHeight() * depth / 8;
+}
+
+/**
+ * Tells which part of the frames of a group the panel shows, none if they have the size of the panel.
+ * @param group Group the frame was sent to, none for the panel topics
+ */
+static std::optional<FrameCrop> get_group_crop(const TaskContext &ctx, const std::optional<PanelGroup> &group, const int depth) {
+    if (!group || group->canvas_width == 0) return std::nullopt;
+
+    auto pixels_per_byte = 8 / depth;
+    return FrameCrop{
+        .source_stride = static_cast<size_t>(group->canvas_width / pixels_per_byte),
+        .x = group->crop_x / pixels_per_byte,
+        .y = group->crop_y,
+        .stride = static_cast<size_t>(ctx.inkplate.einkWidth() / pixels_per_byte),
+        .height = static_cast<size_t>(ctx.inkplate.einkHeight())
+    };
+}
+
+static size_t get_payload_size(const TaskContext &ctx, const std::optional<PanelGroup> &group, const int depth) {
+    if (!group || group->canvas_width == 0) return get_frame_size(ctx, depth);
+    return group->canvas_width * group->canvas_height * depth / 8;
+}
+
+static void publish_assets(const TaskContext &ctx) {
+    using idf::mqtt::Retain;
+
+    auto assets_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(assets_json, "budget", static_cast<double>(ctx.assets.get_budget()));
+    cJSON_AddNumberToObject(assets_json, "used", static_cast<double>(ctx.assets.get_used_size()));
+    auto assets_list_json = cJSON_CreateArray();
+    for (const auto &asset : ctx.assets.list()) {
+        auto asset_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(asset_json, "id", asset.id);
+        cJSON_AddNumberToObject(asset_json, "width", asset.width);
+        cJSON_AddNumberToObject(asset_json, "height", asset.height);
+        cJSON_AddNumberToObject(asset_json, "depth", asset.depth);
+        cJSON_AddNumberToObject(asset_json, "size", static_cast<double>(asset.size));
+        cJSON_AddStringToObject(asset_json, "hash", string_format("%08lx", static_cast<unsigned long>(asset.hash)).c_str());
+        cJSON_AddItemToArray(assets_list_json, asset_json);
+    }
+    cJSON_AddItemToObject(assets_json, "assets", assets_list_json);
+
+    auto panel_assets_topic = string_format("vsb-eink/%s/assets", ctx.config.panel.panel_id.c_str());
+    auto assets_json_str = cJSON_PrintUnformatted(assets_json);
+    ctx.mqtt.publish<std::string>(panel_assets_topic, { .data = assets_json_str, .retain = Retain::Retained });
+
+    cJSON_Delete(assets_json);
+    free(assets_json_str);
+}
+
+static void publish_display_hash(const TaskContext &ctx) {
+    using idf::mqtt::Retain;
+
+    auto hash = ctx.frames.get_back_hash();
+    if (!hash) return;
+
+    auto panel_display_hash_topic = string_format("vsb-eink/%s/display/hash", ctx.config.panel.panel_id.c_str());
+    ctx.mqtt.publish<std::string>(panel_display_hash_topic, { .data = string_format("%08lx", static_cast<unsigned long>(*hash)), .retain = Retain::Retained });
+}
+
+/**
+ * Tells whether the sender announced exactly the frame the panel already has, in which case it can be skipped.
+ */
+static bool is_frame_current(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const int depth) {
+    frame_announced_hash = get_announced_hash(event);
+    auto current_hash = ctx.frames.get_back_hash();
+    if (!frame_announced_hash || !current_hash || *frame_announced_hash != *current_hash || ctx.frames.get_back_depth() != depth) {
+        return false;
+    }
+
+    ESP_LOGI("is_frame_current", "Frame %08lx is already displayed, skipping", static_cast<unsigned long>(*current_hash));
+    frame.reset();
+    return true;
+}
+
+/**
+ * Prepares the back buffer for an incoming frame and starts tracking its changes.
+ * @param crop Part of the frame the panel shows, if it is a larger group frame
+ * @return false if the framebuffer layout cannot take frames of the given depth
+ */
+static bool begin_frame(const TaskContext &ctx, const int depth, const std::optional<FrameCrop> &crop = std::nullopt) {
+    frame.reset();
+
+    // the framebuffer rows must be packed the same way as the incoming ones for the bulk blit to work
+    auto pixels_per_byte = 8 / depth;
+    if (ctx.inkplate.einkWidth() % pixels_per_byte != 0 || ctx.frames.get_buffer_size() < get_frame_size(ctx, depth)) {
+        ESP_LOGE("begin_frame", "Framebuffer layout does not match the %dbpp wire format", depth);
+        return false;
+    }
+
+    ctx.frames.set_back_depth(depth);
+    ctx.frames.set_back_hash(std::nullopt);
+    ctx.frame_diff.reset(depth);
+    frame.accept(depth, crop);
+    frame_hash = 0;
+    return true;
+}
 
-    // switch to 1 bit mode if not already in it
-    if (ctx.inkplate.getDisplayMode() != DisplayMode::INKPLATE_1BIT) {
-        ESP_LOGI("display_1bpp", "Switching to 1 bit mode");
-        ctx.inkplate.setDisplayMode(DisplayMode::INKPLATE_1BIT);
-        ctx.inkplate.clearDisplay();
-        ctx.inkplate.display();
-        partial_update_counter = 0;
+/**
+ * Unpacks a chunk of a raw frame straight into the back buffer, noting what differs from the current frame.
+ */
+static void write_frame(const TaskContext &ctx, const size_t offset, const uint8_t *data, const size_t data_len) {
+    if (frame.get_crop()) {
+        blit_crop(frame.get_depth() == 1 ? blit_1bpp : blit_4bpp, ctx.frames.get_back_buffer(), *frame.get_crop(), offset, data, data_len, &ctx.frame_diff);
+        return;
     }
 
-    // TODO: this is a workaround for a bug in the Inkplate library and should be put at the end of the function once it is fixed
-    if (partial_update_counter >= partial_update_threshold) {
-        ctx.inkplate.clearDisplay();
-        ctx.inkplate.display();
-        partial_update_counter = 0;
+    // chunks arrive in order, so the hash of the wire format is built up along the way
+    if (frame.get_depth() == 1) {
+        blit_1bpp(ctx.frames.get_back_buffer(), offset, data, data_len, &ctx.frame_diff);
+        frame_hash = esp_rom_crc32_le(frame_hash, data, data_len);
+    } else if (frame.get_depth() == 4) {
+        blit_4bpp(ctx.frames.get_back_buffer(), offset, data, data_len, &ctx.frame_diff);
+        frame_hash = esp_rom_crc32_le(frame_hash, ctx.frames.get_back_buffer() + offset, data_len);
     }
+}
+
+/**
+ * Hands a whole frame over to the refresh task, unless the panel already shows it.
+ * @param hash Hash of the frame, if it was built up while receiving it
+ */
+static void end_frame(const TaskContext &ctx, const RefreshKind refresh = RefreshKind::PARTIAL, const std::optional<uint32_t> hash = std::nullopt) {
+    if (frame.get_depth() == 0) return;
+    frame.reset();
+
+    if (hash && frame_announced_hash && *hash != *frame_announced_hash) {
+        ESP_LOGW("end_frame", "Frame hash %08lx does not match the announced %08lx", static_cast<unsigned long>(*hash), static_cast<unsigned long>(*frame_announced_hash));
+    }
+
+    auto unpacked_at = esp_timer_get_time();
+    ctx.metrics.record(FrameStage::RECEIVE, chunk_received_at - frame_started_at);
+    ctx.metrics.record(FrameStage::UNPACK, frame_unpack_us + unpacked_at - chunk_received_at);
+
+    // the diff is taken against the back buffer, which only matches the panel if it holds the committed frame
+    auto diff = ctx.frame_diff.finish();
+    auto back_hash = hash;
+    if (diff.changed_pixels == 0) {
+        auto depth = ctx.frames.get_back_depth();
+        back_hash = hash ? *hash : hash_frame(ctx.frames.get_back_buffer(), get_frame_size(ctx, depth), depth);
+        if (ctx.frames.is_committed(*back_hash)) {
+            ESP_LOGI("end_frame", "Frame is identical to the displayed one, skipping refresh");
+            ctx.frames.set_back_hash(back_hash);
+            return;
+        }
+    }
+
+    ESP_LOGI("end_frame", "%lu pixels changed in %d regions", static_cast<unsigned long>(diff.changed_pixels), static_cast<int>(diff.dirty_rects.size()));
+    ctx.frames.commit(refresh, frame_started_at, back_hash);
+    publish_display_hash(ctx);
+}
+
+/**
+ * Hash of the frame built up while receiving it, none for a cropped group frame, which has a hash of its own.
+ */
+static std::optional<uint32_t> get_received_hash() {
+    if (frame.get_crop()) return std::nullopt;
+    return frame_hash;
+}
+
+static void abort_frame() {
+    frame.reset();
+}
+
+void display_raw(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const int depth, const std::optional<PanelGroup> &group) {
+    // the broker may deliver frames before the last one has been restored on the panel
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
 
     // check expected payload size
-    auto expected_size = ctx.inkplate.einkWidth() * ctx.inkplate.einkHeight() / 8;
+    auto expected_size = get_payload_size(ctx, group, depth);
     if (event->total_data_len != expected_size) {
-        ESP_LOGE("display_1bpp", "Expected %d bytes, got %d bytes", expected_size, event->total_data_len);
+        ESP_LOGE("display_raw", "Expected %d bytes, got %d bytes", static_cast<int>(expected_size), event->total_data_len);
         return;
     }
 
-    // unpack and draw incoming pixels to the screen
-    for (int group_offset = 0; group_offset < event->data_len; group_offset++) {
-        auto total_group_offset = event->current_data_offset + group_offset;
-        for (int pixel_index_in_group = 0; pixel_index_in_group < 8; pixel_index_in_group++) {
-            auto position = get_position_by_index(total_group_offset * 8 + pixel_index_in_group, ctx.inkplate.einkWidth());
-            auto color = (event->data[group_offset] >> (7 - pixel_index_in_group)) & 1;
-            ctx.inkplate.drawPixel(position.x, position.y, color);
-        }
+    if (event->current_data_offset == 0 && (is_frame_current(ctx, event, depth) || !begin_frame(ctx, depth, get_group_crop(ctx, group, depth)))) {
+        return;
     }
 
+    if (!frame.is_accepted(depth)) return;
+
+    write_frame(ctx, event->current_data_offset, reinterpret_cast<const uint8_t *>(event->data), event->data_len);
+
     // display the screen if we have received all the data
-    // TODO: once inkplate.display() works in 1bit mode, it should be used here every threshold-th time
-    if (event->current_data_offset + event->data_len == event->total_data_len) {
-        ctx.inkplate.partialUpdate();
-        partial_update_counter++;
+    if (is_last_chunk(event)) {
+        end_frame(ctx, RefreshKind::PARTIAL, get_received_hash());
     }
 }
 
-void display_4bpp(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
-    // switch to 4 bit mode if not already in it
-    if (ctx.inkplate.getDisplayMode() != DisplayMode::INKPLATE_3BIT) {
-        ESP_LOGI("display_4bpp", "Switching to 4 bit mode");
-        ctx.inkplate.setDisplayMode(DisplayMode::INKPLATE_3BIT);
-        ctx.inkplate.clearDisplay();
-        ctx.inkplate.display();
+void display_rle(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const int depth, const std::optional<PanelGroup> &group) {
+    static PackBitsDecoder decoder;
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
+
+    auto expected_size = get_payload_size(ctx, group, depth);
+
+    if (event->current_data_offset == 0) {
+        if (is_frame_current(ctx, event, depth) || !begin_frame(ctx, depth, get_group_crop(ctx, group, depth))) return;
+        decoder.reset(expected_size);
     }
 
-    // check expected payload size
-    auto expected_size = ctx.inkplate.einkWidth() * ctx.inkplate.einkHeight() / 2;
-    if (event->total_data_len != expected_size) {
-        ESP_LOGE("display_4bpp", "Expected %d bytes, got %d bytes", expected_size, event->total_data_len);
+    if (!frame.is_accepted(depth)) return;
+
+    // decompress the chunk and feed the runs to the raw frame path as they come
+    auto is_decoded = decoder.decode(
+        reinterpret_cast<const uint8_t *>(event->data),
+        event->data_len,
+        [&](const size_t offset, const uint8_t *data, const size_t data_len) {
+            write_frame(ctx, offset, data, data_len);
+        }
+    );
+    if (!is_decoded) {
+        ESP_LOGE("display_rle", "Decompressed frame exceeds %d bytes", static_cast<int>(expected_size));
+        abort_frame();
         return;
     }
 
-    // unpack and draw incoming pixels to the screen
-    for (int group_offset = 0; group_offset < event->data_len; group_offset++) {
-        auto total_group_offset = event->current_data_offset + group_offset;
-        for (int pixel_index_in_group = 0; pixel_index_in_group < 2; pixel_index_in_group++) {
-            auto position = get_position_by_index(total_group_offset * 2 + pixel_index_in_group, ctx.inkplate.einkWidth());
-            auto color = (event->data[group_offset] >> ((1 - pixel_index_in_group) * 4)) & 0b1111;
-            ctx.inkplate.drawPixel(position.x, position.y, color);
+    if (is_last_chunk(event)) {
+        if (!decoder.is_complete()) {
+            ESP_LOGE("display_rle", "Expected %d decompressed bytes, got %d bytes", static_cast<int>(expected_size), static_cast<int>(decoder.get_decoded_size()));
+            abort_frame();
+            return;
         }
+
+        end_frame(ctx, RefreshKind::PARTIAL, get_received_hash());
     }
+}
 
-    // display the screen if we have received all the data
-    if (event->current_data_offset + event->data_len == event->total_data_len) {
-        ctx.inkplate.display();
+/**
+ * Asks the sender for a whole frame, after a delta could not be applied to the current one.
+ * @param base_hash Hash of the frame the delta was made against, if it was announced
+ */
+static void request_full_frame(const TaskContext &ctx, const std::optional<uint32_t> base_hash) {
+    using idf::mqtt::Retain;
+
+    auto resend_json = cJSON_CreateObject();
+    auto current_hash = ctx.frames.get_back_hash();
+    if (base_hash) {
+        cJSON_AddStringToObject(resend_json, "baseHash", string_format("%08lx", static_cast<unsigned long>(*base_hash)).c_str());
+    } else {
+        cJSON_AddNullToObject(resend_json, "baseHash");
+    }
+    if (current_hash) {
+        cJSON_AddStringToObject(resend_json, "hash", string_format("%08lx", static_cast<unsigned long>(*current_hash)).c_str());
+    } else {
+        cJSON_AddNullToObject(resend_json, "hash");
+    }
+    cJSON_AddNumberToObject(resend_json, "depth", ctx.frames.get_back_depth());
+
+    auto panel_display_resend_topic = string_format("vsb-eink/%s/display/resend", ctx.config.panel.panel_id.c_str());
+    auto resend_json_str = cJSON_PrintUnformatted(resend_json);
+    ctx.mqtt.publish<std::string>(panel_display_resend_topic, { .data = resend_json_str, .retain = Retain::NotRetained });
+
+    cJSON_Delete(resend_json);
+    free(resend_json_str);
+}
+
+/**
+ * Applies a PackBits encoded XOR delta onto the newest frame in a single pass, flipping only the pixels set in it.
+ * The delta is only applied onto the frame it was made against, otherwise a whole frame is requested instead.
+ */
+void display_delta(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const int depth) {
+    static PackBitsDecoder decoder;
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
+
+    auto frame_size = get_frame_size(ctx, depth);
+
+    if (event->current_data_offset == 0) {
+        frame.reset();
+
+        // the hash of the base frame is the last topic level, display/raw_1bpp/delta/1a2b3c4d
+        auto base_hash = get_announced_hash(event);
+        auto current_hash = ctx.frames.get_back_hash();
+        if (!base_hash || !current_hash || *base_hash != *current_hash || ctx.frames.get_back_depth() != depth) {
+            ESP_LOGW("display_delta", "Delta base does not match the current frame, requesting a whole frame");
+            request_full_frame(ctx, base_hash);
+            return;
+        }
+
+        // unlike begin_frame, the back buffer keeps its content as the delta is applied onto it
+        ctx.frames.set_back_hash(std::nullopt);
+        ctx.frame_diff.reset(depth);
+        frame.accept(depth);
+        frame_announced_hash.reset();
+        decoder.reset(frame_size);
+    }
+
+    if (!frame.is_accepted(depth)) return;
+
+    auto apply_delta = depth == 1 ? xor_1bpp : xor_4bpp;
+    auto is_decoded = decoder.decode(
+        reinterpret_cast<const uint8_t *>(event->data),
+        event->data_len,
+        [&](const size_t offset, const uint8_t *data, const size_t data_len) {
+            apply_delta(ctx.frames.get_back_buffer(), offset, data, data_len, &ctx.frame_diff);
+        }
+    );
+
+    // a partly applied delta leaves the back buffer without a known hash, so only a whole frame fixes it
+    if (!is_decoded || (is_last_chunk(event) && !decoder.is_complete())) {
+        ESP_LOGE("display_delta", "Expected %d decompressed bytes, got %d bytes", static_cast<int>(frame_size), static_cast<int>(decoder.get_decoded_size()));
+        abort_frame();
+        request_full_frame(ctx, std::nullopt);
+        return;
+    }
+
+    if (is_last_chunk(event)) {
+        end_frame(ctx);
+    }
+}
+
+void display_region(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const std::optional<PanelGroup> &group) {
+    static MessageHeader<RegionHeader::SIZE> header_buffer;
+    static RegionHeader header{};
+    static FrameWindow window{};
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
+
+    auto data = reinterpret_cast<const uint8_t *>(event->data);
+    size_t data_len = event->data_len;
+    size_t offset = event->current_data_offset;
+
+    if (offset < RegionHeader::SIZE) {
+        if (!header_buffer.collect(data, data_len, offset)) return;
+
+        header = RegionHeader::parse(header_buffer.get());
+        frame.reset();
+
+        // regions of a group frame are placed within its canvas
+        auto is_canvas = group && group->canvas_width != 0;
+        auto canvas_width = is_canvas ? group->canvas_width : ctx.inkplate.einkWidth();
+        auto canvas_height = is_canvas ? group->canvas_height : ctx.inkplate.einkHeight();
+        auto region_window = get_region_window(header, ctx.frames.get_back_depth(), canvas_width, canvas_height, ctx.inkplate.einkWidth(), event->total_data_len);
+        if (!region_window) return;
+
+        window = *region_window;
+        auto crop = get_group_crop(ctx, group, header.depth);
+        if (crop) {
+            // the panel is placed relative to the region instead of the whole canvas
+            crop->source_stride = window.stride;
+            crop->x -= static_cast<ptrdiff_t>(window.x);
+            crop->y -= static_cast<ptrdiff_t>(window.y);
+        }
+        ctx.frames.set_back_hash(std::nullopt);
+        ctx.frame_diff.reset(header.depth);
+        frame.accept(header.depth, crop);
+        frame_announced_hash.reset();
+    }
+
+    if (!frame.is_accepted(header.depth)) return;
+
+    auto blit = header.depth == 1 ? blit_1bpp : blit_4bpp;
+    if (frame.get_crop()) {
+        blit_crop(blit, ctx.frames.get_back_buffer(), *frame.get_crop(), offset - RegionHeader::SIZE, data, data_len, &ctx.frame_diff);
+    } else {
+        blit_window(blit, ctx.frames.get_back_buffer(), window, offset - RegionHeader::SIZE, data, data_len, &ctx.frame_diff);
+    }
+
+    // refresh once the whole region has been received
+    if (is_last_chunk(event)) {
+        if (header.flags & RegionHeader::FLAG_NO_REFRESH) {
+            ctx.frame_diff.finish();
+            abort_frame();
+            return;
+        }
+
+        ESP_LOGI("display_region", "Received %dx%d region at %d,%d", header.width, header.height, header.x, header.y);
+        end_frame(ctx, header.flags & RegionHeader::FLAG_FULL_REFRESH ? RefreshKind::FULL : RefreshKind::PARTIAL);
+    }
+}
+
+struct CommandsHeader {
+    static constexpr size_t SIZE = 2;
+
+    uint8_t depth;
+    // same as the region ones
+    uint8_t flags;
+
+    static CommandsHeader parse(const uint8_t *data) {
+        return {
+            .depth = data[0],
+            .flags = data[1]
+        };
+    }
+};
+
+/**
+ * Draws a display list into the back buffer as it streams in and refreshes the panel once it is complete,
+ * see DrawCommandDecoder for the list format.
+ */
+void display_commands(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const std::optional<PanelGroup> &group) {
+    static MessageHeader<CommandsHeader::SIZE> header_buffer;
+    static CommandsHeader header{};
+    static InkplateCanvas canvas(static_cast<int16_t>(ctx.inkplate.einkWidth()), static_cast<int16_t>(ctx.inkplate.einkHeight()));
+    static DrawCommandDecoder decoder(ctx.assets);
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
+
+    auto data = reinterpret_cast<const uint8_t *>(event->data);
+    size_t data_len = event->data_len;
+    size_t offset = event->current_data_offset;
+
+    if (offset < CommandsHeader::SIZE) {
+        if (!header_buffer.collect(data, data_len, offset)) return;
+
+        header = CommandsHeader::parse(header_buffer.get());
+        frame.reset();
+
+        auto current_depth = ctx.frames.get_back_depth();
+        if (header.depth != current_depth) {
+            ESP_LOGE("display_commands", "Commands depth %d does not match the current display depth %d", header.depth, current_depth);
+            return;
+        }
+
+        // commands sent to a group are drawn in its canvas coordinates
+        auto is_canvas = group && group->canvas_width != 0;
+        auto canvas_width = is_canvas ? group->canvas_width : ctx.inkplate.einkWidth();
+        auto canvas_height = is_canvas ? group->canvas_height : ctx.inkplate.einkHeight();
+        canvas.begin(ctx.frames.get_back_buffer(), header.depth, &ctx.frame_diff, canvas_width, canvas_height, is_canvas ? group->crop_x : 0, is_canvas ? group->crop_y : 0);
+        decoder.reset();
+        ctx.frames.set_back_hash(std::nullopt);
+        ctx.frame_diff.reset(header.depth);
+        frame.accept(header.depth);
+        frame_announced_hash.reset();
+    }
+
+    if (!frame.is_accepted(header.depth)) return;
+
+    if (!decoder.decode(data, data_len, canvas)) {
+        ESP_LOGE("display_commands", "Invalid draw command after %d commands", static_cast<int>(decoder.get_command_count()));
+        abort_frame();
+        return;
+    }
+
+    if (is_last_chunk(event)) {
+        if (!decoder.is_complete()) {
+            ESP_LOGE("display_commands", "Display list ends in the middle of a command");
+            abort_frame();
+            return;
+        }
+
+        if (header.flags & RegionHeader::FLAG_NO_REFRESH) {
+            ctx.frame_diff.finish();
+            abort_frame();
+            return;
+        }
+
+        ESP_LOGI("display_commands", "Drew %d commands", static_cast<int>(decoder.get_command_count()));
+        end_frame(ctx, header.flags & RegionHeader::FLAG_FULL_REFRESH ? RefreshKind::FULL : RefreshKind::PARTIAL);
+    }
+}
+
+/**
+ * Decodes a PNG or JPEG image into the back buffer as it streams in, dithered to the current display depth.
+ */
+void display_image(const TaskContext &ctx, const esp_mqtt_event_handle_t event, const ImageFormat format, const std::optional<PanelGroup> &group) {
+    static InkplateCanvas canvas(static_cast<int16_t>(ctx.inkplate.einkWidth()), static_cast<int16_t>(ctx.inkplate.einkHeight()));
+    ctx.frames.wait_until_restored();
+    ChunkTimer chunk_timer(event);
+
+    if (event->current_data_offset == 0) {
+        auto depth = ctx.frames.get_back_depth();
+        ctx.frames.set_back_hash(std::nullopt);
+        ctx.frame_diff.reset(depth);
+        frame.accept(depth);
+        frame_announced_hash.reset();
+
+        // images sent to a group cover its whole canvas
+        auto is_canvas = group && group->canvas_width != 0;
+        auto width = is_canvas ? group->canvas_width : ctx.inkplate.einkWidth();
+        auto height = is_canvas ? group->canvas_height : ctx.inkplate.einkHeight();
+        canvas.begin(ctx.frames.get_back_buffer(), depth, &ctx.frame_diff, width, height, is_canvas ? group->crop_x : 0, is_canvas ? group->crop_y : 0);
+        if (!image_decoder.begin(format, canvas, width, height, event->total_data_len)) {
+            abort_frame();
+            return;
+        }
+    }
+
+    if (frame.get_depth() == 0) return;
+
+    image_decoder.write(reinterpret_cast<const uint8_t *>(event->data), event->data_len);
+
+    if (is_last_chunk(event)) {
+        if (!image_decoder.finish()) {
+            abort_frame();
+            return;
+        }
+
+        end_frame(ctx);
+    }
+}
+
+struct AssetHeader {
+    static constexpr size_t SIZE = 6;
+
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+    uint8_t reserved;
+
+    static AssetHeader parse(const uint8_t *data) {
+        return {
+            .width = static_cast<uint16_t>(data[0] | data[1] << 8),
+            .height = static_cast<uint16_t>(data[2] | data[3] << 8),
+            .depth = data[4],
+            .reserved = data[5]
+        };
+    }
+};
+
+/**
+ * Stores an asset in flash as it streams in, an empty message removes it.
+ */
+void update_asset(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
+    static MessageHeader<AssetHeader::SIZE> header_buffer;
+    static bool is_uploading = false;
+    static std::optional<uint16_t> asset_id;
+
+    // only the first chunk carries the topic, the id is its second to last level, vsb-eink/{panelId}/assets/{id}/set
+    if (event->current_data_offset == 0) {
+        auto topic_id = get_topic_id(std::string_view(event->topic, event->topic_len), UINT16_MAX);
+        asset_id = topic_id ? std::optional<uint16_t>(static_cast<uint16_t>(*topic_id)) : std::nullopt;
+    }
+
+    if (!asset_id) {
+        if (event->current_data_offset == 0) ESP_LOGE("update_asset", "Asset id must be a number from 0 to %d", UINT16_MAX);
+        return;
+    }
+
+    if (event->total_data_len == 0) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.assets.erase(*asset_id));
+        publish_assets(ctx);
+        return;
+    }
+
+    auto data = reinterpret_cast<const uint8_t *>(event->data);
+    size_t data_len = event->data_len;
+    size_t offset = event->current_data_offset;
+
+    if (offset < AssetHeader::SIZE) {
+        if (!header_buffer.collect(data, data_len, offset)) return;
+
+        auto header = AssetHeader::parse(header_buffer.get());
+        is_uploading = false;
+        if (header.depth != 1 && header.depth != 4) {
+            ESP_LOGE("update_asset", "Asset depth must be 1 or 4, got %d", header.depth);
+            return;
+        }
+
+        auto expected_size = static_cast<int>(AssetHeader::SIZE + AssetStore::get_asset_size(header.width, header.height, header.depth));
+        if (event->total_data_len != expected_size) {
+            ESP_LOGE("update_asset", "Expected %d bytes, got %d bytes", expected_size, event->total_data_len);
+            return;
+        }
+
+        auto err = ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.assets.begin_upload(*asset_id, header.width, header.height, header.depth));
+        is_uploading = err == ESP_OK;
+    }
+
+    if (!is_uploading) return;
+
+    if (data_len > 0 && ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.assets.write_upload(data, data_len)) != ESP_OK) {
+        is_uploading = false;
+        return;
+    }
+
+    if (is_last_chunk(event)) {
+        is_uploading = false;
+        ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.assets.finish_upload());
+        publish_assets(ctx);
     }
 }
 
+struct ReadbackHeader {
+    static constexpr size_t SIZE = 14;
+    static constexpr uint8_t FLAG_COMPRESSED = 1 << 0;
+    static constexpr uint8_t FLAG_LAST = 1 << 1;
+
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+    uint8_t flags;
+    uint32_t offset;
+
+    void write(uint8_t *data) const {
+        data[0] = x & 0xff;
+        data[1] = x >> 8;
+        data[2] = y & 0xff;
+        data[3] = y >> 8;
+        data[4] = width & 0xff;
+        data[5] = width >> 8;
+        data[6] = height & 0xff;
+        data[7] = height >> 8;
+        data[8] = depth;
+        data[9] = flags;
+        data[10] = offset & 0xff;
+        data[11] = (offset >> 8) & 0xff;
+        data[12] = (offset >> 16) & 0xff;
+        data[13] = offset >> 24;
+    }
+};
+
+/**
+ * Publishes the newest frame, or a region of it, as a series of chunks converted to the wire format on the fly.
+ * Every chunk carries a header locating it within the region, compressed chunks are separate PackBits streams.
+ */
 void get_panel_display(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
-    using idf::mqtt::Message;
-    using idf::mqtt::QoS;
-    using idf::mqtt::Retain;
+    static constexpr size_t READBACK_CHUNK_SIZE = 4096;
+    static uint8_t chunk_buffer[READBACK_CHUNK_SIZE];
+    static uint8_t message_buffer[ReadbackHeader::SIZE + packbits_max_encoded_size(READBACK_CHUNK_SIZE)];
 
     auto panel_id = ctx.config.panel.panel_id;
     auto get_panel_display_topic = string_format("vsb-eink/%s/display", panel_id.c_str());
 
-    auto is_in_1bit_mode = ctx.inkplate.getDisplayMode() == DisplayMode::INKPLATE_1BIT;
-    auto is_in_3bit_mode = ctx.inkplate.getDisplayMode() == DisplayMode::INKPLATE_3BIT;
+    // the back buffer always holds the newest frame and is only ever written from the MQTT task, once restored
+    ctx.frames.wait_until_restored();
+    auto depth = ctx.frames.get_back_depth();
+    ReadbackHeader header{
+        .x = 0,
+        .y = 0,
+        .width = static_cast<uint16_t>(ctx.inkplate.einkWidth()),
+        .height = static_cast<uint16_t>(ctx.inkplate.einkHeight()),
+        .depth = static_cast<uint8_t>(depth),
+        .flags = 0,
+        .offset = 0
+    };
+    auto is_compressed = false;
 
-    uint8_t *frame_buffer = nullptr;
-    size_t frame_buffer_size = 0;
-    uint8_t *message_buffer = nullptr;
-    size_t message_buffer_size = 0;
+    // an empty request asks for the whole frame
+    if (event->data_len > 0) {
+        if (event->data_len != event->total_data_len) {
+            ESP_LOGE("get_panel_display", "Display request got a chunked response, which is not supported");
+            return;
+        }
+
+        auto request_json = cJSON_ParseWithLength(event->data, event->data_len);
+        if (!cJSON_IsObject(request_json)) {
+            ESP_LOGE("get_panel_display", "Invalid display request");
+            cJSON_Delete(request_json);
+            return;
+        }
 
-    if (is_in_1bit_mode) {
-        frame_buffer = ctx.inkplate._partial->get_data();
-        frame_buffer_size = ctx.inkplate._partial->get_data_size();
-        message_buffer_size = frame_buffer_size;
-        message_buffer = (uint8_t*)malloc(message_buffer_size * sizeof(uint8_t));
+        auto x_json = cJSON_GetObjectItem(request_json, "x");
+        auto y_json = cJSON_GetObjectItem(request_json, "y");
+        auto width_json = cJSON_GetObjectItem(request_json, "width");
+        auto height_json = cJSON_GetObjectItem(request_json, "height");
+        auto compression_json = cJSON_GetObjectItem(request_json, "compression");
 
-        for (int i = 0; i < frame_buffer_size; i++) {
-            message_buffer[i] = reverse_bits(frame_buffer[i]);
+        if (cJSON_IsNumber(x_json)) header.x = static_cast<uint16_t>(x_json->valueint);
+        if (cJSON_IsNumber(y_json)) header.y = static_cast<uint16_t>(y_json->valueint);
+        header.width = cJSON_IsNumber(width_json) ? static_cast<uint16_t>(width_json->valueint) : header.width - header.x;
+        header.height = cJSON_IsNumber(height_json) ? static_cast<uint16_t>(height_json->valueint) : header.height - header.y;
+        is_compressed = cJSON_IsString(compression_json) && strcmp(compression_json->valuestring, "rle") == 0;
+        cJSON_Delete(request_json);
+    }
+
+    auto pixels_per_byte = 8 / depth;
+    if (header.x % pixels_per_byte != 0 || header.width % pixels_per_byte != 0) {
+        ESP_LOGE("get_panel_display", "Region x and width must be multiples of %d", pixels_per_byte);
+        return;
+    }
+
+    if (header.width == 0 || header.height == 0
+        || header.x + header.width > ctx.inkplate.einkWidth()
+        || header.y + header.height > ctx.inkplate.einkHeight()) {
+        ESP_LOGE("get_panel_display", "Region %dx%d at %d,%d is out of bounds", header.width, header.height, header.x, header.y);
+        return;
+    }
+
+    FrameWindow window{
+        .frame_stride = static_cast<size_t>(ctx.inkplate.einkWidth() / pixels_per_byte),
+        .x = static_cast<size_t>(header.x / pixels_per_byte),
+        .y = header.y,
+        .stride = static_cast<size_t>(header.width / pixels_per_byte)
+    };
+    auto read = depth == 1 ? read_1bpp : read_4bpp;
+    size_t region_size = header.width * header.height / pixels_per_byte;
+
+    for (size_t offset = 0; offset < region_size; offset += READBACK_CHUNK_SIZE) {
+        auto chunk_len = std::min(READBACK_CHUNK_SIZE, region_size - offset);
+        auto is_last = offset + chunk_len == region_size;
+
+        header.offset = offset;
+        header.flags = (is_compressed ? ReadbackHeader::FLAG_COMPRESSED : 0) | (is_last ? ReadbackHeader::FLAG_LAST : 0);
+        header.write(message_buffer);
+
+        size_t message_len = ReadbackHeader::SIZE;
+        if (is_compressed) {
+            read_window(read, ctx.frames.get_back_buffer(), window, offset, chunk_buffer, chunk_len);
+            message_len += packbits_encode(chunk_buffer, chunk_len, message_buffer + ReadbackHeader::SIZE);
+        } else {
+            read_window(read, ctx.frames.get_back_buffer(), window, offset, message_buffer + ReadbackHeader::SIZE, chunk_len);
+            message_len += chunk_len;
         }
+
+        ctx.mqtt.publish(get_panel_display_topic, (char*)message_buffer, (char*)message_buffer + message_len);
     }
+}
 
-    if (is_in_3bit_mode) {
-        frame_buffer = ctx.inkplate.DMemory4Bit->get_data();
-        frame_buffer_size = ctx.inkplate.DMemory4Bit->get_data_size();
-        message_buffer_size = frame_buffer_size;
-        message_buffer = frame_buffer;
+/**
+ * Registers the handlers of the frame topics under the given prefix, either the panel or a group one.
+ * @param group Group the topics belong to, none for the panel topics
+ */
+static void register_display_handlers(const TaskContext &ctx, const std::string &topic_prefix, const std::optional<PanelGroup> &group) {
+    using idf::mqtt::Filter;
+    using idf::mqtt::QoS;
+
+    for (auto depth : {1, 4}) {
+        // the frame may also be sent to a subtopic named after its hash, see is_frame_current
+        auto update_display_raw_topic = string_format("%s/raw_%dbpp/set", topic_prefix.c_str(), depth);
+        for (const auto &topic : {update_display_raw_topic, update_display_raw_topic + "/+"}) {
+            ctx.mqtt.register_handler({
+                .filter = Filter(topic),
+                .qos = QoS::AtLeastOnce,
+                .callback = [&ctx, depth, group](const esp_mqtt_event_handle_t event) {
+                    display_raw(ctx, event, depth, group);
+                }
+            });
+        }
+
+        auto update_display_rle_topic = string_format("%s/rle_%dbpp/set", topic_prefix.c_str(), depth);
+        for (const auto &topic : {update_display_rle_topic, update_display_rle_topic + "/+"}) {
+            ctx.mqtt.register_handler({
+                .filter = Filter(topic),
+                .qos = QoS::AtLeastOnce,
+                .callback = [&ctx, depth, group](const esp_mqtt_event_handle_t event) {
+                    display_rle(ctx, event, depth, group);
+                }
+            });
+        }
     }
 
-    ctx.mqtt.publish(get_panel_display_topic, (char*)message_buffer, (char*)message_buffer + message_buffer_size);
+    ctx.mqtt.register_handler({
+        .filter = Filter(topic_prefix + "/region/set"),
+        .qos = QoS::AtLeastOnce,
+        .callback = [&ctx, group](const esp_mqtt_event_handle_t event) {
+            display_region(ctx, event, group);
+        }
+    });
 
-    if (is_in_1bit_mode) {
-        free(message_buffer);
+    for (auto [format, format_name] : {std::pair{ImageFormat::PNG, "png"}, std::pair{ImageFormat::JPEG, "jpeg"}}) {
+        ctx.mqtt.register_handler({
+            .filter = Filter(string_format("%s/%s/set", topic_prefix.c_str(), format_name)),
+            .qos = QoS::AtLeastOnce,
+            .callback = [&ctx, format, group](const esp_mqtt_event_handle_t event) {
+                display_image(ctx, event, format, group);
+            }
+        });
     }
+
+    ctx.mqtt.register_handler({
+        .filter = Filter(topic_prefix + "/commands/set"),
+        .qos = QoS::AtLeastOnce,
+        .callback = [&ctx, group](const esp_mqtt_event_handle_t event) {
+            display_commands(ctx, event, group);
+        }
+    });
 }
 
 void panel_task(const TaskContext &ctx) {
@@ -131,38 +827,58 @@ void panel_task(const TaskContext &ctx) {
     using idf::mqtt::Message;
     using idf::mqtt::QoS;
     using idf::mqtt::Retain;
-    using namespace std::chrono;
 
     auto panel_id = ctx.config.panel.panel_id;
 
+    auto refresh_thread_config = esp_pthread_get_default_config();
+    refresh_thread_config.thread_name = "frame_refresh";
+    refresh_thread_config.stack_size = 4096;
+    esp_pthread_set_cfg(&refresh_thread_config);
+    std::thread refresh_thread(&FramePipeline::run_refresh_loop, &ctx.frames);
+
+    auto decode_thread_config = esp_pthread_get_default_config();
+    decode_thread_config.thread_name = "image_decode";
+    decode_thread_config.stack_size = 4096;
+    esp_pthread_set_cfg(&decode_thread_config);
+    image_decoder.init();
+    std::thread decode_thread(&ImageDecoder::run_worker, &image_decoder);
+
     auto touchpad = InkplateTouchpad(
         ctx.inkplate,
+        ctx.frames.get_panel_mutex(),
         [&](const InkplateTouchpadEvent event) {
             auto btn_id = event.pad_id;
-            auto btn_action = event.event_type;
-            auto btn_action_str = btn_action == InkplateButton::ButtonState::PRESSED ? "pressed" : "released";
+            auto btn_action_str = InkplateButton::get_event_name(event.event_type);
 
             ESP_LOGI("panel_task", "Touchpad %d %s", btn_id, btn_action_str);
-            auto panel_touchpad_action_topic = string_format("vsb-eink/%s/touchpad/%d", panel_id.c_str(), btn_id);
-            ctx.mqtt.publish<std::string>(panel_touchpad_action_topic, {.data=btn_action_str,.retain=Retain::NotRetained});
-
-            auto panel_touchpad_pressed_topic = string_format("vsb-eink/%s/touchpad/%d/%s", panel_id.c_str(), btn_id, btn_action_str);
-            ctx.mqtt.publish<std::string>(panel_touchpad_pressed_topic, {.data="",.retain=Retain::NotRetained});
+            auto panel_touchpad_action_topic = string_format("vsb-eink/%s/touchpad/%d/%s", panel_id.c_str(), btn_id, btn_action_str);
+            ctx.mqtt.publish<std::string>(panel_touchpad_action_topic, {.data="",.retain=Retain::NotRetained});
         });
 
-    auto update_panel_display_raw_1bpp_topic = string_format("vsb-eink/%s/display/raw_1bpp/set", panel_id.c_str());
-    ctx.mqtt.register_handler({
-        .filter = Filter(update_panel_display_raw_1bpp_topic),
-        .callback = [&](const esp_mqtt_event_handle_t event) {
-            display_1bpp(ctx, event);
-        }
-    });
+    register_display_handlers(ctx, string_format("vsb-eink/%s/display", panel_id.c_str()), std::nullopt);
+    for (const auto &group : ctx.config.panel.groups) {
+        ESP_LOGI("panel_task", "Joining group %s", group.id);
+        register_display_handlers(ctx, string_format("vsb-eink/group/%s/display", group.id), group);
+    }
+
+    // deltas are made against the frame of a single panel, so groups only take whole frames
+    for (auto depth : {1, 4}) {
+        auto update_display_delta_topic = string_format("vsb-eink/%s/display/raw_%dbpp/delta/+", panel_id.c_str(), depth);
+        ctx.mqtt.register_handler({
+            .filter = Filter(update_display_delta_topic),
+            .qos = QoS::AtLeastOnce,
+            .callback = [&ctx, depth](const esp_mqtt_event_handle_t event) {
+                display_delta(ctx, event, depth);
+            }
+        });
+    }
 
-    auto update_panel_display_raw_4bpp_topic = string_format("vsb-eink/%s/display/raw_4bpp/set", panel_id.c_str());
+    auto update_asset_topic = string_format("vsb-eink/%s/assets/+/set", panel_id.c_str());
     ctx.mqtt.register_handler({
-        .filter = Filter(update_panel_display_raw_4bpp_topic),
+        .filter = Filter(update_asset_topic),
+        .qos = QoS::AtLeastOnce,
         .callback = [&](const esp_mqtt_event_handle_t event) {
-            display_4bpp(ctx, event);
+            update_asset(ctx, event);
         }
     });
 
@@ -173,13 +889,13 @@ void panel_task(const TaskContext &ctx) {
             get_panel_display(ctx, event);
         }
     });
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.mqtt.release_connection());
 
-    DebounceTimer touchpad_debounce_timer(milliseconds(100));
-    for (;;) {
-        if (touchpad_debounce_timer.tick()) {
-            touchpad.update();
-        }
+    // the restore drives the panel through the I/O expander the touchpad is wired to
+    ctx.frames.wait_until_restored();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(touchpad.begin());
+    publish_display_hash(ctx);
+    publish_assets(ctx);
 
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-    }
+    touchpad.run_event_loop();
 }
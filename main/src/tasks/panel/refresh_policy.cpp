@@ -0,0 +1,114 @@
+#include "refresh_policy.h"
+
+#include <algorithm>
+
+RefreshPolicy::RefreshPolicy(const int width, const int height):
+        width{width},
+        height{height},
+        columns{(width + TILE_SIZE - 1) / TILE_SIZE},
+        rows{(height + TILE_SIZE - 1) / TILE_SIZE},
+        config{},
+        tile_scores(columns * rows, 0),
+        tile_flips(columns * rows, 0),
+        regions{} {}
+
+void RefreshPolicy::set_config(const RefreshPolicyConfig &config) {
+    std::lock_guard lock(config_mutex);
+    this->config = config;
+}
+
+int RefreshPolicy::get_tile_pixels(const int tile) const {
+    auto x = tile % columns * TILE_SIZE;
+    auto y = tile / columns * TILE_SIZE;
+    return std::min(TILE_SIZE, width - x) * std::min(TILE_SIZE, height - y);
+}
+
+RefreshDecision RefreshPolicy::decide(const uint8_t *current_frame, const uint8_t *next_frame, const bool is_full_requested) {
+    RefreshPolicyConfig config;
+    {
+        std::lock_guard lock(config_mutex);
+        config = this->config;
+    }
+
+    regions.clear();
+    if (is_full_requested) {
+        reset();
+        return RefreshDecision::FULL;
+    }
+
+    // count the flipped pixels of every tile, rows of a 1-bit frame are packed 8 pixels per byte
+    std::fill(tile_flips.begin(), tile_flips.end(), 0);
+    auto stride = width / 8;
+    for (int y = 0; y < height; y++) {
+        auto *tile_row_flips = tile_flips.data() + y / TILE_SIZE * columns;
+        auto row_offset = y * stride;
+        for (int column = 0; column < stride; column++) {
+            auto flipped = current_frame[row_offset + column] ^ next_frame[row_offset + column];
+            if (flipped == 0) continue;
+            tile_row_flips[column * 8 / TILE_SIZE] += __builtin_popcount(flipped);
+        }
+    }
+
+    int ghosted_pixels = 0;
+    for (int tile = 0; tile < columns * rows; tile++) {
+        if (tile_flips[tile] == 0) continue;
+
+        tile_scores[tile] += config.partial_update_cost + tile_flips[tile] * 100 / get_tile_pixels(tile);
+        if (tile_scores[tile] >= config.ghosting_threshold) {
+            ghosted_pixels += get_tile_pixels(tile);
+        }
+    }
+
+    if (ghosted_pixels == 0) {
+        return RefreshDecision::PARTIAL;
+    }
+
+    if (ghosted_pixels * 100 >= width * height * config.full_refresh_ratio) {
+        reset();
+        return RefreshDecision::FULL;
+    }
+
+    // merge horizontally adjacent ghosted tiles into regions and let them start over
+    for (int row = 0; row < rows; row++) {
+        int run_start = -1;
+        for (int column = 0; column <= columns; column++) {
+            auto tile = row * columns + column;
+            auto is_ghosted = column < columns && tile_scores[tile] >= config.ghosting_threshold;
+            if (is_ghosted) {
+                tile_scores[tile] = 0;
+                if (run_start < 0) run_start = column;
+                continue;
+            }
+            if (run_start < 0) continue;
+
+            auto x = run_start * TILE_SIZE;
+            auto y = row * TILE_SIZE;
+            regions.push_back({
+                .x = x,
+                .y = y,
+                .width = std::min(column * TILE_SIZE, width) - x,
+                .height = std::min(TILE_SIZE, height - y)
+            });
+            run_start = -1;
+        }
+    }
+
+    return RefreshDecision::REGION;
+}
+
+void RefreshPolicy::reset() {
+    std::fill(tile_scores.begin(), tile_scores.end(), 0);
+}
+
+const std::vector<DirtyRect> &RefreshPolicy::get_regions() const {
+    return regions;
+}
+
+const char *RefreshPolicy::get_decision_name(const RefreshDecision decision) {
+    switch (decision) {
+        case RefreshDecision::PARTIAL: return "partial";
+        case RefreshDecision::REGION: return "region";
+        case RefreshDecision::FULL: return "full";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "config.h"
+#include "drivers/inkplate_frame_diff.h"
+
+enum class RefreshDecision {
+    // only the changed pixels are driven
+    PARTIAL,
+    // the changed pixels are driven and the most ghosted regions get cleaned by flipping them back and forth
+    REGION,
+    // the whole panel is cleared and redrawn
+    FULL,
+    COUNT
+};
+
+/**
+ * Decides how to refresh the panel in 1-bit mode based on the ghosting accumulated by partial updates.
+ * The panel is split into tiles, each partial update adds a fixed cost plus the percentage of flipped pixels
+ * to the score of every tile it touches. Tiles over the threshold are cleaned with a region refresh, unless
+ * they cover so much of the panel that a full refresh is the better deal. Cleaned tiles start over from zero.
+ */
+class RefreshPolicy {
+public:
+    RefreshPolicy(int width, int height);
+
+    void set_config(const RefreshPolicyConfig &config);
+    RefreshDecision decide(const uint8_t *current_frame, const uint8_t *next_frame, bool is_full_requested);
+    void reset();
+
+    [[nodiscard]] const std::vector<DirtyRect> &get_regions() const;
+
+    static const char *get_decision_name(RefreshDecision decision);
+private:
+    static constexpr int TILE_SIZE = 64;
+
+    [[nodiscard]] int get_tile_pixels(int tile) const;
+
+    const int width;
+    const int height;
+    const int columns;
+    const int rows;
+
+    std::mutex config_mutex;
+    RefreshPolicyConfig config;
+
+    std::vector<uint32_t> tile_scores;
+    std::vector<uint32_t> tile_flips;
+    std::vector<DirtyRect> regions;
+};
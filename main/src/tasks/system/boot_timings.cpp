@@ -0,0 +1,29 @@
+#include "boot_timings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+BootTimings::BootTimings(): finished_at{} {}
+
+void BootTimings::mark(const BootPhase phase) {
+    auto now = esp_timer_get_time();
+    finished_at[to_underlying(phase)] = now;
+    ESP_LOGI("BootTimings", "Boot phase %s finished at %d ms", get_phase_name(phase), static_cast<int>(now / 1000));
+}
+
+std::optional<int64_t> BootTimings::get(const BootPhase phase) const {
+    auto at = finished_at[to_underlying(phase)].load();
+    if (at == 0) return std::nullopt;
+    return at;
+}
+
+const char *BootTimings::get_phase_name(const BootPhase phase) {
+    switch (phase) {
+        case BootPhase::INKPLATE: return "inkplate";
+        case BootPhase::CONFIG: return "config";
+        case BootPhase::WIFI: return "wifi";
+        case BootPhase::MQTT: return "mqtt";
+        case BootPhase::FRAME: return "frame";
+        default: return "unknown";
+    }
+}
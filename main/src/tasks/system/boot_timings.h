@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+#include "utils.h"
+
+enum class BootPhase {
+    // Inkplate peripherals initialized
+    INKPLATE,
+    // config loaded from NVS
+    CONFIG,
+    // Wi-Fi connected and got an IP address
+    WIFI,
+    // connected to the MQTT broker
+    MQTT,
+    // last frame restored on the panel
+    FRAME,
+    COUNT
+};
+
+/**
+ * Times at which the boot phases finished, the phases run concurrently and may finish in any order.
+ */
+class BootTimings {
+public:
+    BootTimings();
+
+    void mark(BootPhase phase);
+    std::optional<int64_t> get(BootPhase phase) const;
+
+    static const char *get_phase_name(BootPhase phase);
+private:
+    // esp_timer microseconds since boot, 0 while the phase has not finished
+    std::array<std::atomic<int64_t>, to_underlying(BootPhase::COUNT)> finished_at;
+};
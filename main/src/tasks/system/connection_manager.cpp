@@ -0,0 +1,228 @@
+#include "connection_manager.h"
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "power.h"
+#include "utils.h"
+
+static constexpr auto *TAG = "connection_manager";
+
+ConnectionManager::ConnectionManager(Config &config, WifiClient &wifi, MQTTClient &mqtt, BootTimings &boot_timings):
+        config{config},
+        wifi{wifi},
+        mqtt{mqtt},
+        boot_timings{boot_timings},
+        is_changed{false},
+        wifi_backoff(BASE_DELAY, MAX_DELAY),
+        mqtt_backoff(BASE_DELAY, MAX_DELAY),
+        wifi_target{config.wifi_cache ? WifiTarget::CACHED_AP : WifiTarget::NETWORK},
+        mqtt_target{MqttTarget::BROKER},
+        has_wifi_connected{false},
+        has_mqtt_connected{false},
+        is_wifi_up{false},
+        is_mqtt_up{false},
+        outage_started_at{},
+        outages{0},
+        last_outage_us{0},
+        total_outage_us{0} {
+    wifi.set_status_callback([this] { notify(); });
+    mqtt.set_status_callback([this] { notify(); });
+}
+
+void ConnectionManager::notify() {
+    {
+        std::lock_guard lock(change_mutex);
+        is_changed = true;
+    }
+    changed.notify_one();
+}
+
+void ConnectionManager::wait_for_change() {
+    std::unique_lock lock(change_mutex);
+    changed.wait(lock, [this] { return is_changed; });
+    is_changed = false;
+}
+
+void ConnectionManager::wait_for_retry(ReconnectBackoff &backoff) {
+    auto delay = backoff.next_delay(esp_random());
+    ESP_LOGI(TAG, "Retrying in %d ms, attempt %d", static_cast<int>(delay.count()), backoff.get_attempts());
+    std::this_thread::sleep_for(delay);
+}
+
+/**
+ * Expects the connection to the network started during boot to be in progress already.
+ */
+void ConnectionManager::run() {
+    for (;;) {
+        {
+            std::lock_guard lock(change_mutex);
+            is_changed = false;
+        }
+
+        if (!ensure_wifi()) continue;
+        if (!ensure_mqtt()) continue;
+
+        end_outage();
+        wait_for_change();
+    }
+}
+
+/**
+ * Waits for the connection attempt in progress, starting the next one after a while if it fails.
+ * @return true once connected
+ */
+bool ConnectionManager::ensure_wifi() {
+    if (is_wifi_up && wifi.get_status() != WifiClient::CONNECTED) {
+        is_wifi_up = false;
+        is_mqtt_up = false;
+        begin_outage();
+
+        // the client would otherwise keep on retrying on its own without a network
+        if (mqtt.is_connection_released()) ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt.stop());
+    }
+
+    auto status = wifi.wait_for_connection(WIFI_CONNECT_TIMEOUT);
+    if (status == WifiClient::CONNECTED) {
+        if (!is_wifi_up) on_wifi_connected();
+        return true;
+    }
+
+    wait_for_retry(wifi_backoff);
+
+    // the cached access point gets a single chance per round, it may have moved to another channel
+    wifi_target = static_cast<WifiTarget>((to_underlying(wifi_target) + 1) % to_underlying(WifiTarget::COUNT));
+    if (wifi_target == WifiTarget::CACHED_AP && !config.wifi_cache) wifi_target = WifiTarget::NETWORK;
+
+    switch (wifi_target) {
+        case WifiTarget::CACHED_AP:
+            ESP_LOGI(TAG, "Trying to connect to %s", config.wifi.ssid.c_str());
+            ESP_ERROR_CHECK_WITHOUT_ABORT(wifi.connect(config.wifi, config.wifi_cache, config.ip));
+            break;
+        case WifiTarget::NETWORK:
+            ESP_LOGI(TAG, "Scanning for %s", config.wifi.ssid.c_str());
+            ESP_ERROR_CHECK_WITHOUT_ABORT(wifi.connect(config.wifi, std::nullopt, config.ip));
+            break;
+        default:
+            ESP_LOGW(TAG, "Using fallback network config %s", config.wifi_fallback.ssid.c_str());
+            ESP_ERROR_CHECK_WITHOUT_ABORT(wifi.connect(config.wifi_fallback, std::nullopt, {}));
+            break;
+    }
+    return false;
+}
+
+void ConnectionManager::on_wifi_connected() {
+    is_wifi_up = true;
+    wifi_backoff.reset();
+
+    if (wifi_target == WifiTarget::FALLBACK_NETWORK) {
+        ESP_LOGI(TAG, "Connected to fallback SSID %s", config.wifi_fallback.ssid.c_str());
+        ESP_LOGI(TAG, "Rolling back to fallback network config for future connections");
+        config.rollback_wifi_config();
+    }
+    wifi_target = config.wifi_cache ? WifiTarget::CACHED_AP : WifiTarget::NETWORK;
+
+    // remember the access point, so the next connection can join it without scanning
+    auto connected_ap = wifi.get_connected_ap();
+    if (connected_ap && connected_ap != config.wifi_cache) {
+        config.set_wifi_cache(connected_ap);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(config.commit_wifi_cache());
+    }
+    ESP_LOGI(TAG, "Connected to %s", config.wifi.ssid.c_str());
+
+    if (!has_wifi_connected) {
+        has_wifi_connected = true;
+        boot_timings.mark(BootPhase::WIFI);
+        configure_power_management(config.sleep);
+
+        // the broker is connected to once there is a network, see MQTTClient::defer_connection
+        ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt.release_connection());
+    } else if (mqtt.is_connection_released() && mqtt.get_status() == MQTTClient::FAILED) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt.start());
+    }
+}
+
+/**
+ * Waits for the connection attempt in progress, starting the next one after a while if it fails.
+ * @return true once connected
+ */
+bool ConnectionManager::ensure_mqtt() {
+    // the panel and system tasks may still be registering their handlers
+    if (!mqtt.is_connection_released()) {
+        wait_for_change();
+        return false;
+    }
+
+    auto status = mqtt.wait_for_connection(MQTT_CONNECT_TIMEOUT);
+    if (status == MQTTClient::CONNECTED) {
+        if (!is_mqtt_up) on_mqtt_connected();
+        return true;
+    }
+
+    is_mqtt_up = false;
+    begin_outage();
+    // the client retries on its own at a fixed interval, which would make all panels come back at once
+    ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt.stop());
+    wait_for_retry(mqtt_backoff);
+    if (wifi.get_status() != WifiClient::CONNECTED) return false;
+
+    mqtt_target = static_cast<MqttTarget>((to_underlying(mqtt_target) + 1) % to_underlying(MqttTarget::COUNT));
+    if (mqtt_target == MqttTarget::BROKER) {
+        ESP_LOGI(TAG, "Trying to connect to %s", config.mqtt.broker_url.c_str());
+        mqtt.set_uri(config.mqtt.broker_url);
+    } else {
+        ESP_LOGW(TAG, "Using fallback MQTT broker config %s", config.mqtt_fallback.broker_url.c_str());
+        mqtt.set_uri(config.mqtt_fallback.broker_url);
+    }
+    ESP_ERROR_CHECK_WITHOUT_ABORT(mqtt.start());
+    return false;
+}
+
+void ConnectionManager::on_mqtt_connected() {
+    is_mqtt_up = true;
+    mqtt_backoff.reset();
+
+    if (mqtt_target == MqttTarget::FALLBACK_BROKER) {
+        ESP_LOGI(TAG, "Connected to fallback MQTT broker");
+        ESP_LOGI(TAG, "Rolling back to fallback MQTT broker for future connections");
+        config.rollback_mqtt_config();
+        mqtt_target = MqttTarget::BROKER;
+    }
+    ESP_LOGI(TAG, "Connected to MQTT broker");
+
+    if (!has_mqtt_connected) {
+        has_mqtt_connected = true;
+        boot_timings.mark(BootPhase::MQTT);
+    }
+}
+
+void ConnectionManager::begin_outage() {
+    if (!has_mqtt_connected || outage_started_at) return;
+
+    ESP_LOGW(TAG, "Connection lost");
+    outage_started_at = esp_timer_get_time();
+    outages++;
+}
+
+void ConnectionManager::end_outage() {
+    if (!outage_started_at) return;
+
+    auto outage_us = esp_timer_get_time() - *outage_started_at;
+    outage_started_at.reset();
+    last_outage_us = outage_us;
+    total_outage_us += outage_us;
+    ESP_LOGI(TAG, "Connection restored after %d ms", static_cast<int>(outage_us / 1000));
+}
+
+uint32_t ConnectionManager::get_outages() const {
+    return outages;
+}
+
+int64_t ConnectionManager::get_last_outage_us() const {
+    return last_outage_us;
+}
+
+int64_t ConnectionManager::get_total_outage_us() const {
+    return total_outage_us;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "config.h"
+#include "eink_mqtt.h"
+#include "wifi.h"
+#include "boot_timings.h"
+#include "reconnect_backoff.h"
+
+/**
+ * Keeps the panel connected to Wi-Fi and the MQTT broker. Whenever either connection is lost, it retries with
+ * an exponential backoff, alternating between the configured and the fallback networks and brokers, while the
+ * panel keeps showing its frame. A fallback which works replaces the configured one for future connections,
+ * the same way as during boot.
+ */
+class ConnectionManager {
+public:
+    ConnectionManager(Config &config, WifiClient &wifi, MQTTClient &mqtt, BootTimings &boot_timings);
+    ConnectionManager(ConnectionManager const&) = delete;
+    void operator=(ConnectionManager const&) = delete;
+
+    [[noreturn]] void run();
+
+    [[nodiscard]] uint32_t get_outages() const;
+    [[nodiscard]] int64_t get_last_outage_us() const;
+    [[nodiscard]] int64_t get_total_outage_us() const;
+private:
+    static constexpr auto WIFI_CONNECT_TIMEOUT = std::chrono::seconds(10);
+    static constexpr auto MQTT_CONNECT_TIMEOUT = std::chrono::seconds(15);
+    static constexpr auto BASE_DELAY = std::chrono::seconds(1);
+    static constexpr auto MAX_DELAY = std::chrono::minutes(5);
+
+    // networks tried in turn, the cached access point only if there is one
+    enum class WifiTarget {
+        CACHED_AP,
+        NETWORK,
+        FALLBACK_NETWORK,
+        COUNT
+    };
+
+    enum class MqttTarget {
+        BROKER,
+        FALLBACK_BROKER,
+        COUNT
+    };
+
+    void notify();
+    void wait_for_change();
+    void wait_for_retry(ReconnectBackoff &backoff);
+    bool ensure_wifi();
+    bool ensure_mqtt();
+    void on_wifi_connected();
+    void on_mqtt_connected();
+    void begin_outage();
+    void end_outage();
+
+    Config &config;
+    WifiClient &wifi;
+    MQTTClient &mqtt;
+    BootTimings &boot_timings;
+
+    std::mutex change_mutex;
+    std::condition_variable changed;
+    bool is_changed;
+
+    ReconnectBackoff wifi_backoff;
+    ReconnectBackoff mqtt_backoff;
+    WifiTarget wifi_target;
+    MqttTarget mqtt_target;
+    bool has_wifi_connected;
+    bool has_mqtt_connected;
+    // the connection state as last seen, the clients may have lost it in the meantime
+    bool is_wifi_up;
+    bool is_mqtt_up;
+
+    // an outage lasts from losing the broker until getting it back, the boot itself does not count
+    std::optional<int64_t> outage_started_at;
+    std::atomic<uint32_t> outages;
+    std::atomic<int64_t> last_outage_us;
+    std::atomic<int64_t> total_outage_us;
+};
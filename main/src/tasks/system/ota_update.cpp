@@ -0,0 +1,208 @@
+#include "ota_update.h"
+
+#include <cstring>
+#include <thread>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_app_desc.h>
+#include <esp_crt_bundle.h>
+#include <esp_http_client.h>
+#include <esp_https_ota.h>
+#include <esp_log.h>
+#include <esp_pthread.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <sdkconfig.h>
+
+static constexpr auto *TAG = "ota_update";
+
+OtaUpdater::OtaUpdater(MQTTClient &mqtt, std::string status_topic):
+        mqtt{mqtt},
+        status_topic{std::move(status_topic)},
+        request{},
+        is_request_valid{false},
+        is_running{false} {}
+
+void OtaUpdater::on_data(const esp_mqtt_event_handle_t event) {
+    if (event->current_data_offset == 0) {
+        request.clear();
+        is_request_valid = event->total_data_len <= MAX_REQUEST_SIZE;
+        if (!is_request_valid) {
+            ESP_LOGE(TAG, "OTA update request of %d bytes is too large", event->total_data_len);
+            publish_status("failed", 0, 0, 0, "request too large");
+            return;
+        }
+        request.reserve(event->total_data_len);
+    }
+
+    if (!is_request_valid) return;
+
+    request.append(event->data, event->data_len);
+    if (event->current_data_offset + event->data_len != event->total_data_len) return;
+
+    auto options = parse_request();
+    if (!options) {
+        ESP_LOGE(TAG, "Invalid OTA update request");
+        publish_status("failed", 0, 0, 0, "invalid request");
+        return;
+    }
+
+    if (is_running.exchange(true)) {
+        ESP_LOGW(TAG, "OTA update is already in progress, ignoring request");
+        publish_status("failed", 0, 0, 0, "update already in progress");
+        return;
+    }
+
+    // TLS and the flash writes need far more stack than the default pthread one
+    auto ota_thread_config = esp_pthread_get_default_config();
+    ota_thread_config.thread_name = "ota_update";
+    ota_thread_config.stack_size = 8192;
+    esp_pthread_set_cfg(&ota_thread_config);
+
+    std::thread([this, options = *options]() {
+        run(options);
+        is_running = false;
+    }).detach();
+}
+
+bool OtaUpdater::is_update_running() const {
+    return is_running;
+}
+
+std::optional<OtaUpdateOptions> OtaUpdater::parse_request() const {
+    OtaUpdateOptions options{
+        .url = {},
+        .buffer_size = CONFIG_VSB_EINK_OTA_BUFFER_SIZE,
+        .buffer_size_tx = CONFIG_VSB_EINK_OTA_BUFFER_SIZE_TX
+    };
+
+    // a plain URL is still accepted as the whole request
+    if (request.empty() || request.front() != '{') {
+        if (request.empty()) return std::nullopt;
+        options.url = request;
+        return options;
+    }
+
+    auto request_json = cJSON_ParseWithLength(request.c_str(), request.size());
+    if (!cJSON_IsObject(request_json)) {
+        cJSON_Delete(request_json);
+        return std::nullopt;
+    }
+
+    auto url_json = cJSON_GetObjectItem(request_json, "url");
+    auto buffer_size_json = cJSON_GetObjectItem(request_json, "bufferSize");
+    auto buffer_size_tx_json = cJSON_GetObjectItem(request_json, "bufferSizeTx");
+
+    if (cJSON_IsString(url_json)) options.url = url_json->valuestring;
+    if (cJSON_IsNumber(buffer_size_json)) options.buffer_size = buffer_size_json->valueint;
+    if (cJSON_IsNumber(buffer_size_tx_json)) options.buffer_size_tx = buffer_size_tx_json->valueint;
+    cJSON_Delete(request_json);
+
+    if (options.url.empty() || options.buffer_size < 512 || options.buffer_size_tx < 512) {
+        return std::nullopt;
+    }
+
+    return options;
+}
+
+void OtaUpdater::run(const OtaUpdateOptions &options) {
+    esp_http_client_config_t config = {};
+    config.url = options.url.c_str();
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+    config.buffer_size = options.buffer_size;
+    config.buffer_size_tx = options.buffer_size_tx;
+    config.keep_alive_enable = true;
+
+    esp_https_ota_config_t ota_config = {};
+    ota_config.http_config = &config;
+
+    ESP_LOGI(TAG, "Starting OTA update from %s", options.url.c_str());
+    auto started_at = esp_timer_get_time();
+    publish_status("started");
+
+    esp_https_ota_handle_t ota_handle = nullptr;
+    auto err = esp_https_ota_begin(&ota_config, &ota_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start OTA update: %s", esp_err_to_name(err));
+        publish_status("failed", 0, 0, 0, esp_err_to_name(err));
+        return;
+    }
+
+    // refuse images of other projects before downloading them completely
+    esp_app_desc_t image_description;
+    err = esp_https_ota_get_img_desc(ota_handle, &image_description);
+    if (err != ESP_OK || strncmp(image_description.project_name, esp_app_get_description()->project_name, sizeof(image_description.project_name)) != 0) {
+        ESP_LOGE(TAG, "OTA image does not belong to this project");
+        esp_https_ota_abort(ota_handle);
+        publish_status("failed", 0, 0, 0, "image of another project");
+        return;
+    }
+    ESP_LOGI(TAG, "Downloading firmware version %s", image_description.version);
+
+    auto total_bytes = esp_https_ota_get_image_size(ota_handle);
+    auto last_progress_at = esp_timer_get_time();
+    for (;;) {
+        err = esp_https_ota_perform(ota_handle);
+        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS) break;
+
+        auto now = esp_timer_get_time();
+        if (now - last_progress_at >= PROGRESS_INTERVAL_US) {
+            last_progress_at = now;
+            publish_status("downloading", esp_https_ota_get_image_len_read(ota_handle), total_bytes, now - started_at);
+        }
+    }
+
+    auto bytes_written = esp_https_ota_get_image_len_read(ota_handle);
+    auto elapsed_us = esp_timer_get_time() - started_at;
+    if (err != ESP_OK || !esp_https_ota_is_complete_data_received(ota_handle)) {
+        ESP_LOGE(TAG, "OTA download failed: %s", esp_err_to_name(err));
+        esp_https_ota_abort(ota_handle);
+        publish_status("failed", bytes_written, total_bytes, elapsed_us, err != ESP_OK ? esp_err_to_name(err) : "incomplete image");
+        return;
+    }
+
+    // finishing validates the image (including its signature) before it is marked as bootable
+    publish_status("verifying", bytes_written, total_bytes, elapsed_us);
+    err = esp_https_ota_finish(ota_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "OTA image validation failed: %s", esp_err_to_name(err));
+        publish_status("failed", bytes_written, total_bytes, elapsed_us, esp_err_to_name(err));
+        return;
+    }
+
+    ESP_LOGI(TAG, "OTA update successful, rebooting");
+    publish_status("success", bytes_written, total_bytes, esp_timer_get_time() - started_at);
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    esp_restart();
+}
+
+void OtaUpdater::publish_status(const char *state, const int bytes_written, const int total_bytes, const int64_t elapsed_us, const char *error) {
+    using idf::mqtt::Retain;
+
+    auto status_json = cJSON_CreateObject();
+    cJSON_AddStringToObject(status_json, "state", state);
+    cJSON_AddNumberToObject(status_json, "bytesWritten", bytes_written);
+    if (total_bytes > 0) {
+        cJSON_AddNumberToObject(status_json, "totalBytes", total_bytes);
+    }
+
+    if (elapsed_us > 0 && bytes_written > 0) {
+        auto throughput = static_cast<double>(bytes_written) * 1000 * 1000 / static_cast<double>(elapsed_us);
+        cJSON_AddNumberToObject(status_json, "throughput", static_cast<int>(throughput));
+        if (total_bytes > bytes_written) {
+            cJSON_AddNumberToObject(status_json, "eta", static_cast<int>((total_bytes - bytes_written) / throughput));
+        }
+    }
+
+    if (error != nullptr) {
+        cJSON_AddStringToObject(status_json, "error", error);
+    }
+
+    auto status_json_str = cJSON_PrintUnformatted(status_json);
+    mqtt.publish<std::string>(status_topic, { .data = status_json_str, .retain = Retain::Retained });
+
+    cJSON_Delete(status_json);
+    free(status_json_str);
+}
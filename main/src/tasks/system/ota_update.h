@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "eink_mqtt.h"
+
+struct OtaUpdateOptions {
+    std::string url;
+    int buffer_size;
+    int buffer_size_tx;
+};
+
+/**
+ * Downloads and installs firmware updates requested over MQTT.
+ * The request may arrive in any number of chunks, the download itself runs on a separate thread and
+ * reports its progress to the firmware update status topic, so the MQTT task is never blocked by it.
+ */
+class OtaUpdater {
+public:
+    OtaUpdater(MQTTClient &mqtt, std::string status_topic);
+
+    void on_data(const esp_mqtt_event_handle_t event);
+    [[nodiscard]] bool is_update_running() const;
+private:
+    static constexpr size_t MAX_REQUEST_SIZE = 2048;
+    static constexpr int64_t PROGRESS_INTERVAL_US = 1000 * 1000;
+
+    std::optional<OtaUpdateOptions> parse_request() const;
+    void run(const OtaUpdateOptions &options);
+    void publish_status(const char *state, int bytes_written = 0, int total_bytes = 0, int64_t elapsed_us = 0, const char *error = nullptr);
+
+    MQTTClient &mqtt;
+    const std::string status_topic;
+    std::string request;
+    bool is_request_valid;
+    std::atomic<bool> is_running;
+};
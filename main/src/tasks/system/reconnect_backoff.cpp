@@ -0,0 +1,28 @@
+#include "reconnect_backoff.h"
+
+#include <algorithm>
+
+ReconnectBackoff::ReconnectBackoff(const std::chrono::milliseconds base_delay, const std::chrono::milliseconds max_delay):
+        base_delay{base_delay},
+        max_delay{max_delay},
+        attempts{0} {}
+
+/**
+ * Counts a failed attempt and tells how long to wait before the next one.
+ * @param random Uniformly distributed random number, e.g. from esp_random
+ */
+std::chrono::milliseconds ReconnectBackoff::next_delay(const uint32_t random) {
+    auto delay = std::min<int64_t>(base_delay.count() << std::min(attempts, MAX_DOUBLINGS), max_delay.count());
+    attempts++;
+
+    auto half_delay = delay / 2;
+    return std::chrono::milliseconds(delay - half_delay + random % (half_delay + 1));
+}
+
+void ReconnectBackoff::reset() {
+    attempts = 0;
+}
+
+int ReconnectBackoff::get_attempts() const {
+    return attempts;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Exponential backoff with jitter for reconnection attempts. Every failed attempt doubles the delay up to a limit,
+ * and the actual delay is picked at random from the upper half of it. Panels losing the same broker or access point
+ * at once thus spread out their attempts instead of all coming back at the same moment.
+ */
+class ReconnectBackoff {
+public:
+    ReconnectBackoff(std::chrono::milliseconds base_delay, std::chrono::milliseconds max_delay);
+
+    std::chrono::milliseconds next_delay(uint32_t random);
+    void reset();
+    [[nodiscard]] int get_attempts() const;
+private:
+    // enough doublings to reach any sensible limit, more would overflow
+    static constexpr int MAX_DOUBLINGS = 20;
+
+    const std::chrono::milliseconds base_delay;
+    const std::chrono::milliseconds max_delay;
+    int attempts;
+};
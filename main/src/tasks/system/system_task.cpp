@@ -1,74 +1,113 @@
 #include "system_task.h"
 
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_wifi.h>
 #include <esp_wifi_types.h>
 #include <esp_log.h>
-#include <esp_http_client.h>
-#include <esp_https_ota.h>
-#include <esp_crt_bundle.h>
+#include <esp_netif.h>
+#include <esp_partition.h>
+#include <esp_sleep.h>
 #include <cJSON.h>
 
+#include "drivers/inkplate_touchpad.h"
+#include "ota_update.h"
+#include "power.h"
 #include "utils.h"
 
 static constexpr auto *TAG = "system_task";
 
+// a week, longer intervals are more likely a mistake than a plan
+static constexpr int MAX_DEEP_SLEEP_INTERVAL = 7 * 24 * 60 * 60;
+// a panel awake for less would hardly receive anything before falling asleep again
+static constexpr int MIN_AWAKE_TIME = 10;
+
 void reboot_handler(const esp_mqtt_event_handle_t event) {
     ESP_LOGI(TAG, "Rebooting...");
     esp_restart();
 }
 
-void perform_ota_update_handler(const esp_mqtt_event_handle_t event) {
-    auto data = event->data;
-    auto data_len = event->data_len;
-    auto total_data_len = event->total_data_len;
-
-    if (data_len != total_data_len) {
-        ESP_LOGE(TAG, "OTA update got a chunked response, which is not yet supported");
-        return;
-    }
-
-    esp_http_client_config_t config = {};
-
-    std::string data_str(data, data_len);
-    config.url = data_str.c_str();
-    config.crt_bundle_attach = esp_crt_bundle_attach;
-    config.buffer_size = 1024 * 2;
-    config.buffer_size_tx = 1024;
-
-    esp_https_ota_config_t ota_config = {};
-    ota_config.http_config = &config;
-
-    ESP_LOGI(TAG, "Starting OTA update from %s", data);
-    esp_err_t ret = esp_https_ota(&ota_config);
-
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "OTA update successful, rebooting");
-        esp_restart();
-    } else {
-        ESP_LOGE(TAG, "Firmware upgrade failed");
-    }
+/**
+ * Version of the partition table the panel was flashed with. Version 2 trades the factory app for the frame cache
+ * and asset partitions, which can only be added by reflashing the panel over serial.
+ */
+static int get_partition_table_version() {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "frames") != nullptr ? 2 : 1;
 }
 
 void publish_system_status(const TaskContext &ctx) {
     using idf::mqtt::Retain;
 
-    wifi_ap_record_t ap_info;
-    esp_wifi_sta_get_ap_info(&ap_info);
+    // the status is also published while reconnecting, when there is no access point to report
+    wifi_ap_record_t ap_info{};
+    auto is_associated = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
     auto panel_system_status_topic = string_format("vsb-eink/%s/system", ctx.config.panel.panel_id.c_str());
 
     auto system_status_json = cJSON_CreateObject();
 
     auto system_status_wifi_json = cJSON_CreateObject();
-    cJSON_AddStringToObject(system_status_wifi_json, "ssid", reinterpret_cast<const char *>(ap_info.ssid));
-    cJSON_AddNumberToObject(system_status_wifi_json, "rssi", ap_info.rssi);
+    if (is_associated) {
+        auto *ssid = reinterpret_cast<const char *>(ap_info.ssid);
+        cJSON_AddStringToObject(system_status_wifi_json, "ssid", std::string(ssid, strnlen(ssid, sizeof(ap_info.ssid))).c_str());
+        cJSON_AddNumberToObject(system_status_wifi_json, "rssi", ap_info.rssi);
+    } else {
+        cJSON_AddNullToObject(system_status_wifi_json, "ssid");
+        cJSON_AddNullToObject(system_status_wifi_json, "rssi");
+    }
     cJSON_AddItemToObject(system_status_json, "network", system_status_wifi_json);
 
+    auto system_status_connection_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(system_status_connection_json, "outages", ctx.connection.get_outages());
+    cJSON_AddNumberToObject(system_status_connection_json, "lastOutageMs", static_cast<double>(ctx.connection.get_last_outage_us() / 1000));
+    cJSON_AddNumberToObject(system_status_connection_json, "totalOutageMs", static_cast<double>(ctx.connection.get_total_outage_us() / 1000));
+    cJSON_AddItemToObject(system_status_json, "connection", system_status_connection_json);
+
     cJSON_AddNumberToObject(system_status_json, "uptime", esp_timer_get_time() / 1000 / 1000);
     cJSON_AddNumberToObject(system_status_json, "freeHeap", esp_get_free_heap_size());
     cJSON_AddNumberToObject(system_status_json, "minFreeHeap", esp_get_minimum_free_heap_size());
     cJSON_AddStringToObject(system_status_json, "firmwareVersion", esp_app_get_description()->version);
+    cJSON_AddNumberToObject(system_status_json, "partitionTable", get_partition_table_version());
+
+    auto frame_diff = ctx.frame_diff.get_last_summary();
+    auto system_status_display_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(system_status_display_json, "changedPixels", frame_diff.changed_pixels);
+    auto system_status_dirty_rects_json = cJSON_CreateArray();
+    for (const auto &rect : frame_diff.dirty_rects) {
+        auto rect_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(rect_json, "x", rect.x);
+        cJSON_AddNumberToObject(rect_json, "y", rect.y);
+        cJSON_AddNumberToObject(rect_json, "width", rect.width);
+        cJSON_AddNumberToObject(rect_json, "height", rect.height);
+        cJSON_AddItemToArray(system_status_dirty_rects_json, rect_json);
+    }
+    cJSON_AddItemToObject(system_status_display_json, "dirtyRects", system_status_dirty_rects_json);
+    auto temperature = ctx.waveform_selector.get_temperature();
+    if (temperature) {
+        cJSON_AddNumberToObject(system_status_display_json, "temperature", *temperature);
+    } else {
+        cJSON_AddNullToObject(system_status_display_json, "temperature");
+    }
+    cJSON_AddNumberToObject(system_status_display_json, "waveform", ctx.frames.get_waveform_id());
+    cJSON_AddItemToObject(system_status_json, "display", system_status_display_json);
+
+    // milliseconds since reset at which every boot phase finished, none if it has not yet
+    auto system_status_boot_json = cJSON_CreateObject();
+    for (int phase = 0; phase < to_underlying(BootPhase::COUNT); phase++) {
+        auto phase_name = string_format("%sMs", BootTimings::get_phase_name(static_cast<BootPhase>(phase)));
+        auto finished_at = ctx.boot_timings.get(static_cast<BootPhase>(phase));
+        if (finished_at) {
+            cJSON_AddNumberToObject(system_status_boot_json, phase_name.c_str(), static_cast<double>(*finished_at / 1000));
+        } else {
+            cJSON_AddNullToObject(system_status_boot_json, phase_name.c_str());
+        }
+    }
+    cJSON_AddItemToObject(system_status_json, "boot", system_status_boot_json);
 
     auto system_status_json_str = cJSON_PrintUnformatted(system_status_json);
     ctx.mqtt.publish<std::string>(panel_system_status_topic, { .data=system_status_json_str, .retain = Retain::Retained });
@@ -77,6 +116,99 @@ void publish_system_status(const TaskContext &ctx) {
     free(system_status_json_str);
 }
 
+void publish_metrics(const TaskContext &ctx) {
+    using idf::mqtt::Retain;
+
+    auto panel_metrics_topic = string_format("vsb-eink/%s/metrics", ctx.config.panel.panel_id.c_str());
+
+    auto metrics_json = cJSON_CreateObject();
+
+    auto metrics_frames_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(metrics_frames_json, "committed", ctx.metrics.get_committed_frames());
+    cJSON_AddNumberToObject(metrics_frames_json, "displayed", ctx.metrics.get_displayed_frames());
+    cJSON_AddItemToObject(metrics_json, "frames", metrics_frames_json);
+
+    auto metrics_latency_json = cJSON_CreateObject();
+    for (int stage = 0; stage < to_underlying(FrameStage::COUNT); stage++) {
+        auto summary = ctx.metrics.summarize(static_cast<FrameStage>(stage));
+
+        auto stage_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage_json, "samples", summary.samples);
+        cJSON_AddNumberToObject(stage_json, "minUs", summary.min_us);
+        cJSON_AddNumberToObject(stage_json, "avgUs", summary.avg_us);
+        cJSON_AddNumberToObject(stage_json, "p95Us", summary.p95_us);
+        cJSON_AddNumberToObject(stage_json, "maxUs", summary.max_us);
+        cJSON_AddItemToObject(metrics_latency_json, FrameMetrics::get_stage_name(static_cast<FrameStage>(stage)), stage_json);
+    }
+    cJSON_AddItemToObject(metrics_json, "latency", metrics_latency_json);
+
+    auto metrics_refresh_json = cJSON_CreateObject();
+    for (int decision = 0; decision < to_underlying(RefreshDecision::COUNT); decision++) {
+        auto decision_name = RefreshPolicy::get_decision_name(static_cast<RefreshDecision>(decision));
+        cJSON_AddNumberToObject(metrics_refresh_json, decision_name, ctx.metrics.get_refreshes(static_cast<RefreshDecision>(decision)));
+    }
+    cJSON_AddStringToObject(metrics_refresh_json, "last", RefreshPolicy::get_decision_name(ctx.metrics.get_last_refresh()));
+    cJSON_AddItemToObject(metrics_json, "refresh", metrics_refresh_json);
+
+    auto metrics_json_str = cJSON_PrintUnformatted(metrics_json);
+    ctx.mqtt.publish<std::string>(panel_metrics_topic, { .data=metrics_json_str, .retain = Retain::Retained });
+
+    cJSON_Delete(metrics_json);
+    free(metrics_json_str);
+}
+
+/**
+ * Reads a group of the panel config. The id ends up in topics, so it must not contain any topic separators
+ * or wildcards. Frames of a group with a canvas are cropped by whole bytes, so the crop is aligned to 8 pixels.
+ * @return none if the group is not valid
+ */
+static std::optional<PanelGroup> parse_group(const TaskContext &ctx, const cJSON *group_json) {
+    auto id_json = cJSON_GetObjectItem(group_json, "id");
+    if (!cJSON_IsString(id_json)) return std::nullopt;
+
+    std::string_view id = id_json->valuestring;
+    if (id.empty() || id.size() > PanelGroup::MAX_ID_LEN || id.find_first_of("/+#") != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    PanelGroup group{};
+    std::copy(id.begin(), id.end(), group.id);
+
+    auto get_number = [&](const char *name) {
+        auto number_json = cJSON_GetObjectItem(group_json, name);
+        return cJSON_IsNumber(number_json) ? static_cast<uint16_t>(std::clamp(number_json->valueint, 0, UINT16_MAX)) : 0;
+    };
+    group.canvas_width = get_number("canvas_width");
+    group.canvas_height = get_number("canvas_height");
+    group.crop_x = get_number("crop_x");
+    group.crop_y = get_number("crop_y");
+    if (group.canvas_width == 0) {
+        group.canvas_height = group.crop_x = group.crop_y = 0;
+        return group;
+    }
+
+    auto is_crop_valid = group.canvas_width % 8 == 0 && group.crop_x % 8 == 0
+        && group.crop_x + ctx.inkplate.einkWidth() <= group.canvas_width
+        && group.crop_y + ctx.inkplate.einkHeight() <= group.canvas_height;
+    if (!is_crop_valid) return std::nullopt;
+    return group;
+}
+
+/**
+ * Reads a dotted IPv4 address of the IP config, a missing one stays 0.
+ * @return false if the address is not valid
+ */
+static bool parse_ip_address(const cJSON *ip_config_json, const char *name, uint32_t &address) {
+    auto address_json = cJSON_GetObjectItem(ip_config_json, name);
+    if (address_json == nullptr || cJSON_IsNull(address_json)) return true;
+    if (!cJSON_IsString(address_json)) return false;
+
+    esp_ip4_addr_t ip{};
+    if (esp_netif_str_to_ip4(address_json->valuestring, &ip) != ESP_OK) return false;
+    address = ip.addr;
+    return true;
+}
+
 void update_config_handler(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
     auto data = event->data;
     auto data_len = event->data_len;
@@ -96,28 +228,125 @@ void update_config_handler(const TaskContext &ctx, const esp_mqtt_event_handle_t
     auto panel_config_json = cJSON_GetObjectItem(config_json, "panel");
     auto wifi_config_json = cJSON_GetObjectItem(config_json, "wifi");
     auto mqtt_config_json = cJSON_GetObjectItem(config_json, "mqtt");
+    auto sleep_config_json = cJSON_GetObjectItem(config_json, "sleep");
+    auto ip_config_json = cJSON_GetObjectItem(config_json, "ip");
 
     // update panel config
     bool panel_config_changed = false;
     if (cJSON_IsObject(panel_config_json)) {
         auto panel_id_json = cJSON_GetObjectItem(panel_config_json, "panel_id");
         auto waveform_json = cJSON_GetObjectItem(panel_config_json, "waveform");
+        auto refresh_policy_json = cJSON_GetObjectItem(panel_config_json, "refresh_policy");
+        auto waveform_bands_json = cJSON_GetObjectItem(panel_config_json, "waveform_bands");
+        auto groups_json = cJSON_GetObjectItem(panel_config_json, "groups");
+        auto panel_config = ctx.config.panel;
 
         if (cJSON_IsString(panel_id_json)) {
-            ctx.config.set_panel_config({
-                .panel_id = panel_id_json->valuestring,
-                .waveform = ctx.config.panel.waveform
-            });
+            panel_config.panel_id = panel_id_json->valuestring;
             panel_config_changed = true;
         }
 
         if (cJSON_IsNumber(waveform_json)) {
-            ctx.config.set_panel_config({
-                .panel_id = ctx.config.panel.panel_id,
-                .waveform = static_cast<uint8_t>(waveform_json->valueint)
-            });
+            auto waveform_id = static_cast<uint8_t>(waveform_json->valueint);
+            auto waveform = ctx.waveforms.get(waveform_id);
+
+            if (waveform) {
+                ctx.frames.set_waveform(waveform_id, *waveform);
+                panel_config.waveform = waveform_id;
+                panel_config_changed = true;
+            } else if (waveform_id == 0) {
+                ESP_LOGW(TAG, "The default waveform of the Inkplate library is restored only after a reboot");
+                panel_config.waveform = waveform_id;
+                panel_config_changed = true;
+            } else {
+                ESP_LOGE(TAG, "Waveform %d does not exist", waveform_id);
+            }
+        }
+
+        if (cJSON_IsObject(refresh_policy_json)) {
+            auto ghosting_threshold_json = cJSON_GetObjectItem(refresh_policy_json, "ghosting_threshold");
+            auto partial_update_cost_json = cJSON_GetObjectItem(refresh_policy_json, "partial_update_cost");
+            auto full_refresh_ratio_json = cJSON_GetObjectItem(refresh_policy_json, "full_refresh_ratio");
+            auto &refresh_policy = panel_config.refresh_policy;
+
+            if (cJSON_IsNumber(ghosting_threshold_json)) {
+                refresh_policy.ghosting_threshold = static_cast<uint16_t>(std::clamp(ghosting_threshold_json->valueint, 1, UINT16_MAX));
+            }
+            if (cJSON_IsNumber(partial_update_cost_json)) {
+                refresh_policy.partial_update_cost = static_cast<uint8_t>(std::clamp(partial_update_cost_json->valueint, 0, UINT8_MAX));
+            }
+            if (cJSON_IsNumber(full_refresh_ratio_json)) {
+                refresh_policy.full_refresh_ratio = static_cast<uint8_t>(std::clamp(full_refresh_ratio_json->valueint, 0, 100));
+            }
+
+            ctx.frames.set_refresh_policy_config(refresh_policy);
             panel_config_changed = true;
         }
+
+        if (cJSON_IsArray(waveform_bands_json)) {
+            std::vector<TemperatureBand> waveform_bands;
+            auto is_valid = cJSON_GetArraySize(waveform_bands_json) <= static_cast<int>(Config::MAX_WAVEFORM_BANDS);
+
+            cJSON *band_json;
+            cJSON_ArrayForEach(band_json, waveform_bands_json) {
+                if (!is_valid) break;
+
+                auto max_temperature_json = cJSON_GetObjectItem(band_json, "max_temperature");
+                auto band_waveform_json = cJSON_GetObjectItem(band_json, "waveform");
+                is_valid = cJSON_IsNumber(max_temperature_json) && cJSON_IsNumber(band_waveform_json);
+                if (!is_valid) break;
+
+                // custom waveforms may be uploaded after the bands referencing them
+                auto band_waveform_id = static_cast<uint8_t>(band_waveform_json->valueint);
+                is_valid = ctx.waveforms.get(band_waveform_id).has_value() || WaveformLibrary::is_custom(band_waveform_id);
+                waveform_bands.push_back({
+                    .max_temperature = static_cast<int8_t>(std::clamp(max_temperature_json->valueint, INT8_MIN, INT8_MAX)),
+                    .waveform = band_waveform_id
+                });
+            }
+
+            if (is_valid) {
+                ctx.waveform_selector.set_bands(waveform_bands);
+                panel_config.waveform_bands = waveform_bands;
+                panel_config_changed = true;
+
+                // without bands the panel goes back to the static waveform
+                auto waveform = ctx.waveforms.get(panel_config.waveform);
+                if (waveform_bands.empty() && waveform) {
+                    ctx.frames.set_waveform(panel_config.waveform, *waveform);
+                }
+            } else {
+                ESP_LOGE(TAG, "Invalid waveform bands JSON, expected at most %d bands with max_temperature and an existing waveform",
+                         static_cast<int>(Config::MAX_WAVEFORM_BANDS));
+            }
+        }
+
+        if (cJSON_IsArray(groups_json)) {
+            std::vector<PanelGroup> groups;
+            auto is_valid = cJSON_GetArraySize(groups_json) <= static_cast<int>(Config::MAX_GROUPS);
+
+            cJSON *group_json;
+            cJSON_ArrayForEach(group_json, groups_json) {
+                if (!is_valid) break;
+
+                auto group = parse_group(ctx, group_json);
+                is_valid = group.has_value();
+                if (is_valid) groups.push_back(*group);
+            }
+
+            if (is_valid) {
+                ESP_LOGW(TAG, "The groups are joined only after the next reboot");
+                panel_config.groups = groups;
+                panel_config_changed = true;
+            } else {
+                ESP_LOGE(TAG, "Invalid groups JSON, expected at most %d groups with an id and a crop within the canvas",
+                         static_cast<int>(Config::MAX_GROUPS));
+            }
+        }
+
+        if (panel_config_changed) {
+            ctx.config.set_panel_config(panel_config);
+        }
     }
 
     // update wifi config
@@ -138,6 +367,24 @@ void update_config_handler(const TaskContext &ctx, const esp_mqtt_event_handle_t
         wifi_config_changed = true;
     }
 
+    // update ip config, an address of 0 means DHCP
+    bool ip_config_changed = false;
+    if (cJSON_IsObject(ip_config_json)) {
+        IpConfig ip_config{};
+        auto is_valid = parse_ip_address(ip_config_json, "address", ip_config.address)
+            && parse_ip_address(ip_config_json, "netmask", ip_config.netmask)
+            && parse_ip_address(ip_config_json, "gateway", ip_config.gateway)
+            && parse_ip_address(ip_config_json, "dns", ip_config.dns);
+
+        if (!is_valid || (ip_config.address != 0 && (ip_config.netmask == 0 || ip_config.gateway == 0))) {
+            ESP_LOGE(TAG, "Invalid ip config JSON, a static address needs a netmask and a gateway");
+        } else {
+            ESP_LOGW(TAG, "The ip config is used only after the next reboot");
+            ctx.config.set_ip_config(ip_config);
+            ip_config_changed = true;
+        }
+    }
+
     // update mqtt config
     bool mqtt_config_changed = false;
     if (cJSON_IsObject(mqtt_config_json)) {
@@ -151,21 +398,135 @@ void update_config_handler(const TaskContext &ctx, const esp_mqtt_event_handle_t
         }
     }
 
+    // update sleep config
+    bool sleep_config_changed = false;
+    if (cJSON_IsObject(sleep_config_json)) {
+        auto power_save_json = cJSON_GetObjectItem(sleep_config_json, "power_save");
+        auto deep_sleep_interval_json = cJSON_GetObjectItem(sleep_config_json, "deep_sleep_interval");
+        auto awake_time_json = cJSON_GetObjectItem(sleep_config_json, "awake_time");
+        auto sleep_config = ctx.config.sleep;
+
+        if (cJSON_IsBool(power_save_json)) {
+            sleep_config.power_save = cJSON_IsTrue(power_save_json);
+        }
+        if (cJSON_IsNumber(deep_sleep_interval_json)) {
+            sleep_config.deep_sleep_interval = static_cast<uint32_t>(std::clamp(deep_sleep_interval_json->valueint, 0, MAX_DEEP_SLEEP_INTERVAL));
+        }
+        if (cJSON_IsNumber(awake_time_json)) {
+            sleep_config.awake_time = static_cast<uint16_t>(std::clamp(awake_time_json->valueint, MIN_AWAKE_TIME, UINT16_MAX));
+        }
+
+        if (sleep_config.deep_sleep_interval != 0 && ctx.config.sleep.deep_sleep_interval == 0) {
+            ESP_LOGW(TAG, "The persistent MQTT session is used only after the next reboot");
+        }
+
+        ctx.config.set_sleep_config(sleep_config);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(configure_power_management(sleep_config));
+        sleep_config_changed = true;
+    }
+
     // commit changes
     if (panel_config_changed) ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.config.commit_panel_config());
     if (wifi_config_changed) ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.config.commit_wifi_config());
     if (mqtt_config_changed) ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.config.commit_mqtt_config());
+    if (ip_config_changed) ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.config.commit_ip_config());
+    if (sleep_config_changed) ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.config.commit_sleep_config());
+}
+
+void update_waveform_handler(const TaskContext &ctx, const esp_mqtt_event_handle_t event) {
+    if (event->data_len != event->total_data_len) {
+        ESP_LOGE(TAG, "Waveform update got a chunked response, which is not supported");
+        return;
+    }
+
+    // the id is the second to last topic level, vsb-eink/{panelId}/waveform/{id}/set
+    auto topic_id = get_topic_id(std::string_view(event->topic, event->topic_len), UINT8_MAX);
+    if (!topic_id) {
+        ESP_LOGE(TAG, "Waveform id must be a number from 0 to %d", UINT8_MAX);
+        return;
+    }
+
+    auto waveform_id = static_cast<uint8_t>(*topic_id);
+    if (!WaveformLibrary::is_custom(waveform_id)) {
+        ESP_LOGE(TAG, "Waveform %d is not a custom waveform", waveform_id);
+        return;
+    }
+
+    // an empty message removes the waveform
+    if (event->data_len == 0) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.waveforms.erase_custom(waveform_id));
+        return;
+    }
+
+    auto waveform_json = cJSON_ParseWithLength(event->data, event->data_len);
+    Waveform waveform{};
+    auto is_waveform_valid = cJSON_IsArray(waveform_json) && cJSON_GetArraySize(waveform_json) == static_cast<int>(waveform.size());
+    for (size_t level = 0; is_waveform_valid && level < waveform.size(); level++) {
+        auto level_json = cJSON_GetArrayItem(waveform_json, static_cast<int>(level));
+        is_waveform_valid = cJSON_IsArray(level_json) && cJSON_GetArraySize(level_json) == static_cast<int>(waveform[level].size());
+
+        for (size_t phase = 0; is_waveform_valid && phase < waveform[level].size(); phase++) {
+            auto phase_json = cJSON_GetArrayItem(level_json, static_cast<int>(phase));
+            is_waveform_valid = cJSON_IsNumber(phase_json) && phase_json->valueint >= 0 && phase_json->valueint <= 3;
+            if (is_waveform_valid) waveform[level][phase] = static_cast<uint8_t>(phase_json->valueint);
+        }
+    }
+    cJSON_Delete(waveform_json);
+
+    if (!is_waveform_valid) {
+        ESP_LOGE(TAG, "Invalid waveform JSON, expected 8 levels of 9 phases valued 0 to 3");
+        return;
+    }
+
+    auto err = ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.waveforms.set_custom(waveform_id, waveform));
+    if (err == ESP_OK && ctx.frames.get_waveform_id() == waveform_id) {
+        ESP_LOGI(TAG, "Applying updated waveform %d", waveform_id);
+        ctx.frames.set_waveform(waveform_id, waveform);
+    }
+}
+
+/**
+ * Tells whether the panel may go to deep sleep. It stays awake for a while after booting and after every frame,
+ * so the frames queued by the broker and the ones following them get through, and until the frame is cached.
+ */
+bool is_deep_sleep_due(const TaskContext &ctx, const OtaUpdater &ota_updater) {
+    auto sleep_config = ctx.config.sleep;
+    if (sleep_config.deep_sleep_interval == 0 || ota_updater.is_update_running()) return false;
+
+    auto awake_until = ctx.frames.get_last_committed_at() + sleep_config.awake_time * 1000LL * 1000;
+    if (esp_timer_get_time() < awake_until) return false;
+
+    // the panel keeps showing the frame while asleep, it has to be cached to be known after waking up
+    ctx.frames.flush_cache();
+    return ctx.frames.is_settled();
+}
+
+[[noreturn]]
+void enter_deep_sleep(const TaskContext &ctx) {
+    auto deep_sleep_interval = ctx.config.sleep.deep_sleep_interval;
+    ESP_LOGI(TAG, "Entering deep sleep for %lu s", static_cast<unsigned long>(deep_sleep_interval));
+
+    // a clean disconnect keeps the persistent session, so the broker queues the messages sent in the meantime
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.mqtt.disconnect());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_stop());
+
+    // touching a pad wakes the panel up early
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_sleep_enable_timer_wakeup(static_cast<uint64_t>(deep_sleep_interval) * 1000 * 1000));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_sleep_enable_ext0_wakeup(InkplateTouchpad::INTERRUPT_PIN, 1));
+    esp_deep_sleep_start();
 }
 
 [[noreturn]]
 void system_task(const TaskContext &ctx) {
     using idf::mqtt::Filter;
+    using idf::mqtt::QoS;
     using idf::mqtt::Retain;
     auto panel_id = ctx.config.panel.panel_id;
 
     auto update_panel_config_topic = string_format("vsb-eink/%s/config/set", panel_id.c_str());
     ctx.mqtt.register_handler({
         .filter = Filter(update_panel_config_topic),
+        .qos = QoS::AtLeastOnce,
         .callback = [&](const esp_mqtt_event_handle_t event) { update_config_handler(ctx, event); }
     });
 
@@ -175,18 +536,36 @@ void system_task(const TaskContext &ctx) {
         .callback = reboot_handler
     });
 
+    auto update_panel_waveform_topic = string_format("vsb-eink/%s/waveform/+/set", panel_id.c_str());
+    ctx.mqtt.register_handler({
+        .filter = Filter(update_panel_waveform_topic),
+        .callback = [&](const esp_mqtt_event_handle_t event) { update_waveform_handler(ctx, event); }
+    });
+
     auto update_panel_firmware_topic = string_format("vsb-eink/%s/firmware/update/set", panel_id.c_str());
+    auto panel_firmware_status_topic = string_format("vsb-eink/%s/firmware/update/status", panel_id.c_str());
+    OtaUpdater ota_updater(ctx.mqtt, panel_firmware_status_topic);
     ctx.mqtt.register_handler({
         .filter = Filter(update_panel_firmware_topic),
-        .callback = perform_ota_update_handler
+        .callback = [&](const esp_mqtt_event_handle_t event) { ota_updater.on_data(event); }
     });
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ctx.mqtt.release_connection());
 
     DebounceTimer system_status_debounce_timer(std::chrono::milliseconds(3000));
+    DebounceTimer metrics_debounce_timer(std::chrono::milliseconds(10000));
     for (;;) {
         if (system_status_debounce_timer.tick()) {
             publish_system_status(ctx);
         }
 
+        if (metrics_debounce_timer.tick()) {
+            publish_metrics(ctx);
+        }
+
+        if (is_deep_sleep_due(ctx, ota_updater)) {
+            enter_deep_sleep(ctx);
+        }
+
         vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
 }
\ No newline at end of file
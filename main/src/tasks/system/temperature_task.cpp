@@ -0,0 +1,29 @@
+#include "temperature_task.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+static constexpr auto *TAG = "temperature_task";
+
+// the panel heats up and cools down slowly, there is no point in sampling more often
+static constexpr int SAMPLE_INTERVAL_MS = 60 * 1000;
+
+[[noreturn]]
+void temperature_task(const TaskContext &ctx) {
+    for (;;) {
+        vTaskDelay(SAMPLE_INTERVAL_MS / portTICK_PERIOD_MS);
+
+        auto waveform_id = ctx.waveform_selector.update();
+        if (!waveform_id) continue;
+
+        auto waveform = ctx.waveforms.get(*waveform_id);
+        if (!waveform) {
+            ESP_LOGE(TAG, "Waveform %d of the temperature band does not exist", *waveform_id);
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Panel temperature is %d °C, switching to waveform %d", ctx.waveform_selector.get_temperature().value_or(0), *waveform_id);
+        ctx.frames.set_waveform(*waveform_id, *waveform);
+    }
+}
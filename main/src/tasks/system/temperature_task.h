@@ -0,0 +1,6 @@
+#pragma once
+
+#include "tasks/common.h"
+
+[[noreturn]]
+void temperature_task(const TaskContext &ctx);
@@ -0,0 +1,56 @@
+#include "waveform_selector.h"
+
+#include <algorithm>
+#include <climits>
+
+std::optional<size_t> select_temperature_band(const std::vector<TemperatureBand> &bands, const int temperature, const std::optional<size_t> current_band, const int hysteresis) {
+    if (bands.empty()) return std::nullopt;
+    auto last_band = bands.size() - 1;
+
+    if (current_band && *current_band <= last_band) {
+        auto lower_bound = *current_band == 0 ? INT_MIN : bands[*current_band - 1].max_temperature - hysteresis;
+        auto upper_bound = *current_band == last_band ? INT_MAX : bands[*current_band].max_temperature + hysteresis;
+        if (temperature > lower_bound && temperature <= upper_bound) return current_band;
+    }
+
+    for (size_t band = 0; band < last_band; band++) {
+        if (temperature <= bands[band].max_temperature) return band;
+    }
+    return last_band;
+}
+
+WaveformSelector::WaveformSelector(TemperatureSensor sensor):
+        sensor{std::move(sensor)},
+        bands{},
+        current_band{},
+        temperature{} {}
+
+void WaveformSelector::set_bands(std::vector<TemperatureBand> bands) {
+    std::sort(bands.begin(), bands.end(), [](const auto &a, const auto &b) { return a.max_temperature < b.max_temperature; });
+
+    std::lock_guard lock(mutex);
+    this->bands = std::move(bands);
+    this->current_band.reset();
+}
+
+/**
+ * Samples the sensor and tells which waveform to switch to, if the temperature moved into another band.
+ */
+std::optional<uint8_t> WaveformSelector::update() {
+    auto sample = sensor();
+
+    std::lock_guard lock(mutex);
+    if (!sample) return std::nullopt;
+    temperature = sample;
+
+    auto band = select_temperature_band(bands, *sample, current_band, HYSTERESIS);
+    if (!band || band == current_band) return std::nullopt;
+
+    current_band = band;
+    return bands[*band].waveform;
+}
+
+std::optional<int> WaveformSelector::get_temperature() {
+    std::lock_guard lock(mutex);
+    return temperature;
+}
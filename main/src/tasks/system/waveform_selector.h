@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "config.h"
+
+/**
+ * Picks the band a temperature falls into. Band i covers the temperatures above the maximum of band i - 1
+ * up to its own maximum, the last band covers everything above. To keep a temperature hovering around a bound
+ * from switching waveforms back and forth, the current band is only left once it is exceeded by the hysteresis.
+ * @param bands Temperature bands sorted by their maximum temperature
+ * @param temperature Temperature in °C
+ * @param current_band Index of the band selected last time, if any
+ * @param hysteresis Hysteresis in °C
+ * @return Index of the band, none if there are no bands
+ */
+std::optional<size_t> select_temperature_band(const std::vector<TemperatureBand> &bands, int temperature, std::optional<size_t> current_band, int hysteresis);
+
+/**
+ * Selects the waveform for the current panel temperature, the sensor is injected so the logic runs anywhere.
+ */
+class WaveformSelector {
+public:
+    using TemperatureSensor = std::function<std::optional<int>()>;
+
+    explicit WaveformSelector(TemperatureSensor sensor);
+
+    void set_bands(std::vector<TemperatureBand> bands);
+    std::optional<uint8_t> update();
+    std::optional<int> get_temperature();
+private:
+    static constexpr int HYSTERESIS = 2;
+
+    TemperatureSensor sensor;
+    std::mutex mutex;
+    std::vector<TemperatureBand> bands;
+    std::optional<size_t> current_band;
+    std::optional<int> temperature;
+};
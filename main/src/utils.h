@@ -1,10 +1,13 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <memory>
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <optional>
 
 template <typename E>
 constexpr auto to_underlying(E e) noexcept {
@@ -46,4 +49,14 @@ private:
     std::chrono::steady_clock::time_point last_state_change;
 };
 
+/**
+ * Reads the id in the second to last level of a topic, e.g. vsb-eink/{panelId}/assets/{id}/set.
+ * @param topic The topic
+ * @param max Largest valid id
+ * @return The id, none unless the level is a decimal number from 0 to max
+ */
+std::optional<uint32_t> get_topic_id(std::string_view topic, uint32_t max);
+
+extern const uint8_t reverse_bits_table[256];
+
 uint8_t reverse_bits(uint8_t n);
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "wifi.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+static constexpr auto *TAG = "WifiClient";
+
+WifiClient::WifiClient():
+        netif{nullptr},
+        is_started{false},
+        status{ConnectionStatus::FAILED},
+        status_callback{},
+        connect_attempts{0},
+        connected_ap{} {}
+
+esp_err_t WifiClient::begin() {
+    auto err = esp_netif_init();
+    if (err != ESP_OK) return err;
+
+    // someone else may have created the default event loop already
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err;
+
+    netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+    err = esp_wifi_init(&init_config);
+    if (err != ESP_OK) return err;
+
+    err = esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, on_event, this, nullptr);
+    if (err != ESP_OK) return err;
+    err = esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, on_event, this, nullptr);
+    if (err != ESP_OK) return err;
+
+    // the credentials live in the config, storing them in flash again would only slow down every connection
+    err = esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    if (err != ESP_OK) return err;
+
+    return esp_wifi_set_mode(WIFI_MODE_STA);
+}
+
+/**
+ * Starts connecting to a network without waiting for the connection.
+ * @param config Credentials of the network
+ * @param cache Access point to join directly, a scan over all channels is done without it
+ * @param ip Static IP configuration, DHCP is used if it has no address
+ */
+esp_err_t WifiClient::connect(const WifiConfig &config, const std::optional<WifiCache> &cache, const IpConfig &ip) {
+    wifi_config_t wifi_config{};
+    std::strncpy(reinterpret_cast<char *>(wifi_config.sta.ssid), config.ssid.c_str(), sizeof(wifi_config.sta.ssid));
+    std::strncpy(reinterpret_cast<char *>(wifi_config.sta.password), config.password.c_str(), sizeof(wifi_config.sta.password));
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    if (cache) {
+        wifi_config.sta.bssid_set = true;
+        std::copy(std::begin(cache->bssid), std::end(cache->bssid), std::begin(wifi_config.sta.bssid));
+        wifi_config.sta.channel = cache->channel;
+    }
+
+    {
+        std::lock_guard lock(status_mutex);
+        status = ConnectionStatus::CONNECTING;
+        connect_attempts = 0;
+        connected_ap.reset();
+    }
+
+    if (is_started) esp_wifi_disconnect();
+
+    auto err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) return err;
+
+    err = configure_ip(ip);
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Connecting to %s%s%s", config.ssid.c_str(), cache ? ", cached access point" : "", ip.address != 0 ? ", static IP" : "");
+    if (!is_started) {
+        // the connection is made once the station has started, see on_event
+        is_started = true;
+        return esp_wifi_start();
+    }
+    return esp_wifi_connect();
+}
+
+esp_err_t WifiClient::configure_ip(const IpConfig &ip) {
+    if (ip.address == 0) {
+        auto err = esp_netif_dhcpc_start(netif);
+        return err == ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED ? ESP_OK : err;
+    }
+
+    auto err = esp_netif_dhcpc_stop(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) return err;
+
+    esp_netif_ip_info_t ip_info{};
+    ip_info.ip.addr = ip.address;
+    ip_info.netmask.addr = ip.netmask;
+    ip_info.gw.addr = ip.gateway;
+    err = esp_netif_set_ip_info(netif, &ip_info);
+    if (err != ESP_OK) return err;
+
+    esp_netif_dns_info_t dns_info{};
+    dns_info.ip.u_addr.ip4.addr = ip.dns != 0 ? ip.dns : ip.gateway;
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    return esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info);
+}
+
+void WifiClient::set_status(const ConnectionStatus status) {
+    {
+        std::lock_guard lock(status_mutex);
+        this->status = status;
+    }
+    status_changed.notify_all();
+    if (status_callback) status_callback();
+}
+
+WifiClient::ConnectionStatus WifiClient::wait_for_connection(const std::chrono::milliseconds timeout) {
+    std::unique_lock lock(status_mutex);
+    status_changed.wait_for(lock, timeout, [this] { return status != ConnectionStatus::CONNECTING; });
+    return status;
+}
+
+WifiClient::ConnectionStatus WifiClient::get_status() const {
+    std::lock_guard lock(status_mutex);
+    return status;
+}
+
+/**
+ * Sets a callback called from the event loop whenever the connection status changes, it must not block.
+ * Has to be set before connecting.
+ */
+void WifiClient::set_status_callback(const std::function<void()> &callback) {
+    status_callback = callback;
+}
+
+std::optional<WifiCache> WifiClient::get_connected_ap() const {
+    std::lock_guard lock(status_mutex);
+    return connected_ap;
+}
+
+void WifiClient::on_event(void *arg, const esp_event_base_t event_base, const int32_t event_id, void *event_data) {
+    auto client = static_cast<WifiClient *>(arg);
+
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        auto event = static_cast<wifi_event_sta_connected_t *>(event_data);
+        WifiCache ap{};
+        std::copy(std::begin(event->bssid), std::end(event->bssid), std::begin(ap.bssid));
+        ap.channel = event->channel;
+
+        std::lock_guard lock(client->status_mutex);
+        client->connected_ap = ap;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        auto event = static_cast<wifi_event_sta_disconnected_t *>(event_data);
+        ESP_LOGW(TAG, "Disconnected, reason %d", event->reason);
+
+        std::unique_lock lock(client->status_mutex);
+        if (client->status == ConnectionStatus::CONNECTED) {
+            client->connect_attempts = 0;
+        }
+        if (client->status == ConnectionStatus::FAILED || ++client->connect_attempts > MAX_CONNECT_ATTEMPTS) {
+            lock.unlock();
+            client->set_status(ConnectionStatus::FAILED);
+            return;
+        }
+        lock.unlock();
+        client->set_status(ConnectionStatus::CONNECTING);
+        esp_wifi_connect();
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        auto event = static_cast<ip_event_got_ip_t *>(event_data);
+        ESP_LOGI(TAG, "Got IP " IPSTR, IP2STR(&event->ip_info.ip));
+        client->set_status(ConnectionStatus::CONNECTED);
+    }
+}
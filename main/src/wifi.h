@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+#include <esp_err.h>
+#include <esp_event.h>
+#include <esp_netif.h>
+
+#include "config.h"
+
+/**
+ * Connects to Wi-Fi in the background, so the panel can be refreshed in the meantime. Joining the access point
+ * the panel was connected to last time skips the scan and a static IP address skips DHCP, together they cut
+ * the time to a usable connection down to a fraction.
+ */
+class WifiClient {
+public:
+    enum ConnectionStatus {
+        FAILED,
+        CONNECTING,
+        CONNECTED
+    };
+
+    WifiClient();
+    WifiClient(WifiClient const&) = delete;
+    void operator=(WifiClient const&) = delete;
+
+    esp_err_t begin();
+    esp_err_t connect(const WifiConfig &config, const std::optional<WifiCache> &cache, const IpConfig &ip);
+    ConnectionStatus wait_for_connection(std::chrono::milliseconds timeout);
+    [[nodiscard]] ConnectionStatus get_status() const;
+    [[nodiscard]] std::optional<WifiCache> get_connected_ap() const;
+    void set_status_callback(const std::function<void()> &callback);
+private:
+    static constexpr int MAX_CONNECT_ATTEMPTS = 3;
+
+    static void on_event(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+    void set_status(ConnectionStatus status);
+    esp_err_t configure_ip(const IpConfig &ip);
+
+    esp_netif_t *netif;
+    bool is_started;
+
+    mutable std::mutex status_mutex;
+    std::condition_variable status_changed;
+    ConnectionStatus status;
+    std::function<void()> status_callback;
+    int connect_attempts;
+    std::optional<WifiCache> connected_ap;
+};
@@ -1,10 +1,41 @@
 #!/usr/bin/env python
 import pathlib
+import zlib
 from argparse import ArgumentParser
 from PIL import Image
 
 INKPLATE_WIDTH = 1200
 INKPLATE_HEIGHT = 825
+PACKBITS_MAX_RUN = 128
+
+
+def encode_packbits(data: bytes) -> bytearray:
+    """Encodes data with PackBits, runs of 3 or more equal bytes are repeated, the rest is stored as literals"""
+    encoded = bytearray()
+    literal_start = 0
+    i = 0
+
+    def flush_literals(end):
+        for start in range(literal_start, end, PACKBITS_MAX_RUN):
+            chunk = data[start:min(start + PACKBITS_MAX_RUN, end)]
+            encoded.append(len(chunk) - 1)
+            encoded.extend(chunk)
+
+    while i < len(data):
+        run_end = i + 1
+        while run_end < len(data) and run_end - i < PACKBITS_MAX_RUN and data[run_end] == data[i]:
+            run_end += 1
+
+        if run_end - i >= 3:
+            flush_literals(i)
+            encoded.append(257 - (run_end - i))
+            encoded.append(data[i])
+            literal_start = run_end
+
+        i = run_end
+
+    flush_literals(len(data))
+    return encoded
 
 
 def main():
@@ -12,6 +43,11 @@ def main():
     args_parser.add_argument('input', help='path to input file', type=pathlib.Path)
     args_parser.add_argument('output', help='path to output file', type=pathlib.Path)
     args_parser.add_argument("--mode", choices=["1bpp", "4bpp"], default="1bpp", help="file format version")
+    args_parser.add_argument("--compression", choices=["none", "rle"], default="none",
+                             help="payload compression, rle output is meant for the display/rle_*/set topics")
+    args_parser.add_argument("--delta-base", type=pathlib.Path,
+                             help="uncompressed raw frame the panel currently shows, the output is then a PackBits "
+                                  "encoded XOR delta against it meant for the display/raw_*/delta/{base hash} topics")
 
     args = args_parser.parse_args()
 
@@ -25,28 +61,44 @@ def main():
     if args.mode == "1bpp":
         image = image.convert("1")
 
-        # 4. save 1bpp
+        # 4. pack 1bpp
         pixels = image.getdata()
-        with open(args.output, "wb") as output_file:
-            for pixel_i in range(0, len(pixels), 8):
-                byte = 0
-                for bit_i in range(8):
-                    pixel = pixels[pixel_i + bit_i]
-                    if pixel == 0:
-                        byte |= 1 << bit_i
-                output_file.write(byte.to_bytes(1, byteorder="big"))
+        frame = bytearray()
+        for pixel_i in range(0, len(pixels), 8):
+            byte = 0
+            for bit_i in range(8):
+                pixel = pixels[pixel_i + bit_i]
+                if pixel == 0:
+                    byte |= 1 << bit_i
+            frame.append(byte)
     else:
         image = image.convert("L", palette=Image.ADAPTIVE, colors=8)
 
-        # 4. save 4bpp
+        # 4. pack 4bpp
         pixels = image.getdata()
-        with open(args.output, "wb") as output_file:
-            for pixel_i in range(0, len(pixels), 2):
-                byte = 0
-                for bit_i in range(2):
-                    pixel = pixels[pixel_i + bit_i] // 32
-                    byte |= pixel << (bit_i * 4)
-                output_file.write(byte.to_bytes(1, byteorder="big"))
+        frame = bytearray()
+        for pixel_i in range(0, len(pixels), 2):
+            byte = 0
+            for bit_i in range(2):
+                pixel = pixels[pixel_i + bit_i] // 32
+                byte |= pixel << (bit_i * 4)
+            frame.append(byte)
+
+    # 5. hash, the panel skips frames sent to display/*/set/{hash} when it already shows them
+    print(f"{zlib.crc32(frame):08x}")
+
+    # 6. compress and save, a delta flips only the pixels which differ from the base frame
+    if args.delta_base:
+        base = args.delta_base.read_bytes()
+        if len(base) != len(frame):
+            args_parser.error(f"delta base has {len(base)} bytes, expected {len(frame)} bytes")
+        print(f"base {zlib.crc32(base):08x}")
+        frame = encode_packbits(bytes(a ^ b for a, b in zip(frame, base)))
+    elif args.compression == "rle":
+        frame = encode_packbits(frame)
+
+    with open(args.output, "wb") as output_file:
+        output_file.write(frame)
 
 
 if __name__ == '__main__':